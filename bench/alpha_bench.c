@@ -0,0 +1,80 @@
+/**
+ * alpha_bench.c - Opaque against translucent span fills
+ *
+ * Build with `make bench` and run ./build/alpha_bench
+ * Fills rectangles of a few widths with an opaque and a translucent color,
+ * then checks the SIMD blend kernel against _blend_pixel() on random pixels.
+ */
+
+#include "../src/p5c.c"
+
+#include <stdio.h>
+
+#define RECT_COUNT 2000
+#define ALPHA_ITERATIONS 5
+#define CHECK_PIXELS 4099
+
+void setup(void) {}
+void draw(void) {}
+
+// Milliseconds of the fastest pass over RECT_COUNT w x 64 rectangles
+static double _measure(int w) {
+    double best = 1e30;
+    for (int i = 0; i < ALPHA_ITERATIONS; i++) {
+        background(255, 255, 255);
+        uint64_t start = _monotonic_ns();
+        for (int j = 0; j < RECT_COUNT; j++) {
+            rect((j * 37) % (width - w + 1), (j * 53) % (height - 63), w, 64);
+        }
+        double ms = (_monotonic_ns() - start) / 1e6;
+        if (ms < best) best = ms;
+    }
+    return best;
+}
+
+// Pixels where the span kernel disagrees with the scalar blend
+static int _kernel_errors(void) {
+    static uint32_t expected[CHECK_PIXELS], actual[CHECK_PIXELS];
+    int errors = 0;
+    for (int alpha = 0; alpha < 256; alpha += 15) {
+        Color c = {(uint8_t)randomf(0, 256), (uint8_t)randomf(0, 256), (uint8_t)randomf(0, 256)};
+        uint32_t color = _pack_color(c, (uint8_t)alpha);
+        for (int i = 0; i < CHECK_PIXELS; i++) {
+            // Premultiplied destination pixels, as in layers
+            Color d = {(uint8_t)randomf(0, 256), (uint8_t)randomf(0, 256), (uint8_t)randomf(0, 256)};
+            actual[i] = _pack_color(d, (uint8_t)randomf(0, 256));
+            expected[i] = _blend_pixel(actual[i], color);
+        }
+        // Start off a 16-byte boundary so the unaligned paths run too
+        actual[0] = expected[0];
+        _blend_row_color(actual + 1, CHECK_PIXELS - 1, color);
+        for (int i = 0; i < CHECK_PIXELS; i++) {
+            if (actual[i] != expected[i]) errors++;
+        }
+    }
+    return errors;
+}
+
+int main(void) {
+    size(1280, 720);
+    _init_framebuffer();
+    noStroke();
+
+    printf("%d rects of w x 64 at %dx%d\n", RECT_COUNT, width, height);
+    printf("%-8s %12s %12s %12s\n", "width", "opaque ms", "alpha ms", "Mpix/s");
+    int widths[] = {8, 64, 512, 1280};
+    for (int w = 0; w < 4; w++) {
+        fill(40, 120, 220);
+        double opaque = _measure(widths[w]);
+        fill(40, 120, 220, 128);
+        double translucent = _measure(widths[w]);
+        printf("%-8d %12.3f %12.3f %12.1f\n", widths[w], opaque, translucent,
+               (double)RECT_COUNT * widths[w] * 64 / translucent / 1000.0);
+    }
+
+    int errors = _kernel_errors();
+    printf("blend kernel: %d pixels differ from _blend_pixel()\n", errors);
+
+    _free_framebuffer();
+    return errors == 0 ? 0 : 1;
+}
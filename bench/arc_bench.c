@@ -0,0 +1,98 @@
+/**
+ * arc_bench.c - Open arc fills against ellipses
+ *
+ * Build with `make bench` and run ./build/arc_bench
+ * Times filled OPEN arcs of a few sizes next to the full ellipse, and stroked
+ * pie wedges like those of a pie chart, then checks the sector spans against
+ * a per-pixel angle test, wrapping arcs included.
+ */
+
+#include "../src/p5c.c"
+
+#include <stdio.h>
+
+#define ARC_COUNT 2000
+#define ARC_ITERATIONS 5
+
+void setup(void) {}
+void draw(void) {}
+
+// Milliseconds of the fastest pass over ARC_COUNT d x d arcs in the given
+// mode; a sweep of 0 draws ellipses instead
+static double _measure(int d, float sweep, int mode) {
+    double best = 1e30;
+    for (int i = 0; i < ARC_ITERATIONS; i++) {
+        background(255, 255, 255);
+        uint64_t start = _monotonic_ns();
+        for (int j = 0; j < ARC_COUNT; j++) {
+            int x = (j * 37) % (width - d + 1);
+            int y = (j * 53) % (height - d + 1);
+            if (sweep > 0) {
+                arcMode(x, y, d, d, j * 0.01f, j * 0.01f + sweep, mode);
+            } else {
+                ellipse(x, y, d, d);
+            }
+        }
+        double ms = (_monotonic_ns() - start) / 1e6;
+        if (ms < best) best = ms;
+    }
+    return best;
+}
+
+// Pixels where an a x b sector from start to stop differs from testing each
+// pixel's angle, measured from start around the circle
+static int _sector_errors(int a, int b, float start, float stop) {
+    background(0, 0, 0);
+    int cx = width / 2, cy = height / 2;
+    _fill_arc_sector(cx, cy, a, b, start, stop);
+
+    int errors = 0;
+    double sweep = (double)stop - start;
+    for (int y = -b; y <= b; y++) {
+        for (int x = -a; x <= a; x++) {
+            int in = (int64_t)b * b * x * x + (int64_t)a * a * y * y <= (int64_t)a * a * b * b;
+            if (in && sweep < 2 * M_PI) {
+                double turn = fmod(atan2((double)y, (double)x) - start, 2 * M_PI);
+                if (turn < 0) turn += 2 * M_PI;
+                in = turn <= sweep + 1e-6 || turn >= 2 * M_PI - 1e-6;
+            }
+            int drawn = framebuffer[(cy + y) * width + cx + x] != 0xFF000000u;
+            if (in != drawn) errors++;
+        }
+    }
+    return errors;
+}
+
+int main(void) {
+    size(1280, 720);
+    _init_framebuffer();
+    fill(255, 160, 40);
+
+    printf("%d arcs at %dx%d\n", ARC_COUNT, width, height);
+    printf("%-8s %12s %12s %12s %12s\n", "size", "ellipse ms", "arc 90 ms", "arc 270 ms", "pie ms");
+    int sizes[] = {16, 64, 256};
+    for (int s = 0; s < 3; s++) {
+        noStroke();
+        double full = _measure(sizes[s], 0, OPEN);
+        double quarter = _measure(sizes[s], (float)M_PI / 2, OPEN);
+        double most = _measure(sizes[s], 3 * (float)M_PI / 2, OPEN);
+        stroke(20, 40, 160);
+        double pie = _measure(sizes[s], (float)M_PI / 3, PIE);
+        printf("%-8d %12.3f %12.3f %12.3f %12.3f\n", sizes[s], full, quarter, most, pie);
+    }
+
+    noStroke();
+    fill(255, 255, 255);
+    int errors = 0;
+    for (int i = 0; i < 24; i++) {
+        float start = -7.0f + i * 0.61f;
+        for (int j = 0; j < 12; j++) {
+            errors += _sector_errors(250, 160, start, start + j * 0.57f);
+            errors += _sector_errors(7, 30, start, start + j * 0.57f);
+        }
+    }
+    printf("sectors: %d pixels differ from the angle test\n", errors);
+
+    _free_framebuffer();
+    return errors == 0 ? 0 : 1;
+}
@@ -0,0 +1,132 @@
+/**
+ * batch_bench.c - Batched primitive calls against the equivalent loops
+ *
+ * Build with `make bench` and run ./build/batch_bench
+ * Each batch must leave the same pixels as its loop of single calls.
+ */
+
+#include "../src/p5c.c"
+
+#include <stdio.h>
+
+#define ELEMENTS 20000
+#define BATCH_ITERATIONS 20
+
+void setup(void) {}
+void draw(void) {}
+
+static float xs[ELEMENTS], ys[ELEMENTS], x2s[ELEMENTS], y2s[ELEMENTS];
+static float ws[ELEMENTS], hs[ELEMENTS];
+static Color colors[ELEMENTS];
+
+static void _loop_points(void) {
+    for (int i = 0; i < ELEMENTS; i++) {
+        stroke(colors[i].r, colors[i].g, colors[i].b);
+        point(xs[i], ys[i]);
+    }
+}
+
+static void _batch_points(void) {
+    points(xs, ys, colors, ELEMENTS);
+}
+
+// Short rain-like strokes
+static void _loop_lines(void) {
+    for (int i = 0; i < ELEMENTS; i++) {
+        stroke(colors[i].r, colors[i].g, colors[i].b);
+        line(xs[i], ys[i], x2s[i], y2s[i]);
+    }
+}
+
+static void _batch_lines(void) {
+    lines(xs, ys, x2s, y2s, colors, ELEMENTS);
+}
+
+// Small particles with an outline
+static void _loop_ellipses(void) {
+    for (int i = 0; i < ELEMENTS; i++) {
+        fill(colors[i].r, colors[i].g, colors[i].b);
+        ellipse(xs[i], ys[i], ws[i], hs[i]);
+    }
+}
+
+static void _batch_ellipses(void) {
+    ellipses(xs, ys, ws, hs, colors, ELEMENTS);
+}
+
+static void _loop_rects(void) {
+    for (int i = 0; i < ELEMENTS; i++) {
+        fill(colors[i].r, colors[i].g, colors[i].b);
+        rect(xs[i], ys[i], ws[i], hs[i]);
+    }
+}
+
+static void _batch_rects(void) {
+    rects(xs, ys, ws, hs, colors, ELEMENTS);
+}
+
+static uint32_t _hash_canvas(void) {
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < width * height; i++) {
+        hash = (hash ^ framebuffer[i]) * 16777619u;
+    }
+    return hash;
+}
+
+// Milliseconds of the fastest run of fn, and the canvas it leaves behind.
+// The minimum is the least disturbed by other load on the machine.
+static double _measure(void (*fn)(void), uint32_t* hash) {
+    background(0, 0, 0);
+    fn();
+    *hash = _hash_canvas();
+
+    uint64_t best = UINT64_MAX;
+    for (int i = 0; i < BATCH_ITERATIONS; i++) {
+        uint64_t start = _monotonic_ns();
+        fn();
+        uint64_t elapsed = _monotonic_ns() - start;
+        if (elapsed < best) best = elapsed;
+    }
+    return best / 1e6;
+}
+
+static void _compare(const char* name, void (*loop)(void), void (*batch)(void)) {
+    uint32_t loopHash, batchHash;
+    double loopMs = _measure(loop, &loopHash);
+    double batchMs = _measure(batch, &batchHash);
+    printf("%-10s %10.3f %10.3f %8.2fx %s\n", name, loopMs, batchMs, loopMs / batchMs,
+           loopHash == batchHash ? "identical" : "DIFFERENT");
+}
+
+int main(void) {
+    size(1280, 720);
+    _init_framebuffer();
+
+    // A few percent of the elements straddle or leave the canvas
+    for (int i = 0; i < ELEMENTS; i++) {
+        xs[i] = randomf(-20, width + 20);
+        ys[i] = randomf(-20, height + 20);
+        x2s[i] = xs[i] + randomf(-3, 3);
+        y2s[i] = ys[i] + randomf(8, 20);
+        ws[i] = randomf(2, 17);
+        hs[i] = ws[i];
+        colors[i].r = (uint8_t)(i * 7);
+        colors[i].g = (uint8_t)(i * 13);
+        colors[i].b = 200;
+    }
+
+    printf("%d elements per call at %dx%d\n", ELEMENTS, width, height);
+    printf("%-10s %10s %10s %9s %s\n", "primitive", "loop ms", "batch ms", "speedup", "pixels");
+    stroke(255, 255, 255);
+    strokeWeight(1);
+    _compare("points", _loop_points, _batch_points);
+    _compare("lines", _loop_lines, _batch_lines);
+    strokeWeight(3);
+    _compare("lines w3", _loop_lines, _batch_lines);
+    strokeWeight(1);
+    _compare("ellipses", _loop_ellipses, _batch_ellipses);
+    _compare("rects", _loop_rects, _batch_rects);
+
+    _free_framebuffer();
+    return 0;
+}
@@ -0,0 +1,69 @@
+/**
+ * blit_bench.c - Compositing a prebuilt layer against redrawing it
+ *
+ * Build with `make bench` and run ./build/blit_bench
+ */
+
+#include "../src/p5c.c"
+
+#include <stdio.h>
+
+#define BLIT_ITERATIONS 200
+
+void setup(void) {}
+void draw(void) {}
+
+// A static layer of a few hundred shapes, as a sketch background might have
+static void _draw_layer(void) {
+    for (int i = 0; i < 400; i++) {
+        fill((uint8_t)(i * 7), (uint8_t)(i * 13), 200);
+        stroke(255, 255, 255);
+        int x = (i * 97) % width;
+        int y = (i * 61) % height;
+        ellipse(x, y, 20 + i % 60, 20 + i % 40);
+        line(x, y, x + 80, y + 30);
+    }
+}
+
+// Milliseconds per call of fn
+static double _measure(void (*fn)(void)) {
+    fn();
+    uint64_t start = _monotonic_ns();
+    for (int i = 0; i < BLIT_ITERATIONS; i++) {
+        fn();
+    }
+    return (_monotonic_ns() - start) / 1e6 / BLIT_ITERATIONS;
+}
+
+static P5Graphics* opaqueLayer;
+static P5Graphics* sparseLayer;
+
+static void _redraw(void) { _draw_layer(); }
+static void _copy(void) { image(opaqueLayer, 0, 0); }
+static void _blend(void) { imageBlend(sparseLayer, 0, 0); }
+
+int main(void) {
+    size(1920, 1080);
+    _init_framebuffer();
+
+    opaqueLayer = createGraphics(width, height);
+    beginDraw(opaqueLayer);
+    background(20, 20, 40);
+    _draw_layer();
+    endDraw();
+
+    sparseLayer = createGraphics(width, height);
+    beginDraw(sparseLayer);
+    _draw_layer();
+    endDraw();
+
+    printf("1920x1080 layer of 400 ellipses and lines\n");
+    printf("%-26s %8.3f ms\n", "redraw shapes", _measure(_redraw));
+    printf("%-26s %8.3f ms\n", "image() row copy", _measure(_copy));
+    printf("%-26s %8.3f ms\n", "imageBlend() composite", _measure(_blend));
+
+    freeGraphics(opaqueLayer);
+    freeGraphics(sparseLayer);
+    _free_framebuffer();
+    return 0;
+}
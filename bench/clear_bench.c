@@ -0,0 +1,61 @@
+/**
+ * clear_bench.c - Throughput of background() against the original scalar clear loop
+ *
+ * Build with `make bench` and run ./build/clear_bench
+ */
+
+#include "../src/p5c.c"
+
+#include <stdio.h>
+
+// The benchmark drives the library internals directly and never opens a window
+void setup(void) {}
+void draw(void) {}
+
+#define CLEAR_ITERATIONS 200
+
+// The clear loop p5c shipped with, minus its printf calls
+static void _scalar_clear(uint8_t r, uint8_t g, uint8_t b) {
+    uint32_t color = (0xFF << 24) | (r << 16) | (g << 8) | b;
+    for (int i = 0; i < width * height; i++) {
+        framebuffer[i] = color;
+    }
+}
+
+static double _now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Run one clear function repeatedly and return the write bandwidth in GB/s
+static double _measure(void (*clear)(uint8_t, uint8_t, uint8_t)) {
+    clear(0, 0, 0); // warm up page mappings
+    double start = _now_seconds();
+    for (int i = 0; i < CLEAR_ITERATIONS; i++) {
+        clear((uint8_t)i, 40, 40);
+    }
+    double elapsed = _now_seconds() - start;
+    double bytes = (double)width * height * sizeof(uint32_t) * CLEAR_ITERATIONS;
+    return bytes / elapsed / 1e9;
+}
+
+int main(void) {
+    static const int sizes[][2] = {{640, 480}, {1920, 1080}, {3840, 2160}};
+
+    printf("%-12s %16s %16s %9s\n", "canvas", "scalar GB/s", "background GB/s", "speedup");
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        size(sizes[i][0], sizes[i][1]);
+        _init_framebuffer();
+
+        double scalar = _measure(_scalar_clear);
+        double simd = _measure(background);
+
+        char label[32];
+        snprintf(label, sizeof(label), "%dx%d", width, height);
+        printf("%-12s %16.2f %16.2f %8.2fx\n", label, scalar, simd, simd / scalar);
+    }
+
+    _free_framebuffer();
+    return 0;
+}
@@ -0,0 +1,131 @@
+/**
+ * clip_bench.c - Shapes mostly outside the canvas
+ *
+ * Build with `make bench` and run ./build/clip_bench
+ * Times long lines, small triangles and ellipses scattered over an area nine
+ * times the canvas, as in a zoomed-in view, then draws the same scene into a canvas
+ * three times larger and checks that the clipped pixels match its middle.
+ */
+
+#include "../src/p5c.c"
+
+#include <stdio.h>
+
+#define SHAPE_COUNT 20000
+#define CLIP_ITERATIONS 5
+#define CANVAS_W 320
+#define CANVAS_H 240
+
+void setup(void) {}
+void draw(void) {}
+
+static int shapes[SHAPE_COUNT][6];
+
+// Draw every shape of the given kind, moved by (ox, oy)
+static void _draw_shapes(int kind, int ox, int oy) {
+    for (int i = 0; i < SHAPE_COUNT; i++) {
+        const int* s = shapes[i];
+        switch (kind) {
+            case 0:
+                line(s[0] + ox, s[1] + oy, s[2] + ox, s[3] + oy);
+                break;
+            case 1:
+                triangle(s[0] + ox, s[1] + oy, s[0] + (s[2] & 63) + ox, s[1] + (s[3] & 63) + oy,
+                         s[0] + (s[4] & 63) + ox, s[1] + oy);
+                break;
+            default:
+                ellipse(s[0] + ox, s[1] + oy, s[4] & 255, s[5] & 255);
+                break;
+        }
+    }
+}
+
+// Milliseconds of the fastest pass over all shapes of a kind
+static double _measure(int kind) {
+    double best = 1e30;
+    for (int i = 0; i < CLIP_ITERATIONS; i++) {
+        background(0, 0, 0);
+        uint64_t start = _monotonic_ns();
+        _draw_shapes(kind, 0, 0);
+        double ms = (_monotonic_ns() - start) / 1e6;
+        if (ms < best) best = ms;
+    }
+    return best;
+}
+
+// Set the stroke of a pass: 0 one pixel, 1 thick, 2 smooth
+static void _stroke_style(int style) {
+    strokeWeight(style == 1 ? 3 : 1);
+    if (style == 2) smooth(); else noSmooth();
+}
+
+int main(void) {
+    // Shapes anywhere from a canvas left of and above the visible one to a
+    // canvas right of and below it, most of them long
+    for (int i = 0; i < SHAPE_COUNT; i++) {
+        for (int v = 0; v < 3; v++) {
+            shapes[i][v * 2] = (int)randomf(-CANVAS_W, 2 * CANVAS_W);
+            shapes[i][v * 2 + 1] = (int)randomf(-CANVAS_H, 2 * CANVAS_H);
+        }
+    }
+
+    size(CANVAS_W, CANVAS_H);
+    _init_framebuffer();
+    fill(255, 160, 40, 200);
+    stroke(20, 40, 160);
+
+    printf("%d shapes at %dx%d, spread over 3x3 canvases\n", SHAPE_COUNT, width, height);
+    printf("%-12s %10s %10s %10s\n", "shape", "1px ms", "thick ms", "smooth ms");
+    double lineMs[3];
+    noFill();
+    for (int style = 0; style < 3; style++) {
+        _stroke_style(style);
+        lineMs[style] = _measure(0);
+    }
+    printf("%-12s %10.3f %10.3f %10.3f\n", "lines", lineMs[0], lineMs[1], lineMs[2]);
+    fill(255, 160, 40, 200);
+    noStroke();
+    noSmooth();
+    printf("%-12s %10.3f\n", "triangles", _measure(1));
+    printf("%-12s %10.3f\n", "ellipses", _measure(2));
+
+    // The visible canvas against the middle of one three times the size
+    uint32_t* visible = (uint32_t*)malloc((size_t)CANVAS_W * CANVAS_H * sizeof(uint32_t));
+    if (!visible) return 1;
+    int errors = 0;
+    for (int pass = 0; pass < 5; pass++) {
+        int kind = pass < 3 ? 0 : pass - 2;
+        if (kind == 0) {
+            noFill();
+            stroke(20, 40, 160);
+            _stroke_style(pass);
+        } else {
+            fill(255, 160, 40, 200);
+            stroke(20, 40, 160, 120);
+            _stroke_style(0);
+        }
+
+        size(CANVAS_W, CANVAS_H);
+        _free_framebuffer();
+        _init_framebuffer();
+        background(0, 0, 0);
+        _draw_shapes(kind, 0, 0);
+        memcpy(visible, framebuffer, (size_t)CANVAS_W * CANVAS_H * sizeof(uint32_t));
+
+        size(3 * CANVAS_W, 3 * CANVAS_H);
+        _free_framebuffer();
+        _init_framebuffer();
+        background(0, 0, 0);
+        _draw_shapes(kind, CANVAS_W, CANVAS_H);
+        for (int y = 0; y < CANVAS_H; y++) {
+            for (int x = 0; x < CANVAS_W; x++) {
+                if (visible[y * CANVAS_W + x] != framebuffer[(y + CANVAS_H) * width + x + CANVAS_W]) errors++;
+            }
+        }
+    }
+    printf("clipping: %d pixels differ from the larger canvas\n", errors);
+
+    free(visible);
+    _free_framebuffer();
+    return errors == 0 ? 0 : 1;
+}
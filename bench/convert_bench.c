@@ -0,0 +1,111 @@
+/**
+ * convert_bench.c - Framebuffer conversion for X visuals
+ *
+ * Build with `make bench` and run ./build/convert_bench
+ * Converts a full frame into each pixel layout the X11 backend knows, next
+ * to the plain copy of a matching visual, then checks every dedicated kernel
+ * against the per-pixel generic conversion. No display is needed.
+ */
+
+#include "../src/p5c.c"
+
+#include <stdio.h>
+
+#define CONVERT_ITERATIONS 20
+
+void setup(void) {}
+void draw(void) {}
+
+#ifdef P5C_X11_BACKEND
+
+typedef struct {
+    const char* name;
+    int bitsPerPixel;
+    unsigned long red, green, blue;
+    int msbFirst;
+} Layout;
+
+static const Layout layouts[] = {
+    {"xrgb8888", 32, 0xFF0000, 0x00FF00, 0x0000FF, 0},
+    {"xbgr8888", 32, 0x0000FF, 0x00FF00, 0xFF0000, 0},
+    {"rgb888", 24, 0xFF0000, 0x00FF00, 0x0000FF, 0},
+    {"rgb565", 16, 0xF800, 0x07E0, 0x001F, 0},
+    {"rgb555", 16, 0x7C00, 0x03E0, 0x001F, 0},
+    {"rgb565 msb", 16, 0xF800, 0x07E0, 0x001F, 1},
+    {"rgb101010", 32, 0x3FF00000, 0x000FFC00, 0x000003FF, 0},
+};
+
+static const char* kindNames[] = {"copy", "bgr32", "rgb24", "rgb565", "generic"};
+
+// Milliseconds of the fastest conversion of the whole framebuffer
+static double _measure(const PixelFormat* f, uint8_t* image) {
+    double best = 1e30;
+    for (int i = 0; i < CONVERT_ITERATIONS; i++) {
+        uint64_t start = _monotonic_ns();
+        for (int y = 0; y < height; y++) {
+            _convert_pixels(f, image + (size_t)y * width * f->bytesPerPixel, framebuffer + (size_t)y * width, width);
+        }
+        double ms = (_monotonic_ns() - start) / 1e6;
+        if (ms < best) best = ms;
+    }
+    return best;
+}
+
+// Bytes where the dedicated kernel of f disagrees with the generic one,
+// over runs of every length up to 67 from every start up to 7
+static int _kernel_errors(const PixelFormat* f) {
+    PixelFormat generic = *f;
+    generic.kind = PIXEL_FORMAT_GENERIC;
+    uint8_t expected[80 * 4], actual[80 * 4];
+    int errors = 0;
+    for (int start = 0; start < 8; start++) {
+        for (int n = 1; n <= 67; n++) {
+            memset(expected, 0xAB, sizeof(expected));
+            memset(actual, 0xAB, sizeof(actual));
+            _convert_generic(&generic, expected, framebuffer + start, n);
+            _convert_pixels(f, actual, framebuffer + start, n);
+            for (size_t i = 0; i < sizeof(actual); i++) {
+                if (actual[i] != expected[i]) errors++;
+            }
+        }
+    }
+    return errors;
+}
+
+int main(void) {
+    size(1280, 720);
+    _init_framebuffer();
+    for (int i = 0; i < width * height; i++) {
+        Color c = {(uint8_t)randomf(0, 256), (uint8_t)randomf(0, 256), (uint8_t)randomf(0, 256)};
+        framebuffer[i] = _pack_color(c, 255);
+    }
+    uint8_t* image = (uint8_t*)malloc((size_t)width * height * 4);
+    if (!image) return 1;
+
+    printf("one %dx%d frame per conversion\n", width, height);
+    printf("%-12s %-8s %10s %10s\n", "layout", "kernel", "ms", "Mpix/s");
+    int errors = 0;
+    for (size_t i = 0; i < sizeof(layouts) / sizeof(layouts[0]); i++) {
+        const Layout* l = &layouts[i];
+        PixelFormat f = _pixel_format(l->bitsPerPixel, l->red, l->green, l->blue, l->msbFirst);
+        double ms = _measure(&f, image);
+        printf("%-12s %-8s %10.3f %10.1f\n", l->name, kindNames[f.kind], ms, width * height / ms / 1000.0);
+        if (f.kind != PIXEL_FORMAT_NATIVE && f.kind != PIXEL_FORMAT_GENERIC) {
+            errors += _kernel_errors(&f);
+        }
+    }
+    printf("kernels: %d bytes differ from the generic conversion\n", errors);
+
+    free(image);
+    _free_framebuffer();
+    return errors == 0 ? 0 : 1;
+}
+
+#else
+
+int main(void) {
+    printf("convert_bench needs the X11 backend\n");
+    return 0;
+}
+
+#endif
@@ -0,0 +1,132 @@
+/**
+ * ellipse_bench.c - Filled and stroked ellipses
+ *
+ * Build with `make bench` and run ./build/ellipse_bench
+ * Times circles of a few sizes filled, stroked and both, then checks that
+ * translucent fill and stroke never blend a pixel twice and that one-pixel
+ * outlines hold together.
+ */
+
+#include "../src/p5c.c"
+
+#include <stdio.h>
+
+#define CIRCLE_COUNT 20000
+#define ELLIPSE_ITERATIONS 5
+
+void setup(void) {}
+void draw(void) {}
+
+static int centers[CIRCLE_COUNT][2];
+
+// Milliseconds of the fastest pass over all circles of diameter d
+static double _measure(int d) {
+    double best = 1e30;
+    for (int i = 0; i < ELLIPSE_ITERATIONS; i++) {
+        background(255, 255, 255);
+        uint64_t start = _monotonic_ns();
+        for (int j = 0; j < CIRCLE_COUNT; j++) {
+            ellipse(centers[j][0], centers[j][1], d, d);
+        }
+        double ms = (_monotonic_ns() - start) / 1e6;
+        if (ms < best) best = ms;
+    }
+    return best;
+}
+
+// Pixels of a translucent w x h ellipse at weight blended more than once
+static int _overdrawn(int w, int h, int weight) {
+    background(0, 0, 0);
+    strokeWeight(weight);
+    fill(255, 255, 255, 128);
+    stroke(255, 255, 255, 128);
+    ellipse(width / 2 - w / 2, height / 2 - h / 2, w, h);
+    int count = 0;
+    for (int i = 0; i < width * height; i++) {
+        if (((framebuffer[i] >> 8) & 0xFF) > 128) count++;
+    }
+    return count;
+}
+
+// Does a one-pixel outline fall apart? It must be one 8-connected piece
+static int _has_gap(int w, int h) {
+    background(0, 0, 0);
+    strokeWeight(1);
+    noFill();
+    stroke(255, 255, 255);
+    ellipse(width / 2 - w / 2, height / 2 - h / 2, w, h);
+
+    // Flood the piece holding the first outline pixel, clearing it
+    int* stack = (int*)malloc((size_t)width * height * sizeof(int));
+    if (!stack) return 1;
+    int count = 0;
+    for (int i = 0; i < width * height && count == 0; i++) {
+        if (framebuffer[i] == 0xFFFFFFFFu) {
+            framebuffer[i] = 0;
+            stack[count++] = i;
+        }
+    }
+    while (count > 0) {
+        int p = stack[--count];
+        int x = p % width, y = p / width;
+        for (int dy = -1; dy <= 1; dy++) {
+            for (int dx = -1; dx <= 1; dx++) {
+                int nx = x + dx, ny = y + dy;
+                if (nx < 0 || ny < 0 || nx >= width || ny >= height) continue;
+                if (framebuffer[ny * width + nx] == 0xFFFFFFFFu) {
+                    framebuffer[ny * width + nx] = 0;
+                    stack[count++] = ny * width + nx;
+                }
+            }
+        }
+    }
+    free(stack);
+
+    // Anything left is a second piece
+    for (int i = 0; i < width * height; i++) {
+        if (framebuffer[i] == 0xFFFFFFFFu) return 1;
+    }
+    return 0;
+}
+
+int main(void) {
+    size(640, 360);
+    _init_framebuffer();
+    for (int i = 0; i < CIRCLE_COUNT; i++) {
+        centers[i][0] = (int)randomf(0, width);
+        centers[i][1] = (int)randomf(0, height);
+    }
+
+    printf("%d circles at %dx%d\n", CIRCLE_COUNT, width, height);
+    printf("%-8s %10s %10s %10s %10s\n", "size", "fill ms", "stroke ms", "both ms", "weight 4");
+    int sizes[] = {8, 32, 128};
+    for (int s = 0; s < 3; s++) {
+        fill(255, 160, 40);
+        stroke(20, 40, 160);
+        strokeWeight(1);
+        noStroke();
+        double filled = _measure(sizes[s]);
+        stroke(20, 40, 160);
+        noFill();
+        double stroked = _measure(sizes[s]);
+        fill(255, 160, 40);
+        double both = _measure(sizes[s]);
+        strokeWeight(4);
+        double thick = _measure(sizes[s]);
+        printf("%-8d %10.3f %10.3f %10.3f %10.3f\n", sizes[s], filled, stroked, both, thick);
+    }
+
+    int overdrawn = 0, gaps = 0;
+    for (int w = 3; w < 160; w += 7) {
+        for (int h = 3; h < 160; h += 13) {
+            for (int weight = 1; weight <= 6; weight++) {
+                overdrawn += _overdrawn(w, h, weight);
+            }
+            gaps += _has_gap(w, h);
+        }
+    }
+    printf("ellipses: %d pixels blended more than once, %d outlines with gaps\n", overdrawn, gaps);
+
+    _free_framebuffer();
+    return overdrawn == 0 && gaps == 0 ? 0 : 1;
+}
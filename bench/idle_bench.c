@@ -0,0 +1,179 @@
+/**
+ * idle_bench.c - CPU use and input latency of an idle sketch
+ *
+ * Build with `make bench` and run ./build/idle_bench
+ * Runs 60 fps frames with an empty draw() while another thread sends input
+ * over a pipe, standing in for the X connection. The loop waits once by
+ * checking for input every millisecond as run() used to, once by sleeping
+ * to each frame's deadline, and once by polling the pipe until the
+ * deadline as run() does now, and prints the CPU used and how long input
+ * waited before the loop saw it. Wakeups count the sleeps of the idle run;
+ * CPU use is a percentage of one core, with no input and with the input
+ * thread running.
+ */
+
+#include "../src/p5c.c"
+
+#include <stdio.h>
+#if !defined(P5C_HEADLESS) && !defined(P5C_WINDOWS)
+#include <sys/resource.h>
+#endif
+
+#define IDLE_FRAMES 180
+#define IDLE_RATE 60
+#define IDLE_INPUTS 64
+
+void setup(void) {}
+void draw(void) {}
+
+#if !defined(P5C_HEADLESS) && !defined(P5C_WINDOWS)
+
+static int inputPipe[2], ackPipe[2];
+static volatile int sending;
+static uint64_t latency[IDLE_INPUTS];
+static int received;
+static uint64_t sentAt;
+
+// Send a byte every few milliseconds, each one after the last was seen
+static void* _sender(void* arg) {
+    (void)arg;
+    char c = 0;
+    while (sending) {
+        struct timespec ts = {0, (long)randomf(2, 20) * 1000000};
+        nanosleep(&ts, NULL);
+        __atomic_store_n(&sentAt, _monotonic_ns(), __ATOMIC_RELEASE);
+        if (write(inputPipe[1], &c, 1) != 1) break;
+        if (read(ackPipe[0], &c, 1) != 1) break;
+    }
+    return NULL;
+}
+
+// Read whatever input is waiting, like the XPending() loop
+static void _handle_input(void) {
+    struct pollfd p = {inputPipe[0], POLLIN, 0};
+    while (poll(&p, 1, 0) > 0) {
+        char c;
+        if (read(inputPipe[0], &c, 1) != 1) return;
+        uint64_t now = _monotonic_ns();
+        if (received < IDLE_INPUTS) {
+            latency[received++] = now - __atomic_load_n(&sentAt, __ATOMIC_ACQUIRE);
+        }
+        if (write(ackPipe[1], &c, 1) != 1) return;
+    }
+}
+
+static uint64_t _cpu_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// Times the process gave up the CPU, once per sleep
+static long _sleeps(void) {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_nvcsw;
+}
+
+static int _compare_u64(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+// Run the frames with the given wait, with or without input, and return
+// the share of a CPU used
+static double _run(int mode, int input, double* fps, double* wakes) {
+    if (pipe(inputPipe) != 0 || pipe(ackPipe) != 0) {
+        fprintf(stderr, "idle_bench: pipe() failed\n");
+        return 0;
+    }
+    received = 0;
+    sending = input;
+    pthread_t thread;
+    if (input) pthread_create(&thread, NULL, _sender, NULL);
+
+    long sleeps = _sleeps();
+    uint64_t cpu = _cpu_ns();
+    uint64_t start = _monotonic_ns();
+    uint64_t period = 1000000000ull / IDLE_RATE;
+    uint64_t last = start;
+    _pacer_start(0);
+    for (int frame = 0; frame < IDLE_FRAMES;) {
+        if (mode == 0) {
+            // The old loop: check for input, then sleep a millisecond
+            _handle_input();
+            uint64_t now = _monotonic_ns();
+            if (now - last < period) {
+                struct timespec ts = {0, 1000000};
+                nanosleep(&ts, NULL);
+                continue;
+            }
+            last = now;
+        } else if (mode == 1) {
+            _pacer_wait(-1);
+            _handle_input();
+            _pacer_begin_frame();
+        } else {
+            do {
+                _handle_input();
+            } while (_pacer_wait(inputPipe[0]));
+            _pacer_begin_frame();
+        }
+        frame++;
+    }
+    double wall = (double)(_monotonic_ns() - start);
+    double busy = (double)(_cpu_ns() - cpu);
+    *wakes = (_sleeps() - sleeps) * 1e9 / wall;
+
+    // Release the sender if it waits for an acknowledgement
+    if (input) {
+        sending = 0;
+        char c = 0;
+        if (write(ackPipe[1], &c, 1) != 1) return 0;
+        pthread_join(thread, NULL);
+    }
+    close(inputPipe[0]);
+    close(inputPipe[1]);
+    close(ackPipe[0]);
+    close(ackPipe[1]);
+
+    *fps = IDLE_FRAMES * 1e9 / wall;
+    return 100.0 * busy / wall;
+}
+
+// Print CPU use without and with input, and the input latency
+static double _report(const char* name, int mode) {
+    double fps, wakes, ignored;
+    double idle = _run(mode, 0, &fps, &wakes);
+    double busy = _run(mode, 1, &fps, &ignored);
+    int n = received;
+    qsort(latency, n, sizeof(uint64_t), _compare_u64);
+    double sum = 0;
+    for (int i = 0; i < n; i++) sum += latency[i];
+    printf("%-10s %8.2f %8.0f %8.2f %8.2f %10.3f %10.3f %10.3f\n", name, fps, wakes, idle, busy,
+           n ? sum / n / 1e6 : 0.0, n ? latency[n / 2] / 1e6 : 0.0, n ? latency[n - 1] / 1e6 : 0.0);
+    return fps;
+}
+
+int main(void) {
+    frameRate(IDLE_RATE);
+
+    printf("%d idle frames at %d fps with input every 2-20 ms\n", IDLE_FRAMES, IDLE_RATE);
+    printf("%-10s %8s %8s %8s %8s %10s %10s %10s\n", "wait", "fps", "wakes/s", "idle %", "input %",
+           "mean ms", "p50 ms", "max ms");
+    _report("poll 1 ms", 0);
+    _report("deadline", 1);
+    double fps = _report("poll fd", 2);
+
+    // A rate more than 1% off means input wakes break the deadlines
+    return fabs(fps - IDLE_RATE) < IDLE_RATE * 0.01 ? 0 : 1;
+}
+
+#else
+
+int main(void) {
+    printf("idle_bench needs a windowed POSIX build\n");
+    return 0;
+}
+
+#endif
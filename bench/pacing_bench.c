@@ -0,0 +1,122 @@
+/**
+ * pacing_bench.c - Frame pacing jitter
+ *
+ * Build with `make bench` and run ./build/pacing_bench
+ * Runs 60 fps frames with a random 0-8 ms workload, paced once by polling
+ * with 1 ms sleeps as the main loops used to and once by the frame pacer,
+ * and prints how far frame starts stray from an exact 60 Hz grid. The
+ * pacer run starts after a slow setup(), which must not show up as dropped
+ * frames or as the first deltaTime.
+ */
+
+#include "../src/p5c.c"
+
+#include <stdio.h>
+
+#define PACING_FRAMES 120
+#define PACING_RATE 60
+
+void setup(void) {}
+void draw(void) {}
+
+#ifndef P5C_HEADLESS
+
+static uint64_t starts[PACING_FRAMES];
+
+// Keep the CPU busy for ms milliseconds, like a draw() call
+static void _work(double ms) {
+    uint64_t end = _monotonic_ns() + (uint64_t)(ms * 1e6);
+    while (_monotonic_ns() < end) {
+    }
+}
+
+static int _compare_u64(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+// Print the spread of frame intervals and of the offsets from the grid
+static double _report(const char* name) {
+    uint64_t period = 1000000000ull / PACING_RATE;
+    uint64_t error[PACING_FRAMES - 1];
+    double sum = 0, sumSq = 0;
+    for (int i = 1; i < PACING_FRAMES; i++) {
+        double interval = (double)(starts[i] - starts[i - 1]);
+        sum += interval;
+        sumSq += interval * interval;
+        uint64_t due = starts[0] + (uint64_t)i * period;
+        error[i - 1] = starts[i] > due ? starts[i] - due : due - starts[i];
+    }
+    int n = PACING_FRAMES - 1;
+    double mean = sum / n;
+    double deviation = sqrt(fmax(0.0, sumSq / n - mean * mean));
+    qsort(error, n, sizeof(uint64_t), _compare_u64);
+    double fps = 1e9 / mean;
+    printf("%-10s %8.2f %10.3f %10.3f %10.3f %10.3f\n", name, fps, deviation / 1e6,
+           error[n / 2] / 1e6, error[n * 99 / 100] / 1e6, error[n - 1] / 1e6);
+    return fps;
+}
+
+int main(void) {
+    frameRate(PACING_RATE);
+    double workload[PACING_FRAMES];
+    for (int i = 0; i < PACING_FRAMES; i++) {
+        workload[i] = randomf(0, 8);
+    }
+
+    printf("%d frames at %d fps with 0-8 ms of work each\n", PACING_FRAMES, PACING_RATE);
+    printf("%-10s %8s %10s %10s %10s %10s\n", "pacing", "fps", "sd ms", "p50 ms", "p99 ms", "max ms");
+
+    // The old loops: run a frame once a period has passed since the last
+    // one began, checking every millisecond
+    uint64_t last = _monotonic_ns();
+    uint64_t period = 1000000000ull / PACING_RATE;
+    for (int frame = 0; frame < PACING_FRAMES;) {
+        uint64_t now = _monotonic_ns();
+        if (now - last >= period) {
+            starts[frame] = now;
+            _work(workload[frame]);
+            frame++;
+            last = now;
+        } else {
+#ifdef P5C_WINDOWS
+            Sleep(1);
+#else
+            struct timespec ts = {0, 1000000};
+            nanosleep(&ts, NULL);
+#endif
+        }
+    }
+    _report("poll 1 ms");
+
+    // As run() does: the clock starts, setup() takes a while, then frames
+    _pacer_start(0);
+    _work(200);
+    _pacer_first_frame();
+    float firstDelta = 0;
+    for (int frame = 0; frame < PACING_FRAMES; frame++) {
+        _pacer_wait(-1);
+        _pacer_begin_frame();
+        if (frame == 0) firstDelta = deltaTime;
+        starts[frame] = pacer.frameStart;
+        _work(workload[frame]);
+    }
+    double fps = _report("pacer");
+    printf("pacer: %llu frames dropped, first deltaTime %.2f ms, sleeps wake %.3f ms late on average\n",
+           (unsigned long long)pacer.dropped, firstDelta, pacer.wakeLatency / 1e6);
+
+    // A rate more than 1% off means the deadlines are wrong, not noisy; a
+    // 200 ms setup() must not count as dropped frames or a long first frame
+    int errors = fabs(fps - PACING_RATE) >= PACING_RATE * 0.01;
+    if (pacer.dropped > 0 || firstDelta > 2000.0f / PACING_RATE) errors++;
+    return errors == 0 ? 0 : 1;
+}
+
+#else
+
+int main(void) {
+    printf("pacing_bench needs a windowed build\n");
+    return 0;
+}
+
+#endif
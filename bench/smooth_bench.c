@@ -0,0 +1,64 @@
+/**
+ * smooth_bench.c - Aliased against anti-aliased lines
+ *
+ * Build with `make bench` and run ./build/smooth_bench
+ * Draws the same random lines with noSmooth() and smooth() at a few stroke
+ * weights. The aliased column should not move when the smooth path changes.
+ */
+
+#include "../src/p5c.c"
+
+#include <stdio.h>
+
+#define LINE_COUNT 20000
+#define SMOOTH_ITERATIONS 5
+
+void setup(void) {}
+void draw(void) {}
+
+static int segments[LINE_COUNT][4];
+
+// Milliseconds of the fastest pass over all lines
+static double _measure(void) {
+    double best = 1e30;
+    for (int i = 0; i < SMOOTH_ITERATIONS; i++) {
+        background(255, 255, 255);
+        uint64_t start = _monotonic_ns();
+        for (int j = 0; j < LINE_COUNT; j++) {
+            const int* s = segments[j];
+            line(s[0], s[1], s[2], s[3]);
+        }
+        double ms = (_monotonic_ns() - start) / 1e6;
+        if (ms < best) best = ms;
+    }
+    return best;
+}
+
+int main(void) {
+    size(1280, 720);
+    _init_framebuffer();
+
+    // Strokes of up to 40 pixels in every direction
+    for (int i = 0; i < LINE_COUNT; i++) {
+        segments[i][0] = (int)randomf(0, width);
+        segments[i][1] = (int)randomf(0, height);
+        segments[i][2] = segments[i][0] + (int)randomf(-40, 40);
+        segments[i][3] = segments[i][1] + (int)randomf(-40, 40);
+    }
+
+    printf("%d lines at %dx%d\n", LINE_COUNT, width, height);
+    printf("%-8s %12s %12s\n", "weight", "aliased ms", "smooth ms");
+    stroke(20, 40, 160);
+    int weights[] = {1, 2, 4, 8};
+    for (int w = 0; w < 4; w++) {
+        strokeWeight(weights[w]);
+        noSmooth();
+        double aliased = _measure();
+        smooth();
+        double smoothed = _measure();
+        printf("%-8d %12.3f %12.3f\n", weights[w], aliased, smoothed);
+    }
+
+    _free_framebuffer();
+    return 0;
+}
@@ -0,0 +1,139 @@
+/**
+ * stats_bench.c - Per-frame counters
+ *
+ * Build with `make bench` and run ./build/stats_bench
+ * Runs a particle scene serially and with tiled rendering and prints the
+ * frame statistics of both, then checks the pixels counted for a lone
+ * rectangle, that shapes drawn through other calls count once, and that
+ * the tile workers' pixels add up to the serial count.
+ */
+
+#include "../src/p5c.c"
+
+#include <stdio.h>
+
+#define PARTICLES 20000
+#define STATS_FRAMES 30
+
+static float px[PARTICLES], py[PARTICLES], pr[PARTICLES];
+
+void setup(void) {}
+void draw(void) {}
+
+static void _particles(void) {
+    background(30, 30, 30);
+    for (int i = 0; i < PARTICLES; i++) {
+        float x = px[i] + frameCount * (i % 7 - 3);
+        float y = py[i] + frameCount * (i % 5 - 2);
+        fill((uint8_t)i, 200, 255);
+        stroke(255, 255, 255);
+        ellipse((int)x, (int)y, (int)pr[i], (int)pr[i]);
+        line((int)x, (int)y, (int)x - (i % 7 - 3) * 4, (int)y - (i % 5 - 2) * 4);
+    }
+}
+
+static void _lone_rect(void) {
+    background(0, 0, 0);
+    noStroke();
+    fill(255, 255, 255);
+    rect(10, 20, 100, 50);
+}
+
+static void _nested(void) {
+    background(0, 0, 0);
+    stroke(255, 255, 255);
+    fill(255, 0, 0);
+    rect(10, 10, 40, 40);
+    quad(100, 10, 140, 20, 130, 60, 90, 40);
+    float xs[3] = {200, 220, 240}, ys[3] = {20, 40, 60}, ws[3] = {10, 0, 12};
+    rects(xs, ys, ws, ws, NULL, 3);
+    ellipses(xs, ys, ws, ws, NULL, 3);
+}
+
+// Run one frame as the main loops do and return its statistics
+static P5FrameStats _frame(void (*scene)(void)) {
+    _stats_begin_frame();
+    scene();
+    _finish_frame();
+    _present_dirty_rects(_discard_rect);
+    _stats_presented();
+    frameCount++;
+    _stats_close_frame(_monotonic_ns());
+    return p5c_get_frame_stats();
+}
+
+// Average the particle scene's statistics over STATS_FRAMES frames
+static P5FrameStats _run_frames(int threads) {
+    p5c_threads(threads);
+    _init_framebuffer();
+    P5FrameStats total;
+    memset(&total, 0, sizeof(total));
+    for (frameCount = 0; frameCount < STATS_FRAMES;) {
+        P5FrameStats s = _frame(_particles);
+        total.frameMs += s.frameMs / STATS_FRAMES;
+        total.drawMs += s.drawMs / STATS_FRAMES;
+        total.pixels += s.pixels;
+        total.spans += s.spans;
+        for (int i = 0; i < P5C_STAT_PRIMITIVES; i++) {
+            total.primitives[i] += s.primitives[i];
+        }
+    }
+    _stop_frame_workers();
+    return total;
+}
+
+int main(void) {
+    size(1280, 720);
+    for (int i = 0; i < PARTICLES; i++) {
+        px[i] = randomf(0, width);
+        py[i] = randomf(0, height);
+        pr[i] = randomf(2, 14);
+    }
+
+    printf("%d particles at %dx%d, %d frames\n", PARTICLES, width, height, STATS_FRAMES);
+    printf("%-8s %10s %10s %14s %12s %10s %10s\n", "threads", "frame ms", "draw ms", "pixels", "spans",
+           "ellipses", "lines");
+    P5FrameStats serial = _run_frames(1);
+    P5FrameStats tiled = _run_frames(4);
+    const P5FrameStats* runs[2] = {&serial, &tiled};
+    for (int r = 0; r < 2; r++) {
+        const P5FrameStats* s = runs[r];
+        printf("%-8d %10.2f %10.2f %14llu %12llu %10d %10d\n", r ? 4 : 1, s->frameMs, s->drawMs,
+               (unsigned long long)s->pixels, (unsigned long long)s->spans, s->primitives[P5C_STAT_ELLIPSE],
+               s->primitives[P5C_STAT_LINE]);
+    }
+
+    // Tiles split spans at their edges, so only the pixels must agree
+    int errors = 0;
+    if (tiled.pixels != serial.pixels) errors++;
+    for (int i = 0; i < P5C_STAT_PRIMITIVES; i++) {
+        if (tiled.primitives[i] != serial.primitives[i]) errors++;
+    }
+
+    p5c_threads(1);
+    _init_framebuffer();
+    P5FrameStats s = _frame(_lone_rect);
+    uint64_t canvas = (uint64_t)width * height;
+    // A row of the clear, and one or two per row from the rectangle's triangles
+    if (s.pixels != canvas + 100 * 50 || s.spans < (uint64_t)height + 50 || s.spans > (uint64_t)height + 100) {
+        errors++;
+    }
+    if (s.primitives[P5C_STAT_RECT] != 1 || s.primitives[P5C_STAT_QUAD] != 0 ||
+        s.primitives[P5C_STAT_TRIANGLE] != 0 || s.primitives[P5C_STAT_LINE] != 0) {
+        errors++;
+    }
+
+    s = _frame(_nested);
+    int expected[P5C_STAT_PRIMITIVES] = {0};
+    expected[P5C_STAT_RECT] = 4;
+    expected[P5C_STAT_QUAD] = 1;
+    expected[P5C_STAT_ELLIPSE] = 3;
+    for (int i = 0; i < P5C_STAT_PRIMITIVES; i++) {
+        if (s.primitives[i] != expected[i]) errors++;
+    }
+    printf("frame stats: %d counters wrong\n", errors);
+
+    _stop_frame_workers();
+    _free_framebuffer();
+    return errors == 0 ? 0 : 1;
+}
@@ -0,0 +1,108 @@
+/**
+ * stroke_bench.c - Thick lines and points
+ *
+ * Build with `make bench` and run ./build/stroke_bench
+ * Times short rain-like strokes and random lines at a few weights, then
+ * checks that translucent thick strokes blend every pixel exactly once and
+ * that their area matches weight x length at every angle.
+ */
+
+#include "../src/p5c.c"
+
+#include <stdio.h>
+
+#define STROKE_COUNT 20000
+#define STROKE_ITERATIONS 5
+#define ANGLE_STEPS 48
+
+void setup(void) {}
+void draw(void) {}
+
+static int segments[STROKE_COUNT][4];
+
+// Milliseconds of the fastest pass over all segments, as lines or points
+static double _measure(int asPoints) {
+    double best = 1e30;
+    for (int i = 0; i < STROKE_ITERATIONS; i++) {
+        background(230, 230, 250);
+        uint64_t start = _monotonic_ns();
+        for (int j = 0; j < STROKE_COUNT; j++) {
+            const int* s = segments[j];
+            if (asPoints) {
+                point(s[0], s[1]);
+            } else {
+                line(s[0], s[1], s[2], s[3]);
+            }
+        }
+        double ms = (_monotonic_ns() - start) / 1e6;
+        if (ms < best) best = ms;
+    }
+    return best;
+}
+
+// Draw a half-transparent white line over black and count the pixels it
+// covered; a pixel blended twice would come out brighter than 128
+static int _covered(int x1, int y1, int x2, int y2, int* overdrawn) {
+    background(0, 0, 0);
+    line(x1, y1, x2, y2);
+    int count = 0;
+    for (int i = 0; i < width * height; i++) {
+        uint32_t g = (framebuffer[i] >> 8) & 0xFF;
+        if (g > 128) (*overdrawn)++;
+        if (g != 0) count++;
+    }
+    return count;
+}
+
+int main(void) {
+    size(640, 360);
+    _init_framebuffer();
+
+    printf("%d strokes at %dx%d\n", STROKE_COUNT, width, height);
+    printf("%-8s %12s %12s %12s\n", "weight", "rain ms", "random ms", "points ms");
+    stroke(138, 43, 226);
+    for (int weight = 1; weight <= 8; weight *= 2) {
+        strokeWeight(weight);
+        for (int i = 0; i < STROKE_COUNT; i++) {
+            segments[i][0] = (int)randomf(0, width);
+            segments[i][1] = (int)randomf(0, height);
+            segments[i][2] = segments[i][0];
+            segments[i][3] = segments[i][1] + (int)randomf(10, 20);
+        }
+        double rain = _measure(0);
+        for (int i = 0; i < STROKE_COUNT; i++) {
+            segments[i][2] = segments[i][0] + (int)randomf(-40, 40);
+            segments[i][3] = segments[i][1] + (int)randomf(-40, 40);
+        }
+        double random = _measure(0);
+        double points = _measure(1);
+        printf("%-8d %12.3f %12.3f %12.3f\n", weight, rain, random, points);
+    }
+
+    // Lines of length 100 around a circle: every pixel once, and the area
+    // within a pixel's worth of border of weight x (length + 1)
+    int overdrawn = 0;
+    double worst = 0;
+    stroke(255, 255, 255, 128);
+    for (int weight = 2; weight <= 9; weight++) {
+        strokeWeight(weight);
+        for (int i = 0; i < ANGLE_STEPS; i++) {
+            float angle = i * 2.0f * (float)M_PI / ANGLE_STEPS;
+            int x2 = width / 2 + (int)lrintf(100 * cosf(angle));
+            int y2 = height / 2 + (int)lrintf(100 * sinf(angle));
+            float length = hypotf((float)(x2 - width / 2), (float)(y2 - height / 2));
+            int area = _covered(width / 2, height / 2, x2, y2, &overdrawn);
+            double error = fabs(area - weight * (length + 1.0)) / (length + 1.0);
+            if (error > worst) worst = error;
+        }
+        background(0, 0, 0);
+        point(width / 2, height / 2);
+        for (int i = 0; i < width * height; i++) {
+            if (((framebuffer[i] >> 8) & 0xFF) > 128) overdrawn++;
+        }
+    }
+    printf("thick strokes: %d pixels blended more than once, width error <= %.2f px\n", overdrawn, worst);
+
+    _free_framebuffer();
+    return overdrawn == 0 && worst <= 1.0 ? 0 : 1;
+}
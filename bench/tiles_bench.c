@@ -0,0 +1,77 @@
+/**
+ * tiles_bench.c - Frame time of a particle scene, serial vs tiled rendering
+ *
+ * Build with `make bench` and run ./build/tiles_bench [max threads]
+ * Every thread count must produce the same pixels as serial drawing.
+ */
+
+#include "../src/p5c.c"
+
+#include <stdio.h>
+
+#define PARTICLES 20000
+#define BENCH_FRAMES 60
+
+static float px[PARTICLES], py[PARTICLES], pr[PARTICLES];
+
+void setup(void) {}
+
+// Many small stroked circles and trails over a cleared canvas
+void draw(void) {
+    background(30, 30, 30);
+    for (int i = 0; i < PARTICLES; i++) {
+        float x = px[i] + frameCount * (i % 7 - 3);
+        float y = py[i] + frameCount * (i % 5 - 2);
+        fill((uint8_t)i, 200, 255);
+        stroke(255, 255, 255);
+        ellipse((int)x, (int)y, (int)pr[i], (int)pr[i]);
+        line((int)x, (int)y, (int)x - (i % 7 - 3) * 4, (int)y - (i % 5 - 2) * 4);
+    }
+}
+
+// Render the frames and return milliseconds per frame and a pixel hash
+static double _run_frames(int threads, uint32_t* hash) {
+    p5c_threads(threads);
+    _init_framebuffer();
+
+    uint64_t start = _monotonic_ns();
+    *hash = 2166136261u;
+    for (frameCount = 0; frameCount < BENCH_FRAMES; frameCount++) {
+        draw();
+        _finish_frame();
+        for (int i = 0; i < width * height; i += 61) {
+            *hash = (*hash ^ framebuffer[i]) * 16777619u;
+        }
+    }
+    double ms = (_monotonic_ns() - start) / 1e6 / BENCH_FRAMES;
+
+    _stop_frame_workers();
+    return ms;
+}
+
+int main(int argc, char** argv) {
+    int maxThreads = argc > 1 ? atoi(argv[1]) : _cpu_count();
+    if (maxThreads < 2) maxThreads = 2;
+
+    size(1280, 720);
+    for (int i = 0; i < PARTICLES; i++) {
+        px[i] = randomf(0, width);
+        py[i] = randomf(0, height);
+        pr[i] = randomf(2, 14);
+    }
+
+    uint32_t serialHash;
+    double serial = _run_frames(1, &serialHash);
+    printf("%d CPUs, %d particles at %dx%d\n", _cpu_count(), PARTICLES, width, height);
+    printf("%-8s %10s %9s %s\n", "threads", "ms/frame", "speedup", "pixels");
+    printf("%-8d %10.2f %8.2fx %s\n", 1, serial, 1.0, "reference");
+
+    for (int threads = 2; threads <= maxThreads; threads *= 2) {
+        uint32_t hash;
+        double ms = _run_frames(threads, &hash);
+        printf("%-8d %10.2f %8.2fx %s\n", threads, ms, serial / ms, hash == serialHash ? "identical" : "DIFFERENT");
+    }
+
+    _free_framebuffer();
+    return 0;
+}
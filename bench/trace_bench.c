@@ -0,0 +1,199 @@
+/**
+ * trace_bench.c - Trace-event output
+ *
+ * Build with `make bench` and run ./build/trace_bench
+ * Builds the library with tracing on, times an empty zone, then runs a
+ * particle scene serially and with tiled rendering and writes the trace
+ * next to the binary (<binary>.json, or P5C_TRACE_FILE=<path>) for
+ * chrome://tracing or ui.perfetto.dev. The file is read back to check that
+ * every frame has its draw and finish zones and a sleep zone when it waited,
+ * that zones on a thread nest, and that the tile workers are named.
+ */
+
+#ifndef P5C_TRACE
+#define P5C_TRACE
+#endif
+#include "../src/p5c.c"
+
+#include <stdio.h>
+
+#define PARTICLES 5000
+#define TRACE_FRAMES 20
+#define ZONE_LOOPS 100000
+#define MAX_TRACE_EVENTS 1000000
+
+static float px[PARTICLES], py[PARTICLES], pr[PARTICLES];
+#ifndef P5C_HEADLESS
+static int sleptFrames; // Frames that finished early enough to sleep
+#endif
+
+void setup(void) {}
+void draw(void) {}
+
+static void _particles(void) {
+    background(30, 30, 30);
+    for (int i = 0; i < PARTICLES; i++) {
+        float x = px[i] + frameCount * (i % 7 - 3);
+        float y = py[i] + frameCount * (i % 5 - 2);
+        fill((uint8_t)i, 200, 255);
+        stroke(255, 255, 255);
+        ellipse((int)x, (int)y, (int)pr[i], (int)pr[i]);
+        line((int)x, (int)y, (int)x - (i % 7 - 3) * 4, (int)y - (i % 5 - 2) * 4);
+    }
+}
+
+// Run frames as the main loops do
+static void _run_frames(int threads) {
+    p5c_threads(threads);
+    _init_framebuffer();
+    _pacer_start(0);
+    for (int frame = 0; frame < TRACE_FRAMES; frame++) {
+        // A frame of this scene can outrun the writer on a busy or single
+        // core machine, and the checks need every zone, so drain each frame
+        _trace_flush();
+#ifndef P5C_HEADLESS
+        uint64_t slept = pacer.slept;
+        _pacer_wait(-1);
+        if (pacer.slept != slept) sleptFrames++;
+#endif
+        _pacer_begin_frame();
+        {
+            P5C_TRACE_ZONE("draw");
+            _particles();
+        }
+        _finish_frame();
+        _present_dirty_rects(_discard_rect);
+        frameCount++;
+    }
+    _stop_frame_workers();
+}
+
+typedef struct {
+    char name[32];
+    int tid;
+    double ts, dur;
+} ReadEvent;
+
+static ReadEvent events[MAX_TRACE_EVENTS];
+
+static int _count_named(int n, const char* name) {
+    int count = 0;
+    for (int i = 0; i < n; i++) {
+        if (strcmp(events[i].name, name) == 0) count++;
+    }
+    return count;
+}
+
+static int _compare_events(const void* a, const void* b) {
+    const ReadEvent* x = (const ReadEvent*)a;
+    const ReadEvent* y = (const ReadEvent*)b;
+    if (x->tid != y->tid) return x->tid - y->tid;
+    if (x->ts != y->ts) return x->ts < y->ts ? -1 : 1;
+    return x->dur > y->dur ? -1 : x->dur < y->dur;
+}
+
+// Zones on one thread either nest or follow each other; timestamps are
+// printed to the nanosecond, so allow that much rounding
+static int _count_overlaps(int n) {
+    qsort(events, n, sizeof(ReadEvent), _compare_events);
+    int overlaps = 0;
+    double open[64];
+    int depth = 0, tid = -1;
+    for (int i = 0; i < n; i++) {
+        if (events[i].tid != tid) {
+            tid = events[i].tid;
+            depth = 0;
+        }
+        while (depth > 0 && events[i].ts >= open[depth - 1] - 0.002) depth--;
+        if (depth > 0 && events[i].ts + events[i].dur > open[depth - 1] + 0.002) overlaps++;
+        if (depth < 64) open[depth++] = events[i].ts + events[i].dur;
+    }
+    return overlaps;
+}
+
+int main(int argc, char** argv) {
+    (void)argc;
+    static char path[1024];
+    const char* env = getenv("P5C_TRACE_FILE");
+    if (env && *env) {
+        snprintf(path, sizeof(path), "%s", env);
+    } else {
+        static char setting[1100];
+        snprintf(path, sizeof(path), "%s.json", argv[0]);
+        snprintf(setting, sizeof(setting), "P5C_TRACE_FILE=%s", path);
+        putenv(setting);
+    }
+
+    size(1280, 720);
+    frameRate(60);
+    for (int i = 0; i < PARTICLES; i++) {
+        px[i] = randomf(0, width);
+        py[i] = randomf(0, height);
+        pr[i] = randomf(2, 14);
+    }
+
+    // Opens the trace, so the empty zones below time the steady state
+    {
+        P5C_TRACE_ZONE("setup");
+    }
+    uint64_t zoneTime = 0;
+    for (int i = 0; i < ZONE_LOOPS / 1000; i++) {
+        uint64_t start = _monotonic_ns();
+        for (int j = 0; j < 1000; j++) {
+            P5C_TRACE_ZONE("empty");
+        }
+        zoneTime += _monotonic_ns() - start;
+        // Drain between batches so the ring never fills
+        _trace_flush();
+    }
+    double zoneNs = (double)zoneTime / ZONE_LOOPS;
+
+    _run_frames(1);
+    _run_frames(4);
+    _free_framebuffer();
+    _trace_close();
+
+    FILE* f = fopen(path, "r");
+    if (!f) {
+        printf("trace_bench: cannot read %s\n", path);
+        return 1;
+    }
+    char line[512];
+    int n = 0, lines = 0, workers = 0, closed = 0;
+    while (fgets(line, sizeof(line), f)) {
+        lines++;
+        if (strcmp(line, "]\n") == 0) closed = 1;
+        if (strstr(line, "\"args\":{\"name\":\"tile worker\"}")) workers++;
+        ReadEvent e;
+        if (n < MAX_TRACE_EVENTS &&
+            sscanf(line, "{\"name\":\"%31[^\"]\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%lf,\"dur\":%lf}", e.name,
+                   &e.tid, &e.ts, &e.dur) == 4) {
+            events[n++] = e;
+        }
+    }
+    fclose(f);
+
+    int frames = 2 * TRACE_FRAMES;
+    int draws = _count_named(n, "draw"), finishes = _count_named(n, "finish frame");
+    int sleeps = _count_named(n, "sleep"), tiles = _count_named(n, "tile");
+    int ellipses = _count_named(n, "ellipse"), empties = _count_named(n, "empty");
+    int overlaps = _count_overlaps(n);
+
+    printf("%d zones in %s, %.1f ns per empty zone\n", n, path, zoneNs);
+    printf("%-14s %8s %8s %8s %8s %10s %10s %8s\n", "", "draw", "finish", "sleep", "tile", "ellipse", "empty",
+           "workers");
+    printf("%-14s %8d %8d %8d %8d %10d %10d %8d\n", "zones", draws, finishes, sleeps, tiles, ellipses, empties,
+           workers);
+
+    // The serial run has no tiles; the tiled one rasterizes every frame
+    int errors = 0;
+    if (!closed) errors++;
+    if (draws != frames || finishes != frames || ellipses != frames * PARTICLES) errors++;
+    if (tiles < TRACE_FRAMES || workers != 3) errors++;
+#ifndef P5C_HEADLESS
+    if (sleeps != sleptFrames) errors++;
+#endif
+    if (empties != ZONE_LOOPS || overlaps != 0) errors++;
+    printf("trace: %d lines, %d zones overlapping another, %d checks failed\n", lines, overlaps, errors);
+    return errors == 0 ? 0 : 1;
+}
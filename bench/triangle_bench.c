@@ -0,0 +1,109 @@
+/**
+ * triangle_bench.c - Triangle fill throughput and mesh coverage
+ *
+ * Build with `make bench` and run ./build/triangle_bench
+ * Fills random triangles of three sizes, then a jittered grid mesh whose
+ * triangles must cover every pixel of its area exactly once.
+ */
+
+#include "../src/p5c.c"
+
+#include <stdio.h>
+
+#define TRIANGLE_COUNT 20000
+#define MESH_CELLS 16
+
+void setup(void) {}
+void draw(void) {}
+
+static int triangles[TRIANGLE_COUNT][6];
+
+// Milliseconds to fill TRIANGLE_COUNT triangles with vertices up to size apart
+static double _fill_random(int size) {
+    for (int i = 0; i < TRIANGLE_COUNT; i++) {
+        int x = (int)randomf(0, width - size);
+        int y = (int)randomf(0, height - size);
+        for (int v = 0; v < 3; v++) {
+            triangles[i][v * 2] = x + (int)randomf(0, size);
+            triangles[i][v * 2 + 1] = y + (int)randomf(0, size);
+        }
+    }
+
+    uint64_t start = _monotonic_ns();
+    for (int i = 0; i < TRIANGLE_COUNT; i++) {
+        const int* t = triangles[i];
+        triangle(t[0], t[1], t[2], t[3], t[4], t[5]);
+    }
+    return (_monotonic_ns() - start) / 1e6;
+}
+
+// Fill a jittered grid mesh one triangle at a time, counting how often each
+// pixel is written; returns the number of pixels not covered exactly once
+static int _mesh_coverage_errors(void) {
+    int vx[MESH_CELLS + 1][MESH_CELLS + 1];
+    int vy[MESH_CELLS + 1][MESH_CELLS + 1];
+    int cellW = width / MESH_CELLS;
+    int cellH = height / MESH_CELLS;
+    for (int j = 0; j <= MESH_CELLS; j++) {
+        for (int i = 0; i <= MESH_CELLS; i++) {
+            int inner = i > 0 && i < MESH_CELLS && j > 0 && j < MESH_CELLS;
+            vx[j][i] = i * cellW + (inner ? (int)randomf(-cellW / 3, cellW / 3) : 0);
+            vy[j][i] = j * cellH + (inner ? (int)randomf(-cellH / 3, cellH / 3) : 0);
+        }
+    }
+
+    int meshW = MESH_CELLS * cellW;
+    int meshH = MESH_CELLS * cellH;
+    uint8_t* counts = (uint8_t*)calloc((size_t)meshW * meshH, 1);
+    if (!counts) return -1;
+
+    for (int j = 0; j < MESH_CELLS; j++) {
+        for (int i = 0; i < MESH_CELLS; i++) {
+            int halves[2][6] = {
+                {vx[j][i], vy[j][i], vx[j][i + 1], vy[j][i + 1], vx[j + 1][i + 1], vy[j + 1][i + 1]},
+                {vx[j][i], vy[j][i], vx[j + 1][i + 1], vy[j + 1][i + 1], vx[j + 1][i], vy[j + 1][i]}
+            };
+            for (int k = 0; k < 2; k++) {
+                const int* t = halves[k];
+                background(0, 0, 0);
+                triangle(t[0], t[1], t[2], t[3], t[4], t[5]);
+                for (int y = 0; y < meshH; y++) {
+                    for (int x = 0; x < meshW; x++) {
+                        if (framebuffer[y * width + x] != 0xFF000000u) counts[y * meshW + x]++;
+                    }
+                }
+            }
+        }
+    }
+
+    int errors = 0;
+    for (int p = 0; p < meshW * meshH; p++) {
+        if (counts[p] != 1) errors++;
+    }
+    free(counts);
+    return errors;
+}
+
+int main(void) {
+    size(1280, 720);
+    _init_framebuffer();
+    noStroke();
+    fill(255, 160, 40);
+
+    printf("%d triangles per size at %dx%d\n", TRIANGLE_COUNT, width, height);
+    printf("%-8s %10s %12s\n", "size", "ms", "Mtris/s");
+    int sizes[] = {8, 64, 512};
+    for (int s = 0; s < 3; s++) {
+        double ms = _fill_random(sizes[s]);
+        printf("%-8d %10.3f %12.2f\n", sizes[s], ms, TRIANGLE_COUNT / ms / 1000.0);
+    }
+
+    size(320, 240);
+    _free_framebuffer();
+    _init_framebuffer();
+    int errors = _mesh_coverage_errors();
+    printf("mesh: %d pixels not covered exactly once\n", errors);
+
+    _free_framebuffer();
+    return errors == 0 ? 0 : 1;
+}
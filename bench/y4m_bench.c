@@ -0,0 +1,78 @@
+/**
+ * y4m_bench.c - Cost of streaming 1080p frames as YUV4MPEG2
+ *
+ * Build with `make bench` and run ./build/y4m_bench [output]
+ * (default /dev/null; pass a fifo read by ffmpeg for a real pipeline)
+ */
+
+#include "../src/p5c.c"
+
+#include <stdio.h>
+
+#define STREAM_FRAMES 300
+
+static uint64_t captureNs = 0;
+
+void setup(void) {
+    size(1920, 1080);
+    frameRate(60);
+}
+
+// A moving gradient so every frame differs
+void draw(void) {
+    for (int y = 0; y < height; y++) {
+        uint32_t* row = framebuffer + (size_t)y * width;
+        for (int x = 0; x < width; x++) {
+            row[x] = 0xFF000000u | (uint32_t)(((x + frameCount) & 0xFF) << 16) | (uint32_t)((y & 0xFF) << 8) | 0x40;
+        }
+    }
+    _mark_all_dirty();
+}
+
+// Time just the per-frame hand-off the frame loop pays for
+static void bench_capture(void) {
+    uint64_t start = _monotonic_ns();
+    _video_capture_frame();
+    captureNs += _monotonic_ns() - start;
+}
+
+int main(int argc, char** argv) {
+    const char* path = argc > 1 ? argv[1] : "/dev/null";
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "cannot open %s\n", path);
+        return 1;
+    }
+
+    setup();
+    _init_framebuffer();
+
+    // Conversion alone, without the writer thread
+    uint8_t* i420 = (uint8_t*)malloc((size_t)width * height * 3 / 2);
+    uint64_t start = _monotonic_ns();
+    for (int i = 0; i < STREAM_FRAMES; i++) {
+        _convert_i420(framebuffer, width, height, i420);
+    }
+    double convertMs = (_monotonic_ns() - start) / 1e6 / STREAM_FRAMES;
+    free(i420);
+
+    // Full stream: draw, convert and queue, write on the background thread
+    p5c_stream_y4m(fd);
+    start = _monotonic_ns();
+    for (frameCount = 0; frameCount < STREAM_FRAMES; frameCount++) {
+        draw();
+        bench_capture();
+    }
+    _video_shutdown();
+    double totalSeconds = (_monotonic_ns() - start) * 1e-9;
+
+    P5ExportStats stats = p5c_get_video_stats();
+    printf("1920x1080 BGRA->I420 convert: %.2f ms/frame\n", convertMs);
+    printf("capture on frame loop:        %.2f ms/frame (budget at 60 fps: 16.67 ms)\n",
+           captureNs / 1e6 / STREAM_FRAMES);
+    printf("end-to-end:                   %.1f fps, %d frames written, %d stalls (%.1f ms)\n",
+           STREAM_FRAMES / totalSeconds, stats.framesWritten, stats.stalls, stats.stallSeconds * 1000.0);
+
+    _free_framebuffer();
+    return 0;
+}
@@ -0,0 +1,42 @@
+/**
+ * headless_render.c - Render frames offscreen and inspect the pixels
+ *
+ * Runs without a display, so it works on CI machines and render servers.
+ */
+
+#include "../include/p5c.h"
+#include <stdio.h>
+
+#define FRAMES 120
+
+float x = 0;
+
+void setup() {
+    size(320, 240);
+}
+
+void draw() {
+    background(20, 20, 40);
+
+    fill(255, 200, 0);
+    noStroke();
+    ellipse((int)x, 100, 40, 40);
+
+    x += 2;
+}
+
+int main() {
+    // Render FRAMES frames at full speed with no window
+    p5c_headless(FRAMES);
+    int result = run();
+
+    // Hash the final frame, e.g. to compare against a known-good value
+    const uint32_t* pixels = p5c_get_pixels();
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < width * height; i++) {
+        hash = (hash ^ pixels[i]) * 16777619u;
+    }
+    printf("Rendered %d frames, final frame hash %08x\n", frameCount, hash);
+
+    return result;
+}
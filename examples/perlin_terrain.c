@@ -36,6 +36,27 @@ int scl = 20;
 int w = 2000;
 int h = 1600;
 
+// The moon and mountains never change, so they are recorded once and replayed
+P5Record* scenery = NULL;
+
+static void draw_scenery(void) {
+    // Draw a "moon"
+    fill(200, 200, 200);
+    noStroke();
+    ellipse(100, 100, 50, 50);
+
+    // Draw some mountains in the foreground
+    fill(100, 100, 100);
+    for (int i = 0; i < width; i += 200) {
+        int mHeight = (int)(150 + noise(i * 0.01f) * 100);
+        triangle(
+            i, height,
+            i + 100, height - mHeight,
+            i + 200, height
+        );
+    }
+}
+
 void setup() {
     // Set the canvas size
     size(640, 480);
@@ -90,20 +111,13 @@ void draw() {
         point(x, y);
     }
 
-    // Draw a "moon"
-    fill(200, 200, 200);
-    noStroke();
-    ellipse(100, 100, 50, 50);
-
-    // Draw some mountains in the foreground
-    fill(100, 100, 100);
-    for (int i = 0; i < width; i += 200) {
-        int mHeight = (int)(150 + noise(i * 0.01f) * 100);
-        triangle(
-            i, height,
-            i + 100, height - mHeight,
-            i + 200, height
-        );
+    // Record the static scenery on the first frame, then replay its spans
+    if (!scenery) {
+        beginRecord();
+        draw_scenery();
+        scenery = endRecord();
+    } else {
+        drawRecord(scenery);
     }
 }
 
@@ -29,8 +29,8 @@ void setup() {
 }
 
 void draw() {
-    // Set the background color
-    background(0, 0, 0);
+    // Don't clear the background: the walker leaves a trail, and only the
+    // newly drawn circle has to be sent to the screen each frame
 
     // Set the stroke color to white
     stroke(255, 255, 255);
@@ -0,0 +1,40 @@
+#include "../include/p5c.h"
+
+float angle = 0.0f;
+
+void setup() {
+    // Set the canvas size
+    size(640, 480);
+
+    // Set frame rate
+    frameRate(60);
+}
+
+void draw() {
+    background(30, 30, 30);
+
+    // Spin a square around the center of the canvas
+    push();
+    translate(width / 2, height / 2);
+    rotate(angle);
+    fill(255, 0, 0);
+    stroke(255, 255, 255);
+    rect(-60, -60, 120, 120);
+
+    // A stretched circle rotates with the square
+    scale(2.0f, 0.5f);
+    fill(0, 0, 255);
+    circle(-20, -20, 40);
+    pop();
+
+    // Untransformed shapes are not affected
+    fill(0, 255, 0);
+    noStroke();
+    ellipse(20, 20, 40, 40);
+
+    angle += 0.02f;
+}
+
+int main() {
+    return run();
+}
@@ -15,7 +15,7 @@
     #define P5C_WINDOWS
 #elif defined(__linux__)
     #define P5C_LINUX
-#else
+#elif !defined(P5C_HEADLESS)
     #error "Unsupported platform"
 #endif
 
@@ -43,6 +43,7 @@ typedef struct {
 extern int width;
 extern int height;
 extern int frameCount;
+extern float deltaTime; // Milliseconds between the starts of the last two frames
 extern int mouseX;
 extern int mouseY;
 extern int mousePressed;
@@ -57,6 +58,7 @@ void draw(void);
 void size(int w, int h);
 void background(uint8_t r, uint8_t g, uint8_t b);
 void frameRate(int fps);
+unsigned long millis(void);
 int run(void);
 
 // Drawing functions
@@ -74,13 +76,28 @@ void arcDetail(int x, int y, int w, int h, float start, float stop, int mode, in
 
 // Transform functions
 void translate(float x, float y);
+void rotate(float angle);
+void scale(float sx, float sy);
+void applyMatrix(float a, float b, float c, float d, float e, float f);
 void push(void);
 void pop(void);
 void resetMatrix(void);
 
-// Color functions
+// Color functions. fill() and stroke() take r, g, b or r, g, b, alpha, as in
+// fill(r, g, b, 128); translucent shapes blend over what is already drawn.
+// Any other number of arguments fails to compile with an undeclared
+// p5c_fill_takes_3_or_4_arguments (or p5c_stroke_...) error.
 void fill(uint8_t r, uint8_t g, uint8_t b);
 void stroke(uint8_t r, uint8_t g, uint8_t b);
+void fillRGBA(uint8_t r, uint8_t g, uint8_t b, uint8_t a);
+void strokeRGBA(uint8_t r, uint8_t g, uint8_t b, uint8_t a);
+#define P5C_COLOR_FN(_1, _2, _3, _4, name, ...) name
+#define fill(...) \
+    (P5C_COLOR_FN(__VA_ARGS__, fillRGBA, fill, p5c_fill_takes_3_or_4_arguments, \
+                  p5c_fill_takes_3_or_4_arguments, ))(__VA_ARGS__)
+#define stroke(...) \
+    (P5C_COLOR_FN(__VA_ARGS__, strokeRGBA, stroke, p5c_stroke_takes_3_or_4_arguments, \
+                  p5c_stroke_takes_3_or_4_arguments, ))(__VA_ARGS__)
 void noFill(void);
 void noStroke(void);
 
@@ -97,4 +114,140 @@ int keyIsDown(char k);
 // Add the strokeWeight function declaration
 void strokeWeight(int weight);
 
+// Anti-aliased lines; noSmooth() (the default) keeps hard pixel edges
+void smooth(void);
+void noSmooth(void);
+
+// Display lists: drawing between beginRecord() and endRecord() is stored as
+// the spans it wrote, transformed and clipped. drawRecord() replays them at
+// the same place without any rasterization. Record after size(); on a
+// target of another size the list is clipped.
+typedef struct P5Record P5Record;
+
+void beginRecord(void);
+P5Record* endRecord(void);
+void drawRecord(P5Record* record);
+void freeRecord(P5Record* record);
+
+// Batched primitives: draw n shapes from parallel coordinate arrays in one
+// call, with the same result as calling the single function in a loop.
+// colors may be NULL; otherwise it replaces the stroke color (points, lines)
+// or fill color (ellipses, rects) per element.
+void points(const float* xs, const float* ys, const Color* colors, int n);
+void lines(const float* x1s, const float* y1s, const float* x2s, const float* y2s, const Color* colors, int n);
+void ellipses(const float* xs, const float* ys, const float* ws, const float* hs, const Color* colors, int n);
+void rects(const float* xs, const float* ys, const float* ws, const float* hs, const Color* colors, int n);
+
+// Offscreen graphics: createGraphics() makes a transparent w x h layer.
+// Drawing between beginDraw(g) and endDraw() goes into it (width and height
+// report its size meanwhile, and the transform starts from identity).
+// image() copies a layer onto the canvas; imageBlend() composites it with
+// its transparency. Both honour translate() only.
+typedef struct P5Graphics P5Graphics;
+
+P5Graphics* createGraphics(int w, int h);
+void freeGraphics(P5Graphics* g);
+void beginDraw(P5Graphics* g);
+void endDraw(void);
+void clear(void);
+void image(P5Graphics* g, int x, int y);
+void imageBlend(P5Graphics* g, int x, int y);
+
+// Tiled rendering: with count > 1 threads (0 for one per CPU), draw calls
+// are recorded during draw() and rasterized at the end of the frame by a
+// worker pool, one 64x64 tile at a time in the order they were issued.
+// The pixels are identical to immediate drawing. P5C_THREADS=<count> in the
+// environment does the same when p5c_threads() is not called.
+void p5c_threads(int count);
+
+// Frame export: saveCanvas() writes the canvas once, saveFrames() writes the
+// next count frames using a printf pattern such as "out/frame_%04d.qoi".
+// Files ending in .qoi are written as QOI, everything else as binary PPM.
+// Encoding runs on a writer thread; draw() only waits when all ring buffers
+// are full, which p5c_get_export_stats() reports as stalls.
+typedef struct {
+    int framesQueued;    // Frames handed to the writer thread
+    int framesWritten;   // Frames encoded and written to disk
+    int framesDropped;   // Frames that could not be allocated or written
+    int stalls;          // Times the frame loop waited for a free buffer
+    double stallSeconds; // Total time spent waiting
+} P5ExportStats;
+
+void saveCanvas(const char* path);
+void saveFrames(const char* pattern, int count);
+void p5c_export_ring_size(int buffers);
+P5ExportStats p5c_get_export_stats(void);
+
+// Video streaming: write every frame as YUV4MPEG2 (I420) to fd, e.g. 1 to
+// pipe into "ffmpeg -i - out.mp4". Setting P5C_Y4M=<path> (or "-" for stdout)
+// does the same without code changes. Frames are converted on the frame loop
+// and written by a background thread.
+void p5c_stream_y4m(int fd);
+P5ExportStats p5c_get_video_stats(void);
+
+// Frame statistics: p5c_get_frame_stats() returns the timings and drawing
+// counters of the last completed frame. p5c_stats_overlay(1), or P5C_STATS=1
+// in the environment, shows the frame rate and a graph of recent frame times
+// in the top-left corner of the window; saved and streamed frames leave it out.
+#define P5C_STAT_POINT      0
+#define P5C_STAT_LINE       1
+#define P5C_STAT_TRIANGLE   2
+#define P5C_STAT_QUAD       3
+#define P5C_STAT_RECT       4
+#define P5C_STAT_ELLIPSE    5
+#define P5C_STAT_ARC        6
+#define P5C_STAT_IMAGE      7
+#define P5C_STAT_RECORD     8
+#define P5C_STAT_PRIMITIVES 9
+
+typedef struct {
+    int frame;                           // frameCount of the frame
+    double frameMs;                      // From its start to the next frame's
+    double drawMs;                       // In draw() and rasterizing deferred drawing
+    double presentMs;                    // Copying it to the window
+    double sleepMs;                      // Sleeping until the next frame was due
+    uint64_t pixels;                     // Pixels written or blended
+    uint64_t spans;                      // Horizontal runs filled by the rasterizers
+    int primitives[P5C_STAT_PRIMITIVES]; // Shapes drawn, by P5C_STAT_* type
+    int framesDropped;                   // Frames skipped so far for running late
+} P5FrameStats;
+
+P5FrameStats p5c_get_frame_stats(void);
+void p5c_stats_overlay(int enabled);
+
+// Tracing: building with -DP5C_TRACE (make TRACE=1) records the frame loop
+// stages, the tile workers and every drawing call as Chrome trace events,
+// written to p5c_trace.json (or P5C_TRACE_FILE=<path>) for chrome://tracing
+// or ui.perfetto.dev. P5C_TRACE_ZONE("name") times the rest of the
+// enclosing block; without -DP5C_TRACE it compiles to nothing. The name
+// must be a string that outlives the program, such as a literal.
+#ifdef P5C_TRACE
+#if !defined(__GNUC__)
+    #error "P5C_TRACE needs GCC or Clang"
+#endif
+
+typedef struct {
+    const char* name;
+    uint64_t start;
+} P5TraceZone;
+
+uint64_t p5c_trace_begin(void);
+void p5c_trace_end(P5TraceZone* zone);
+
+#define P5C_TRACE_CONCAT_(a, b) a##b
+#define P5C_TRACE_CONCAT(a, b) P5C_TRACE_CONCAT_(a, b)
+#define P5C_TRACE_ZONE(name) \
+    P5TraceZone P5C_TRACE_CONCAT(p5cTraceZone, __LINE__) \
+        __attribute__((cleanup(p5c_trace_end))) = {(name), p5c_trace_begin()}
+#else
+#define P5C_TRACE_ZONE(name) ((void)0)
+#endif
+
+// Headless rendering: call p5c_headless() before run() (or set
+// P5C_HEADLESS=<frames>) to render that many frames without a window.
+// p5c_get_pixels() returns the width * height 0xAARRGGBB framebuffer and
+// stays valid after run() returns in headless mode.
+void p5c_headless(int frames);
+const uint32_t* p5c_get_pixels(void);
+
 #endif /* P5C_H */
@@ -108,6 +108,24 @@ int keyIsDown(char k);
     #include <unistd.h>
 #endif
 
+// SIMD support (SSE2 is part of the x86-64 baseline)
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #include <emmintrin.h>
+    #define P5C_SSE2
+#endif
+
+// AVX2 kernels are compiled with a target attribute and picked at runtime
+#if defined(P5C_SSE2) && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    #include <immintrin.h>
+    #define P5C_AVX2
+#endif
+
+// Framebuffer alignment in bytes (one cache line)
+#define FRAMEBUFFER_ALIGN 64
+
+// Clears at least this large bypass the cache with non-temporal stores
+#define STREAMING_CLEAR_BYTES (256 * 1024)
+
 // Global state variables
 int width = 640;
 int height = 480;
@@ -152,7 +170,10 @@ static void (*_draw)(void) = NULL;
 static void _init_framebuffer(void);
 static void _render_framebuffer(void);
 static void _clear_framebuffer(uint8_t r, uint8_t g, uint8_t b);
+static void _free_framebuffer(void);
 static void _set_pixel(int x, int y, uint8_t r, uint8_t g, uint8_t b);
+static void _fill_span(int y, int x0, int x1, uint32_t color);
+static uint32_t _pack_color(Color c);
 static void _sort_points_by_y(int* x1, int* y1, int* x2, int* y2, int* x3, int* y3);
 
 // Initialize the library
@@ -236,10 +257,9 @@ void line(int x1, int y1, int x2, int y2) {
 void rect(int x, int y, int w, int h) {
     // Fill the rectangle if fill is enabled
     if (useFill) {
+        uint32_t color = _pack_color(fillColor);
         for (int j = y; j < y + h; j++) {
-            for (int i = x; i < x + w; i++) {
-                _set_pixel(i, j, fillColor.r, fillColor.g, fillColor.b);
-            }
+            _fill_span(j, x, x + w - 1, color);
         }
     }
 
@@ -261,15 +281,21 @@ void ellipse(int x, int y, int w, int h) {
 
     // Fill the ellipse if fill is enabled
     if (useFill) {
-        // Simple scanline fill
+        uint32_t color = _pack_color(fillColor);
+
+        // Simple scanline fill: solve (dx/a)^2 + (dy/b)^2 <= 1 for the
+        // horizontal extent of each row and write it as one span
         for (int j = y; j < y + h; j++) {
-            for (int i = x; i < x + w; i++) {
-                float dx = (i - cx) / (float)a;
-                float dy = (j - cy) / (float)b;
-                if (dx * dx + dy * dy <= 1.0f) {
-                    _set_pixel(i, j, fillColor.r, fillColor.g, fillColor.b);
-                }
-            }
+            float dy = (j - cy) / (float)b;
+            float t = 1.0f - dy * dy;
+            if (t < 0.0f) continue;
+
+            float half = a * sqrtf(t);
+            int x0 = (int)ceilf(cx - half);
+            int x1 = (int)floorf(cx + half);
+            if (x0 < x) x0 = x;
+            if (x1 > x + w - 1) x1 = x + w - 1;
+            _fill_span(j, x0, x1, color);
         }
     }
 
@@ -360,6 +386,8 @@ void triangle(int x1, int y1, int x2, int y2, int x3, int y3) {
 
     // Fill the triangle if fill is enabled
     if (useFill) {
+        uint32_t color = _pack_color(fillColor);
+
         // Sort the vertices by y-coordinate
         _sort_points_by_y(&x1, &y1, &x2, &y2, &x3, &y3);
 
@@ -372,9 +400,7 @@ void triangle(int x1, int y1, int x2, int y2, int x3, int y3) {
             float x_end = x1;
 
             for (int y = y1; y <= y2; y++) {
-                for (int x = (int)x_start; x <= (int)x_end; x++) {
-                    _set_pixel(x, y, fillColor.r, fillColor.g, fillColor.b);
-                }
+                _fill_span(y, (int)floorf(x_start), (int)floorf(x_end), color);
                 x_start += slope1;
                 x_end += slope2;
             }
@@ -388,9 +414,7 @@ void triangle(int x1, int y1, int x2, int y2, int x3, int y3) {
             float x_end = x3;
 
             for (int y = y3; y >= y1; y--) {
-                for (int x = (int)x_start; x <= (int)x_end; x++) {
-                    _set_pixel(x, y, fillColor.r, fillColor.g, fillColor.b);
-                }
+                _fill_span(y, (int)floorf(x_start), (int)floorf(x_end), color);
                 x_start -= slope1;
                 x_end -= slope2;
             }
@@ -408,9 +432,7 @@ void triangle(int x1, int y1, int x2, int y2, int x3, int y3) {
             float x_end = x1;
 
             for (int y = y1; y <= y2; y++) {
-                for (int x = (int)x_start; x <= (int)x_end; x++) {
-                    _set_pixel(x, y, fillColor.r, fillColor.g, fillColor.b);
-                }
+                _fill_span(y, (int)floorf(x_start), (int)floorf(x_end), color);
                 x_start += slope1;
                 x_end += slope2;
             }
@@ -422,9 +444,7 @@ void triangle(int x1, int y1, int x2, int y2, int x3, int y3) {
             x_end = x3;
 
             for (int y = y3; y > y2; y--) {
-                for (int x = (int)x_start; x <= (int)x_end; x++) {
-                    _set_pixel(x, y, fillColor.r, fillColor.g, fillColor.b);
-                }
+                _fill_span(y, (int)floorf(x_start), (int)floorf(x_end), color);
                 x_start -= slope1;
                 x_end -= slope2;
             }
@@ -434,10 +454,16 @@ void triangle(int x1, int y1, int x2, int y2, int x3, int y3) {
 
 // Initialize the framebuffer
 static void _init_framebuffer(void) {
-    if (framebuffer) {
-        free(framebuffer);
-    }
-    framebuffer = (uint32_t*)malloc(width * height * sizeof(uint32_t));
+    _free_framebuffer();
+
+    // Cache-line aligned so the SIMD kernels can use aligned stores
+    size_t bytes = (size_t)width * height * sizeof(uint32_t);
+#ifdef P5C_WINDOWS
+    framebuffer = (uint32_t*)_aligned_malloc(bytes, FRAMEBUFFER_ALIGN);
+#else
+    void* memory = NULL;
+    framebuffer = posix_memalign(&memory, FRAMEBUFFER_ALIGN, bytes) == 0 ? (uint32_t*)memory : NULL;
+#endif
     if (!framebuffer) {
         fprintf(stderr, "Failed to allocate framebuffer\n");
         exit(1);
@@ -445,23 +471,141 @@ static void _init_framebuffer(void) {
     _clear_framebuffer(0, 0, 0);
 }
 
-// Clear the framebuffer with a specific color
-static void _clear_framebuffer(uint8_t r, uint8_t g, uint8_t b) {
+
+// Set a pixel in the framebuffer
+static void _set_pixel(int x, int y, uint8_t r, uint8_t g, uint8_t b) {
     if (!framebuffer) return;
+    if (x < 0 || x >= width || y < 0 || y >= height) return;
 
     uint32_t color = (0xFF << 24) | (r << 16) | (g << 8) | b;
-    for (int i = 0; i < width * height; i++) {
-        framebuffer[i] = color;
+    framebuffer[y * width + x] = color;
+}
+
+// Pack a color into the framebuffer's 0xAARRGGBB layout
+static uint32_t _pack_color(Color c) {
+    return 0xFF000000u | ((uint32_t)c.r << 16) | ((uint32_t)c.g << 8) | c.b;
+}
+
+// Store n copies of a packed color starting at dst
+static void _fill_row(uint32_t* dst, size_t n, uint32_t color) {
+#ifdef P5C_SSE2
+    // Store single pixels until dst is 16-byte aligned, then 4 at a time
+    while (n > 0 && ((uintptr_t)dst & 15)) {
+        *dst++ = color;
+        n--;
+    }
+    __m128i c = _mm_set1_epi32((int)color);
+    for (; n >= 16; n -= 16, dst += 16) {
+        _mm_store_si128((__m128i*)dst, c);
+        _mm_store_si128((__m128i*)(dst + 4), c);
+        _mm_store_si128((__m128i*)(dst + 8), c);
+        _mm_store_si128((__m128i*)(dst + 12), c);
+    }
+    for (; n >= 4; n -= 4, dst += 4) {
+        _mm_store_si128((__m128i*)dst, c);
+    }
+#endif
+    while (n-- > 0) {
+        *dst++ = color;
     }
 }
 
-// Set a pixel in the framebuffer
-static void _set_pixel(int x, int y, uint8_t r, uint8_t g, uint8_t b) {
+// Fill the horizontal span [x0, x1] on row y with a packed color
+static void _fill_span(int y, int x0, int x1, uint32_t color) {
+    if (!framebuffer) return;
+
+    // Clip once for the whole span
+    if (y < 0 || y >= height) return;
+    if (x0 < 0) x0 = 0;
+    if (x1 >= width) x1 = width - 1;
+    if (x0 > x1) return;
+
+    _fill_row(framebuffer + (size_t)y * width + x0, x1 - x0 + 1, color);
+}
+
+// Release the framebuffer allocated by _init_framebuffer
+static void _free_framebuffer(void) {
+    if (!framebuffer) return;
+#ifdef P5C_WINDOWS
+    _aligned_free(framebuffer);
+#else
+    free(framebuffer);
+#endif
+    framebuffer = NULL;
+}
+
+#ifdef P5C_AVX2
+// Store n copies of color with 32-byte non-temporal stores
+__attribute__((target("avx2")))
+static void _stream_fill_avx2(uint32_t* dst, size_t n, uint32_t color) {
+    while (n > 0 && ((uintptr_t)dst & 31)) {
+        *dst++ = color;
+        n--;
+    }
+    __m256i c = _mm256_set1_epi32((int)color);
+    for (; n >= 32; n -= 32, dst += 32) {
+        _mm256_stream_si256((__m256i*)dst, c);
+        _mm256_stream_si256((__m256i*)(dst + 8), c);
+        _mm256_stream_si256((__m256i*)(dst + 16), c);
+        _mm256_stream_si256((__m256i*)(dst + 24), c);
+    }
+    for (; n >= 8; n -= 8, dst += 8) {
+        _mm256_stream_si256((__m256i*)dst, c);
+    }
+    _mm_sfence();
+    while (n-- > 0) {
+        *dst++ = color;
+    }
+}
+#endif
+
+// Store n copies of color, streaming past the cache where possible
+static void _stream_fill(uint32_t* dst, size_t n, uint32_t color) {
+#ifdef P5C_AVX2
+    if (__builtin_cpu_supports("avx2")) {
+        _stream_fill_avx2(dst, n, color);
+        return;
+    }
+#endif
+#ifdef P5C_SSE2
+    while (n > 0 && ((uintptr_t)dst & 15)) {
+        *dst++ = color;
+        n--;
+    }
+    __m128i c = _mm_set1_epi32((int)color);
+    for (; n >= 16; n -= 16, dst += 16) {
+        _mm_stream_si128((__m128i*)dst, c);
+        _mm_stream_si128((__m128i*)(dst + 4), c);
+        _mm_stream_si128((__m128i*)(dst + 8), c);
+        _mm_stream_si128((__m128i*)(dst + 12), c);
+    }
+    for (; n >= 4; n -= 4, dst += 4) {
+        _mm_stream_si128((__m128i*)dst, c);
+    }
+    _mm_sfence();
+#endif
+    while (n-- > 0) {
+        *dst++ = color;
+    }
+}
+
+// Clear the framebuffer with a specific color
+static void _clear_framebuffer(uint8_t r, uint8_t g, uint8_t b) {
     if (!framebuffer) return;
-    if (x < 0 || x >= width || y < 0 || y >= height) return;
 
     uint32_t color = (0xFF << 24) | (r << 16) | (g << 8) | b;
-    framebuffer[y * width + x] = color;
+    size_t count = (size_t)width * height;
+#ifdef P5C_DEBUG
+    fprintf(stderr, "p5c: clearing %zu pixels with color (%d, %d, %d)\n", count, r, g, b);
+#endif
+
+    // Small canvases stay in cache for the drawing that follows; large ones
+    // would only evict it, so write them around the cache
+    if (count * sizeof(uint32_t) >= STREAMING_CLEAR_BYTES) {
+        _stream_fill(framebuffer, count, color);
+    } else {
+        _fill_row(framebuffer, count, color);
+    }
 }
 
 // Math utilities
@@ -627,10 +771,7 @@ int run(void) {
 
 cleanup:
     // Clean up
-    if (framebuffer) {
-        free(framebuffer);
-        framebuffer = NULL;
-    }
+    _free_framebuffer();
     ReleaseDC(hwnd, hdc);
     return 0;
 }
@@ -794,10 +935,7 @@ cleanup:
         ximage->data = NULL; // Prevent XDestroyImage from freeing our framebuffer
         XDestroyImage(ximage);
     }
-    if (framebuffer) {
-        free(framebuffer);
-        framebuffer = NULL;
-    }
+    _free_framebuffer();
     XFreeGC(display, gc);
     XDestroyWindow(display, window);
     XCloseDisplay(display);
@@ -13,6 +13,8 @@
 #define CLOCK_MONOTONIC 1
 #endif
 #include <math.h>
+#include <limits.h>
+#include <stddef.h>
 #include <string.h> // for memcpy
 
 // Define M_PI if not already defined
@@ -20,21 +22,77 @@
 #define M_PI 3.14159265358979323846
 #endif
 
+// Window system backends; a P5C_HEADLESS build has none and needs no X11
+#ifndef P5C_HEADLESS
+    #if defined(P5C_WINDOWS)
+        #define P5C_WIN32_BACKEND
+    #elif defined(P5C_LINUX)
+        #define P5C_X11_BACKEND
+    #endif
+#endif
+
 // Platform-specific includes
 #ifdef P5C_WINDOWS
     #include <windows.h>
+    #include <mmsystem.h>
+    #include <io.h>
+    #include <fcntl.h>
+#else
+    #include <pthread.h>
+    #include <unistd.h>
+    #include <fcntl.h>
+    #include <errno.h>
+    #include <poll.h>
+    #include <signal.h>
 #endif
 
-#ifdef P5C_LINUX
+#ifdef P5C_X11_BACKEND
     #include <X11/Xlib.h>
     #include <X11/Xutil.h>
-    #include <unistd.h>
+    #include <X11/extensions/XShm.h>
+    #include <sys/ipc.h>
+    #include <sys/shm.h>
+#endif
+
+// SIMD support (SSE2 is part of the x86-64 baseline)
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #include <emmintrin.h>
+    #define P5C_SSE2
+#endif
+
+// AVX2 and SSSE3 kernels are compiled with a target attribute and picked at runtime
+#if defined(P5C_SSE2) && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    #include <immintrin.h>
+    #define P5C_AVX2
+    #define P5C_SSSE3
+#endif
+
+// Framebuffer alignment in bytes (one cache line)
+#define FRAMEBUFFER_ALIGN 64
+
+// Clears at least this large bypass the cache with non-temporal stores
+#define STREAMING_CLEAR_BYTES (256 * 1024)
+
+// Dirty tracking granularity: writes mark 32x32 pixel tiles
+#define DIRTY_TILE_SHIFT 5
+#define DIRTY_TILE_SIZE (1 << DIRTY_TILE_SHIFT)
+
+// Tiled rendering bins commands into 64x64 tiles (a multiple of the dirty
+// tiles, so workers never share a dirty flag)
+#define BIN_TILE_SHIFT 6
+#define BIN_TILE_SIZE (1 << BIN_TILE_SHIFT)
+
+#ifdef _MSC_VER
+    #define P5C_THREAD_LOCAL __declspec(thread)
+#else
+    #define P5C_THREAD_LOCAL __thread
 #endif
 
 // Global state variables
 int width = 640;
 int height = 480;
 int frameCount = 0;
+float deltaTime = 0.0f;
 int mouseX = 0;
 int mouseY = 0;
 int mousePressed = 0;
@@ -49,23 +107,102 @@ static int specialKeyStates[256] = {0};
 
 // Internal state
 static uint32_t* framebuffer = NULL;
-static Color fillColor = {255, 255, 255};
-static Color strokeColor = {0, 0, 0};
-static int useFill = 1;
-static int useStroke = 1;
+static int framebufferExternal = 0; // Memory owned by a presentation backend
+static int canvasPresented = 0;     // A window shows the framebuffer; its size is fixed
+static P5Graphics* activeGraphics = NULL; // Layer between beginDraw() and endDraw()
 static int targetFrameRate = 60;
 static int currentAngleMode = RADIANS; // Default to radians
 
-// Add a global variable for stroke weight
-static int strokeWeightValue = 1; // Default stroke weight is 1
+// Drawing style is per thread: the main thread holds the sketch's style, and
+// tile workers load each recorded command's style into their own copy
+static P5C_THREAD_LOCAL Color fillColor = {255, 255, 255};
+static P5C_THREAD_LOCAL Color strokeColor = {0, 0, 0};
+static P5C_THREAD_LOCAL uint8_t fillAlpha = 255;
+static P5C_THREAD_LOCAL uint8_t strokeAlpha = 255;
+static P5C_THREAD_LOCAL int useFill = 1;
+static P5C_THREAD_LOCAL int useStroke = 1;
+static P5C_THREAD_LOCAL int strokeWeightValue = 1; // Default stroke weight is 1
+static P5C_THREAD_LOCAL int useSmooth = 0;          // Anti-aliased lines
+
+// Inclusive clip rectangle for pixel writes: the canvas on the main thread,
+// the current tile on a worker
+static P5C_THREAD_LOCAL int clipX0 = 0;
+static P5C_THREAD_LOCAL int clipY0 = 0;
+static P5C_THREAD_LOCAL int clipX1 = -1;
+static P5C_THREAD_LOCAL int clipY1 = -1;
+
+// Drawing counters of the frame in progress, per thread so that counting
+// takes no locks; tile workers fold theirs into the frame's totals when they
+// finish their tiles
+typedef struct {
+    uint64_t pixels;
+    uint64_t spans;
+    int primitives[P5C_STAT_PRIMITIVES];
+} FrameCounters;
+
+static P5C_THREAD_LOCAL FrameCounters frameCounters;
+
+// Nonzero inside a counted call that draws through other public calls, such
+// as rect() through quad()
+static int primitiveDepth = 0;
+
+static inline void _count_primitives(int type, int n) {
+    if (primitiveDepth == 0) frameCounters.primitives[type] += n;
+}
+
+// Count one filled run of n pixels
+static inline void _count_span(int n) {
+    frameCounters.spans++;
+    frameCounters.pixels += (uint64_t)n;
+}
+
+// Set while draw calls are recorded for the tile workers instead of drawn
+static int recordingCommands = 0;
+
+// Set between beginRecord() and endRecord(): pixel writes are also captured
+static int recordingList = 0;
+
+// Recorded draw command types, each replaying one device-space rasterizer
+#define COMMAND_CLEAR    0
+#define COMMAND_POINT    1
+#define COMMAND_LINE     2
+#define COMMAND_TRIANGLE 3
+#define COMMAND_ELLIPSE  4
+#define COMMAND_POLYGON  5
+#define COMMAND_SECTOR   6
+#define COMMAND_RECORD   7
+#define COMMAND_IMAGE    8
 
 #define MAX_MATRIX_STACK 32
+#define MAX_ELLIPSE_SEGMENTS 1024
+
+// Matrix kinds, from cheapest to most general, so drawing code can skip
+// work the current transform does not need
+#define MATRIX_IDENTITY  0
+#define MATRIX_TRANSLATE 1
+#define MATRIX_AFFINE    2
 
 typedef struct {
     float m[3][3]; // 3x3 matrix for 2D transformations
+    int kind;      // MATRIX_IDENTITY, MATRIX_TRANSLATE or MATRIX_AFFINE
 } Matrix;
 
-static Matrix currentMatrix;
+// A rectangle of the canvas that needs presenting, in pixels
+typedef struct {
+    int x, y, w, h;
+} DirtyRect;
+
+// One byte per tile, set when anything in the tile was written this frame
+static uint8_t* dirtyTiles = NULL;
+static int dirtyCols = 0;
+static int dirtyRows = 0;
+static int dirtyAll = 0; // Set by full-canvas writes such as background()
+
+// Scratch space for merging dirty tiles into rectangles (one row's worth each)
+static DirtyRect* dirtyOpen = NULL;
+static DirtyRect* dirtyNext = NULL;
+
+static Matrix currentMatrix = {{{1.0f, 0.0f, 0.0f}, {0.0f, 1.0f, 0.0f}, {0.0f, 0.0f, 1.0f}}, MATRIX_IDENTITY};
 static Matrix matrixStack[MAX_MATRIX_STACK];
 static int matrixStackSize = 0;
 
@@ -73,37 +210,90 @@ static int matrixStackSize = 0;
 static void (*_setup)(void) = NULL;
 static void (*_draw)(void) = NULL;
 
+// Headless mode: number of frames to render offscreen, 0 when a window is used
+static int headlessFrames = 0;
+
 // Platform-specific variables
-#ifdef P5C_WINDOWS
+#ifdef P5C_WIN32_BACKEND
     static HWND hwnd;
     static HDC hdc;
     static BITMAPINFO bmi;
 #endif
 
-#ifdef P5C_LINUX
+#ifdef P5C_X11_BACKEND
     static Display* display;
     static Window window;
     static GC gc;
     static XImage* ximage;
     static Atom wm_delete_window;
+
+    // MIT-SHM presentation: the framebuffer lives in a segment shared with the X server
+    static XShmSegmentInfo shmInfo;
+    static int useShm = 0;
+    static int shmCompletionType = 0;
+    static int shmPending = 0; // XShmPutImage requests not yet completed
 #endif
 
 // Forward declarations of internal functions
 static void _init_framebuffer(void);
+#ifdef P5C_X11_BACKEND
+static void _adopt_framebuffer(uint32_t* memory);
+#endif
+#ifndef P5C_HEADLESS
 static void _render_framebuffer(void);
+#endif
 static void _clear_framebuffer(uint8_t r, uint8_t g, uint8_t b);
-static void _set_pixel(int x, int y, uint8_t r, uint8_t g, uint8_t b);
+static void _free_framebuffer(void);
+static void _init_dirty_tiles(void);
+static void _reset_clip(void);
+static void _free_dirty_tiles(void);
+static int _present_dirty_rects(void (*present)(int x, int y, int w, int h));
+static void _set_pixel(int x, int y, uint32_t color);
+static void _fill_span(int y, int x0, int x1, uint32_t color);
+static uint32_t _pack_color(Color c, uint8_t alpha);
+static inline uint32_t _blend_pixel(uint32_t dst, uint32_t src);
 static void _init_matrix(Matrix* m);
 static void _transform_point(float* x, float* y);
+static void _draw_triangle(int x1, int y1, int x2, int y2, int x3, int y3);
+static void _record_command(int type, int v0, int v1, int v2, int v3, int v4, int v5);
+static void _record_polygon(const int* xs, const int* ys, int n);
+static void _record_sector(int cx, int cy, int a, int b, float start, float stop);
+static void _init_tile_renderer(void);
+static void _flush_commands(void);
+static void _capture_span(int y, int x0, int x1, uint32_t color);
+static void _draw_line_smooth(int x1, int y1, int x2, int y2);
+static void _fill_disc(int x, int y, int d, uint32_t color);
+static void _fill_row(uint32_t* dst, size_t n, uint32_t color);
+static void _blend_row_color(uint32_t* dst, int n, uint32_t color);
+static void _mark_dirty_span(int y, int x0, int x1);
+static void _fill_thick_line(int x1, int y1, int x2, int y2, uint32_t color);
+static void _draw_line_unclipped(int x1, int y1, int x2, int y2, uint32_t color);
+static inline int64_t _floor_div(int64_t a, int64_t b);
+static void _record_display_list(const P5Record* record);
+static void _record_graphics(const P5Graphics* g, int x, int y, int blend);
+static uint32_t* _alloc_pixels(size_t bytes);
+static void _free_pixels(uint32_t* pixels);
 
 // Initialize the library
 void size(int w, int h) {
+    if (w == width && h == height) return;
+    if (activeGraphics || canvasPresented) {
+        fprintf(stderr, "p5c: size() cannot resize a layer or an open window\n");
+        return;
+    }
     width = w;
     height = h;
+
+    // setup() draws into a framebuffer allocated before it runs
+    if (framebuffer) {
+        _flush_commands();
+        _init_framebuffer();
+    }
 }
 
 // Set the background color
 void background(uint8_t r, uint8_t g, uint8_t b) {
+    P5C_TRACE_ZONE("background");
     _clear_framebuffer(r, g, b);
 }
 
@@ -114,9 +304,15 @@ void frameRate(int fps) {
 
 // Set the fill color
 void fill(uint8_t r, uint8_t g, uint8_t b) {
+    fillRGBA(r, g, b, 255);
+}
+
+// Set a translucent fill color: fill(r, g, b, a)
+void fillRGBA(uint8_t r, uint8_t g, uint8_t b, uint8_t a) {
     fillColor.r = r;
     fillColor.g = g;
     fillColor.b = b;
+    fillAlpha = a;
     useFill = 1;
 }
 
@@ -127,9 +323,15 @@ void noFill(void) {
 
 // Set the stroke color
 void stroke(uint8_t r, uint8_t g, uint8_t b) {
+    strokeRGBA(r, g, b, 255);
+}
+
+// Set a translucent stroke color: stroke(r, g, b, a)
+void strokeRGBA(uint8_t r, uint8_t g, uint8_t b, uint8_t a) {
     strokeColor.r = r;
     strokeColor.g = g;
     strokeColor.b = b;
+    strokeAlpha = a;
     useStroke = 1;
 }
 
@@ -145,57 +347,197 @@ void strokeWeight(int weight) {
     }
 }
 
-// Modify the point function to account for stroke weight
-void point(int x, int y) {
-    if (useStroke) {
-        int halfWeight = strokeWeightValue / 2;
-        for (int dx = -halfWeight; dx <= halfWeight; dx++) {
-            for (int dy = -halfWeight; dy <= halfWeight; dy++) {
-                _set_pixel(x + dx, y + dy, strokeColor.r, strokeColor.g, strokeColor.b);
-            }
-        }
+// Draw lines and outlines anti-aliased
+void smooth(void) {
+    useSmooth = 1;
+}
+
+// Draw lines and outlines with hard pixel edges (the default)
+void noSmooth(void) {
+    useSmooth = 0;
+}
+
+// Round a transformed coordinate to the nearest pixel
+static int _round_coord(float v) {
+    return (int)floorf(v + 0.5f);
+}
+
+// Map a vertex from user space to device pixels with the current matrix
+static void _transform_vertex(int x, int y, int* outX, int* outY) {
+    if (currentMatrix.kind == MATRIX_IDENTITY) {
+        *outX = x;
+        *outY = y;
+        return;
     }
+
+    float fx = (float)x;
+    float fy = (float)y;
+    _transform_point(&fx, &fy);
+    *outX = _round_coord(fx);
+    *outY = _round_coord(fy);
 }
 
-// Modify the line function to account for stroke weight
-void line(int x1, int y1, int x2, int y2) {
-    if (!useStroke) return;
+// Is the box [x0, x1] x [y0, y1] inside the clip rectangle?
+static inline int _inside_clip(int x0, int y0, int x1, int y1) {
+    return x0 >= clipX0 && x1 <= clipX1 && y0 >= clipY0 && y1 <= clipY1;
+}
+
+// Does the box [x0, x1] x [y0, y1] miss the clip rectangle entirely?
+static inline int _outside_clip(int x0, int y0, int x1, int y1) {
+    return x1 < clipX0 || x0 > clipX1 || y1 < clipY0 || y0 > clipY1;
+}
+
+// Cohen-Sutherland outcode of (x, y) against the clip rectangle grown by pad
+#define OUTCODE_LEFT   1
+#define OUTCODE_RIGHT  2
+#define OUTCODE_TOP    4
+#define OUTCODE_BOTTOM 8
+
+static inline int _outcode(int x, int y, int pad) {
+    int code = 0;
+    if (x < clipX0 - pad) code |= OUTCODE_LEFT;
+    else if (x > clipX1 + pad) code |= OUTCODE_RIGHT;
+    if (y < clipY0 - pad) code |= OUTCODE_TOP;
+    else if (y > clipY1 + pad) code |= OUTCODE_BOTTOM;
+    return code;
+}
+
+// Draw a stroke-weighted point at device coordinates
+static void _draw_point(int x, int y) {
+    if (recordingCommands) {
+        _record_command(COMMAND_POINT, x, y, 0, 0, 0, 0);
+        return;
+    }
+
+    uint32_t color = _pack_color(strokeColor, strokeAlpha);
+    if (strokeWeightValue <= 1) {
+        _set_pixel(x, y, color);
+    } else {
+        _fill_disc(x, y, strokeWeightValue, color);
+    }
+}
 
+// The pixels of Bresenham's line from (x1, y1) to (x2, y2) that lie in the
+// clip rectangle. At step i along the major axis the line has taken
+// k(i) = floor((2 i minor + major - 1) / (2 major)) minor steps, so the steps
+// inside the rectangle are found Liang-Barsky style, by solving the bounds
+// on both axes for i, and only those are walked.
+static void _draw_line_clipped(int x1, int y1, int x2, int y2, uint32_t color) {
     int dx = abs(x2 - x1);
     int dy = abs(y2 - y1);
     int sx = x1 < x2 ? 1 : -1;
     int sy = y1 < y2 ? 1 : -1;
-    int err = dx - dy;
-    int e2;
+    int xMajor = dx > dy;
+    int64_t major = xMajor ? dx : dy;
+    int64_t minor = xMajor ? dy : dx;
+    if (major == 0) {
+        _set_pixel(x1, y1, color);
+        return;
+    }
 
-    int halfWeight = strokeWeightValue / 2;
+    // Steps from the start along each axis that stay inside the rectangle
+    int64_t lo[2], hi[2];
+    lo[0] = sx > 0 ? (int64_t)clipX0 - x1 : (int64_t)x1 - clipX1;
+    hi[0] = sx > 0 ? (int64_t)clipX1 - x1 : (int64_t)x1 - clipX0;
+    lo[1] = sy > 0 ? (int64_t)clipY0 - y1 : (int64_t)y1 - clipY1;
+    hi[1] = sy > 0 ? (int64_t)clipY1 - y1 : (int64_t)y1 - clipY0;
+    int m = xMajor ? 0 : 1;
+
+    int64_t first = lo[m] > 0 ? lo[m] : 0;
+    int64_t last = hi[m] < major ? hi[m] : major;
+
+    // k(i) >= lo and k(i) <= hi of the minor axis
+    int64_t kLo = lo[1 - m], kHi = hi[1 - m];
+    if (kHi < 0) return;
+    if (kLo > 0) {
+        if (minor == 0) return;
+        int64_t i = -_floor_div(-(2 * major * kLo - major + 1), 2 * minor);
+        if (i > first) first = i;
+    }
+    if (minor > 0) {
+        int64_t i = _floor_div(2 * major * (kHi + 1) - major, 2 * minor);
+        if (i < last) last = i;
+    }
 
-    while (1) {
-        // Draw a thicker line by adding perpendicular offsets
-        for (int offset = -halfWeight; offset <= halfWeight; offset++) {
-            if (dx > dy) {
-                _set_pixel(x1, y1 + offset, strokeColor.r, strokeColor.g, strokeColor.b);
-            } else {
-                _set_pixel(x1 + offset, y1, strokeColor.r, strokeColor.g, strokeColor.b);
-            }
+    int64_t numerator = 2 * first * minor + major - 1;
+    int64_t k = numerator / (2 * major);
+    int64_t remainder = numerator % (2 * major);
+    int majorX = xMajor ? sx : 0, majorY = xMajor ? 0 : sy;
+    int minorX = xMajor ? 0 : sx, minorY = xMajor ? sy : 0;
+    int x = x1 + (int)(majorX * first + minorX * k);
+    int y = y1 + (int)(majorY * first + minorY * k);
+    for (int64_t i = first; i <= last; i++) {
+        _set_pixel(x, y, color);
+        x += majorX;
+        y += majorY;
+        remainder += 2 * minor;
+        if (remainder >= 2 * major) {
+            remainder -= 2 * major;
+            x += minorX;
+            y += minorY;
         }
+    }
+}
+
+// Draw a line between device coordinates: Bresenham's algorithm for one
+// pixel, a filled parallelogram for thicker strokes
+static void _draw_line(int x1, int y1, int x2, int y2) {
+    if (recordingCommands) {
+        _record_command(COMMAND_LINE, x1, y1, x2, y2, 0, 0);
+        return;
+    }
 
-        if (x1 == x2 && y1 == y2) break;
+    // Both ends beyond the same side of the clip rectangle, by more than
+    // the stroke reaches: nothing to draw
+    int reach = strokeWeightValue / 2 + 1;
+    if (_outcode(x1, y1, reach) & _outcode(x2, y2, reach)) return;
 
-        e2 = 2 * err;
-        if (e2 > -dy) {
-            err -= dy;
-            x1 += sx;
-        }
-        if (e2 < dx) {
-            err += dx;
-            y1 += sy;
-        }
+    if (useSmooth) {
+        _draw_line_smooth(x1, y1, x2, y2);
+        return;
+    }
+
+    uint32_t color = _pack_color(strokeColor, strokeAlpha);
+    if (strokeWeightValue > 1) {
+        _fill_thick_line(x1, y1, x2, y2, color);
+        return;
+    }
+
+    int minX = x1 < x2 ? x1 : x2, maxX = x1 < x2 ? x2 : x1;
+    int minY = y1 < y2 ? y1 : y2, maxY = y1 < y2 ? y2 : y1;
+    if (framebuffer && !recordingList && (color >> 24) == 0xFF && _inside_clip(minX, minY, maxX, maxY)) {
+        _draw_line_unclipped(x1, y1, x2, y2, color);
+        return;
+    }
+    _draw_line_clipped(x1, y1, x2, y2, color);
+}
+
+// Modify the point function to account for stroke weight
+void point(int x, int y) {
+    P5C_TRACE_ZONE("point");
+    if (useStroke) {
+        _count_primitives(P5C_STAT_POINT, 1);
+        _transform_vertex(x, y, &x, &y);
+        _draw_point(x, y);
     }
 }
 
+// Modify the line function to account for stroke weight
+void line(int x1, int y1, int x2, int y2) {
+    P5C_TRACE_ZONE("line");
+    if (!useStroke) return;
+    _count_primitives(P5C_STAT_LINE, 1);
+
+    _transform_vertex(x1, y1, &x1, &y1);
+    _transform_vertex(x2, y2, &x2, &y2);
+    _draw_line(x1, y1, x2, y2);
+}
+
 // Draw a quadrilateral
 void quad(int x1, int y1, int x2, int y2, int x3, int y3, int x4, int y4) {
+    P5C_TRACE_ZONE("quad");
+    _count_primitives(P5C_STAT_QUAD, 1);
+    primitiveDepth++;
     if (useFill && !useStroke) {
         triangle(x1, y1, x2, y2, x3, y3);
         triangle(x1, y1, x3, y3, x4, y4);
@@ -220,20 +562,179 @@ void quad(int x1, int y1, int x2, int y2, int x3, int y3, int x4, int y4) {
         line(x3, y3, x4, y4);
         line(x4, y4, x1, y1);
     }
+    primitiveDepth--;
 }
 
 // Daw a rectangle using the quad function
 void rect(int x, int y, int w, int h) {
-    // Rectangle as a quad: top-left, top-right, bottom-right, bottom-left
-    quad(x, y, x + w - 1, y, x + w - 1, y + h - 1, x, y + h - 1);
+    P5C_TRACE_ZONE("rect");
+
+    // The fill covers the w x h pixels from (x, y): under the top-left rule
+    // its far edges lie one past the last column and row. The outline runs
+    // through the outermost pixels.
+    _count_primitives(P5C_STAT_RECT, 1);
+    primitiveDepth++;
+    if (useFill) {
+        int savedStroke = useStroke;
+        useStroke = 0;
+        quad(x, y, x + w, y, x + w, y + h, x, y + h);
+        useStroke = savedStroke;
+    }
+    if (useStroke) {
+        int savedFill = useFill;
+        useFill = 0;
+        quad(x, y, x + w - 1, y, x + w - 1, y + h - 1, x, y + h - 1);
+        useFill = savedFill;
+    }
+    primitiveDepth--;
 }
 
 void square(int x, int y, int size) {
     rect(x, y, size, size);
 }
 
-// Draw an ellipse using the midpoint ellipse algorithm
-void ellipse(int x, int y, int w, int h) {
+// Ellipses are drawn as spans from exact integer half-widths: row k of an
+// ellipse with semi-axes a, b holds the pixels |x| <= half(k), the largest
+// x with b^2 x^2 + a^2 k^2 <= a^2 b^2. The stroke is the ring between an
+// outer and an inner ellipse and the fill is what lies inside it, so the
+// two never write the same pixel.
+
+// Larger semi-axes could overflow the 64-bit decision value
+#define ELLIPSE_MAX_RADIUS (1 << 15)
+
+// Rows of the stack buffers _draw_ellipse() uses before allocating
+#define ELLIPSE_STACK_ROWS 1024
+
+// Half-widths of an ellipse's rows, walking away from its center. d is
+// a^2 b^2 - b^2 x^2 - a^2 k^2, non-negative while (x, k) is inside.
+typedef struct {
+    int64_t a2, b2, d;
+    int x, k, b;
+} EllipseRows;
+
+static void _ellipse_rows_init(EllipseRows* e, int a, int b) {
+    e->a2 = (int64_t)a * a;
+    e->b2 = (int64_t)b * b;
+    e->d = 0;
+    e->x = a;
+    e->k = 0;
+    e->b = b;
+}
+
+// Half-width of row k, or -1 past the ellipse; k must not decrease between calls
+static int _ellipse_rows_half(EllipseRows* e, int k) {
+    if (k > e->b || e->x < 0) return -1;
+    while (e->k < k) {
+        e->d -= e->a2 * (2 * e->k + 1);
+        e->k++;
+    }
+    while (e->d < 0) {
+        e->d += e->b2 * (2 * e->x - 1);
+        e->x--;
+    }
+    return e->x;
+}
+
+// Spans of rows +-k, k = 0..rows-1, of an ellipse with semi-axes a, b:
+// outer[k] is the half-width of everything drawn and inner[k] that of the
+// fill, -1 where the row has none. A stroke of weight w adds w / 2 pixels
+// outside and takes the pixels inside the ellipse shrunk by (w - 1) / 2 that
+// touch its outside; weight 1 is the ellipse's own border. Returns the row
+// count, b + w / 2 + 1 when stroked.
+static int _ellipse_spans(int a, int b, int weight, int* outer, int* inner) {
+    int grow = weight / 2;
+    int shrink = (weight - 1) / 2;
+    int rows = b + (weight > 0 ? grow : 0) + 1;
+
+    EllipseRows outside;
+    _ellipse_rows_init(&outside, weight > 0 ? a + grow : a, rows - 1);
+    for (int k = 0; k < rows; k++) {
+        outer[k] = _ellipse_rows_half(&outside, k);
+    }
+    if (weight <= 0) {
+        memcpy(inner, outer, rows * sizeof(int));
+        return rows;
+    }
+
+    // A pixel of the shrunk ellipse is stroked when its right or upper
+    // neighbour (away from the center) is outside
+    int ia = a - shrink, ib = b - shrink;
+    if (ia < 0 || ib < 0) {
+        // Too thick to leave an inside: no rows
+        ia = 0;
+        ib = -1;
+    }
+    EllipseRows row, next;
+    _ellipse_rows_init(&row, ia, ib);
+    _ellipse_rows_init(&next, ia, ib);
+    for (int k = 0; k < rows; k++) {
+        int half = _ellipse_rows_half(&row, k) - 1;
+        int above = _ellipse_rows_half(&next, k + 1);
+        if (above < half) half = above;
+        inner[k] = half < -1 ? -1 : half;
+    }
+    return rows;
+}
+
+// Write the part of [x0, x1] inside the clip columns of row y, whose pixels
+// start at row; the caller has checked y and marks the row dirty
+static inline void _put_span(uint32_t* row, int y, int x0, int x1, uint32_t color) {
+    if (x0 < clipX0) x0 = clipX0;
+    if (x1 > clipX1) x1 = clipX1;
+    if (x0 > x1 || (color >> 24) == 0) return;
+    if ((color >> 24) != 0xFF) {
+        _blend_row_color(row + x0, x1 - x0 + 1, color);
+    } else if (x1 - x0 < 8) {
+        for (int x = x0; x <= x1; x++) row[x] = color;
+    } else {
+        _fill_row(row + x0, x1 - x0 + 1, color);
+    }
+    _count_span(x1 - x0 + 1);
+    if (recordingList) _capture_span(y, x0, x1, color);
+}
+
+// Draw ellipse spans around device (cx, cy): the fill inside inner[k], the
+// stroke from there out to outer[k]. Each row is clipped and marked dirty once.
+static void _draw_ellipse_spans(int cx, int cy, int rows, const int* outer, const int* inner,
+                                int filled, int stroked) {
+    if (!framebuffer) return;
+    uint32_t fillPixel = _pack_color(fillColor, fillAlpha);
+    uint32_t strokePixel = _pack_color(strokeColor, strokeAlpha);
+
+    // Only the rows inside the clip rectangle
+    int first = clipY0 - cy > -(rows - 1) ? clipY0 - cy : -(rows - 1);
+    int last = clipY1 - cy < rows - 1 ? clipY1 - cy : rows - 1;
+    for (int sy = first; sy <= last; sy++) {
+        int k = sy < 0 ? -sy : sy;
+        int o = outer[k], i = inner[k];
+        int y = cy + sy;
+        int x0 = cx - o > clipX0 ? cx - o : clipX0;
+        int x1 = cx + o < clipX1 ? cx + o : clipX1;
+        if (o < 0 || x0 > x1) continue;
+
+        uint32_t* row = framebuffer + (size_t)y * width;
+        if (filled && i >= 0) {
+            _put_span(row, y, cx - i, cx + i, fillPixel);
+        }
+        if (stroked) {
+            if (i < 0) {
+                _put_span(row, y, cx - o, cx + o, strokePixel);
+            } else if (o > i) {
+                _put_span(row, y, cx - o, cx - i - 1, strokePixel);
+                _put_span(row, y, cx + i + 1, cx + o, strokePixel);
+            }
+        }
+        _mark_dirty_span(y, x0, x1);
+    }
+}
+
+// Draw an axis-aligned ellipse with its bounding box at device coordinates
+static void _draw_ellipse(int x, int y, int w, int h) {
+    if (recordingCommands) {
+        _record_command(COMMAND_ELLIPSE, x, y, w, h, 0, 0);
+        return;
+    }
+
     // Calculate ellipse parameters
     int a = w / 2;
     int b = h / 2;
@@ -241,101 +742,162 @@ void ellipse(int x, int y, int w, int h) {
     int cy = y + b;
 
     // Handle degenerate cases
-    if (w <= 0 || h <= 0) return;
+    if (w <= 0 || h <= 0 || a > ELLIPSE_MAX_RADIUS || b > ELLIPSE_MAX_RADIUS) return;
 
     // Special case for circle with small radius
     if (w == h && w <= 2) {
         if (useFill) {
-            _set_pixel(cx, cy, fillColor.r, fillColor.g, fillColor.b);
+            _fill_span(cy, cx, cx, _pack_color(fillColor, fillAlpha));
         } else if (useStroke) {
-            _set_pixel(cx, cy, strokeColor.r, strokeColor.g, strokeColor.b);
+            _set_pixel(cx, cy, _pack_color(strokeColor, strokeAlpha));
         }
         return;
     }
+    if (!useFill && !useStroke) return;
+
+    int weight = useStroke ? strokeWeightValue : 0;
+    int rows = b + weight / 2 + 1;
+    if (_outside_clip(cx - a - weight / 2, cy - rows + 1, cx + a + weight / 2, cy + rows - 1)) return;
+    int stackRows[2 * ELLIPSE_STACK_ROWS];
+    int* outer = rows <= ELLIPSE_STACK_ROWS ? stackRows : (int*)malloc(2 * rows * sizeof(int));
+    if (!outer) return;
+    int* inner = outer + rows;
+
+    _ellipse_spans(a, b, weight, outer, inner);
+    _draw_ellipse_spans(cx, cy, rows, outer, inner, useFill, useStroke);
+    if (outer != stackRows) free(outer);
+}
 
-    // For filled ellipses, we'll use a scanline algorithm
-    if (useFill) {
-        // For each scanline within the ellipse bounds
-        for (int sy = -b; sy <= b; sy++) {
-            // Calculate the width at this y coordinate
-            // Using the ellipse formula: (x/a)^2 + (y/b)^2 = 1
-            // Solving for x: x = a * sqrt(1 - (y/b)^2)
-            float temp = 1.0f - (float)(sy * sy) / (b * b);
-            if (temp < 0) continue;
-
-            int width = (int)(a * sqrt(temp));
-
-            // Draw the horizontal line
-            for (int sx = -width; sx <= width; sx++) {
-                _set_pixel(cx + sx, cy + sy, fillColor.r, fillColor.g, fillColor.b);
-            }
-        }
+// Fill a convex polygon given in device coordinates, one span per row
+static void _fill_convex_polygon(const int* xs, const int* ys, int n) {
+    if (recordingCommands) {
+        _record_polygon(xs, ys, n);
+        return;
     }
 
-    // For the outline, use the midpoint ellipse algorithm
-    if (useStroke) {
-        // First region: where the slope is < -1
-        int x1 = 0;
-        int y1 = b;
-        int a_sqr = a * a;
-        int b_sqr = b * b;
-        int dx = 0;
-        int dy = 2 * a_sqr * y1;
-
-        // Decision parameter for region 1
-        int d1 = b_sqr - a_sqr * b + a_sqr / 4;
-
-        while (dx < dy) {
-            // Plot four symmetric points
-            _set_pixel(cx + x1, cy + y1, strokeColor.r, strokeColor.g, strokeColor.b);
-            _set_pixel(cx - x1, cy + y1, strokeColor.r, strokeColor.g, strokeColor.b);
-            _set_pixel(cx + x1, cy - y1, strokeColor.r, strokeColor.g, strokeColor.b);
-            _set_pixel(cx - x1, cy - y1, strokeColor.r, strokeColor.g, strokeColor.b);
-
-            // Update
-            x1++;
-            dx += 2 * b_sqr;
-
-            if (d1 < 0) {
-                d1 += dx + b_sqr;
+    int minX = xs[0], maxX = xs[0];
+    int minY = ys[0], maxY = ys[0];
+    for (int i = 1; i < n; i++) {
+        if (xs[i] < minX) minX = xs[i];
+        if (xs[i] > maxX) maxX = xs[i];
+        if (ys[i] < minY) minY = ys[i];
+        if (ys[i] > maxY) maxY = ys[i];
+    }
+    if (_outside_clip(minX, minY, maxX, maxY)) return;
+    if (minY < clipY0) minY = clipY0;
+    if (maxY > clipY1) maxY = clipY1;
+    if (minY > maxY) return;
+
+    int rows = maxY - minY + 1;
+    int* left = (int*)malloc(2 * rows * sizeof(int));
+    if (!left) return;
+    int* right = left + rows;
+    for (int i = 0; i < rows; i++) {
+        left[i] = INT_MAX;
+        right[i] = INT_MIN;
+    }
+
+    // Record the leftmost and rightmost edge crossing of every row
+    for (int i = 0; i < n; i++) {
+        int x0 = xs[i], y0 = ys[i];
+        int x1 = xs[(i + 1) % n], y1 = ys[(i + 1) % n];
+        if (y0 > y1) {
+            int t = x0; x0 = x1; x1 = t;
+            t = y0; y0 = y1; y1 = t;
+        }
+        int yStart = y0 < minY ? minY : y0;
+        int yEnd = y1 > maxY ? maxY : y1;
+        for (int y = yStart; y <= yEnd; y++) {
+            int xa, xb;
+            if (y0 == y1) {
+                xa = x0 < x1 ? x0 : x1;
+                xb = x0 < x1 ? x1 : x0;
             } else {
-                y1--;
-                dy -= 2 * a_sqr;
-                d1 += dx - dy + b_sqr;
+                xa = xb = x0 + (int)((long long)(y - y0) * (x1 - x0) / (y1 - y0));
             }
+            if (xa < left[y - minY]) left[y - minY] = xa;
+            if (xb > right[y - minY]) right[y - minY] = xb;
         }
+    }
 
-        // Second region: where the slope is >= -1
-        int x2 = a;
-        int y2 = 0;
-        dx = 2 * b_sqr * x2;
-        dy = 0;
+    uint32_t color = _pack_color(fillColor, fillAlpha);
+    for (int i = 0; i < rows; i++) {
+        _fill_span(minY + i, left[i], right[i], color);
+    }
+    free(left);
+}
 
-        // Decision parameter for region 2
-        int d2 = a_sqr - b_sqr * a + b_sqr / 4;
+// Segments for a curve of on-screen radius r turning through sweep radians:
+// enough to keep the chord error below half a pixel, and at least 8 for a
+// full turn so tiny circles stay round
+static int _curve_segments(float r, float sweep) {
+    float step = (float)M_PI / 4.0f;
+    if (r > 0.5f) {
+        float chord = 2.0f * acosf(1.0f - 0.5f / r);
+        if (chord < step) step = chord;
+    }
+    int segments = (int)ceilf(sweep / step);
+    return segments < 1 ? 1 : segments;
+}
 
-        while (dx > dy) {
-            // Plot four symmetric points
-            _set_pixel(cx + x2, cy + y2, strokeColor.r, strokeColor.g, strokeColor.b);
-            _set_pixel(cx - x2, cy + y2, strokeColor.r, strokeColor.g, strokeColor.b);
-            _set_pixel(cx + x2, cy - y2, strokeColor.r, strokeColor.g, strokeColor.b);
-            _set_pixel(cx - x2, cy - y2, strokeColor.r, strokeColor.g, strokeColor.b);
+// Draw an ellipse under a rotating or shearing matrix as a polygon
+static void _draw_ellipse_polygon(float cx, float cy, float a, float b) {
+    // Estimate the on-screen radius from the lengths of the matrix axes
+    float scaleX = hypotf(currentMatrix.m[0][0], currentMatrix.m[1][0]);
+    float scaleY = hypotf(currentMatrix.m[0][1], currentMatrix.m[1][1]);
+    float r = fmaxf(a * scaleX, b * scaleY);
+
+    int segments = _curve_segments(r, 2.0f * (float)M_PI);
+    if (segments > MAX_ELLIPSE_SEGMENTS) segments = MAX_ELLIPSE_SEGMENTS;
+
+    int px[MAX_ELLIPSE_SEGMENTS];
+    int py[MAX_ELLIPSE_SEGMENTS];
+    float angleStep = 2.0f * (float)M_PI / segments;
+    for (int i = 0; i < segments; i++) {
+        float fx = cx + a * cosf(i * angleStep);
+        float fy = cy + b * sinf(i * angleStep);
+        _transform_point(&fx, &fy);
+        px[i] = _round_coord(fx);
+        py[i] = _round_coord(fy);
+    }
 
-            // Update
-            y2++;
-            dy += 2 * a_sqr;
+    if (useFill) {
+        _fill_convex_polygon(px, py, segments);
+    }
 
-            if (d2 < 0) {
-                d2 += dy + a_sqr;
-            } else {
-                x2--;
-                dx -= 2 * b_sqr;
-                d2 += dy - dx + a_sqr;
-            }
+    if (useStroke) {
+        for (int i = 0; i < segments; i++) {
+            int j = (i + 1) % segments;
+            _draw_line(px[i], py[i], px[j], py[j]);
         }
     }
 }
 
+// Draw an ellipse using the midpoint ellipse algorithm
+void ellipse(int x, int y, int w, int h) {
+    P5C_TRACE_ZONE("ellipse");
+    // Handle degenerate cases
+    if (w <= 0 || h <= 0) return;
+    _count_primitives(P5C_STAT_ELLIPSE, 1);
+
+    if (currentMatrix.kind != MATRIX_AFFINE) {
+        // Translation moves the bounding box without changing its size
+        _transform_vertex(x, y, &x, &y);
+        _draw_ellipse(x, y, w, h);
+    } else if (currentMatrix.m[0][1] == 0.0f && currentMatrix.m[1][0] == 0.0f) {
+        // A pure scale keeps the ellipse axis-aligned: scale the box around the center
+        float cx = (float)(x + w / 2);
+        float cy = (float)(y + h / 2);
+        _transform_point(&cx, &cy);
+        int sw = _round_coord(w * fabsf(currentMatrix.m[0][0]));
+        int sh = _round_coord(h * fabsf(currentMatrix.m[1][1]));
+        if (sw <= 0 || sh <= 0) return;
+        _draw_ellipse(_round_coord(cx) - sw / 2, _round_coord(cy) - sh / 2, sw, sh);
+    } else {
+        _draw_ellipse_polygon(x + w / 2, y + h / 2, w / 2, h / 2);
+    }
+}
+
 //Draw a circle using the ellipse algorithm
 void circle(int x, int y, int r) {
     ellipse(x, y, r, r);
@@ -349,8 +911,134 @@ static float _normalize_angle(float angle) {
     return angle;
 }
 
+// Angles within about a float ulp of 2 pi of a sector edge count as inside,
+// as they did for the float atan2f() test on pixels lying on the edge rays
+#define SECTOR_ANGLE_SLACK 5e-7
+
+// Pixels x of row y, as an interval clamped to [-h, h], on the side of the
+// line through the center along (c, s) where c * y - s * x >= 0
+static void _half_plane_span(double c, double s, int y, int h, int* lo, int* hi) {
+    *lo = -h;
+    *hi = h;
+    if (s == 0.0) {
+        if (c * y < 0) *lo = h + 1;
+        return;
+    }
+    // Clamp before converting so huge crossings cannot overflow
+    double t = c * y / s;
+    if (t > h + 1) t = h + 1;
+    if (t < -h - 1) t = -h - 1;
+    if (s > 0) {
+        int x = (int)floor(t);
+        if (x < *hi) *hi = x;
+    } else {
+        int x = (int)ceil(t);
+        if (x > *lo) *lo = x;
+    }
+}
+
+// Fill the part of an axis-aligned ellipse centered at device (cx, cy) whose
+// angle lies in [startAngle, stopAngle], wrapping past 2 pi. A sector up to
+// pi wide is where the pixel is past the start ray and before the stop ray,
+// a wider one where either holds, so each row is at most two spans cut from
+// the ellipse row where it crosses the rays.
+static void _fill_arc_sector(int cx, int cy, int a, int b, float startAngle, float stopAngle) {
+    if (recordingCommands) {
+        _record_sector(cx, cy, a, b, startAngle, stopAngle);
+        return;
+    }
+    if (a < 0 || b < 0 || a > ELLIPSE_MAX_RADIUS || b > ELLIPSE_MAX_RADIUS) return;
+    if (_outside_clip(cx - a, cy - b, cx + a, cy + b)) return;
+
+    double sweep = (double)stopAngle - startAngle;
+    if (sweep < 0) return;
+    double start = (double)startAngle - SECTOR_ANGLE_SLACK;
+    double stop = start + sweep + 2 * SECTOR_ANGLE_SLACK;
+    int full = sweep + 2 * SECTOR_ANGLE_SLACK >= 2 * M_PI;
+    int convex = sweep + 2 * SECTOR_ANGLE_SLACK <= M_PI;
+
+    // Past the start ray: cs * y - ss * x >= 0; before the stop ray the same
+    // with the stop direction reversed
+    double cs = cos(start), ss = sin(start);
+    double ce = -cos(stop), se = -sin(stop);
+
+    // The center pixel counts as angle 0, like the positive x axis
+    int zeroInside = convex ? (-ss >= 0 && -se >= 0) : (-ss >= 0 || -se >= 0);
+
+    uint32_t color = _pack_color(fillColor, fillAlpha);
+    EllipseRows rows;
+    _ellipse_rows_init(&rows, a, b);
+    for (int k = 0; k <= b; k++) {
+        int h = _ellipse_rows_half(&rows, k);
+        for (int side = 0; side < (k > 0 ? 2 : 1); side++) {
+            int y = side ? -k : k;
+            if (cy + y < clipY0 || cy + y > clipY1) continue;
+            if (full) {
+                _fill_span(cy + y, cx - h, cx + h, color);
+                continue;
+            }
+
+            int aLo, aHi, bLo, bHi;
+            _half_plane_span(cs, ss, y, h, &aLo, &aHi);
+            _half_plane_span(ce, se, y, h, &bLo, &bHi);
+            if (y == 0 && !zeroInside) {
+                // Only the negative x axis can be in; drop the center
+                if (aHi > -1) aHi = -1;
+                if (bHi > -1) bHi = -1;
+            }
+
+            if (convex) {
+                int lo = aLo > bLo ? aLo : bLo;
+                int hi = aHi < bHi ? aHi : bHi;
+                if (lo <= hi) _fill_span(cy + y, cx + lo, cx + hi, color);
+            } else if (aLo > aHi || bLo > bHi || aLo > bHi + 1 || bLo > aHi + 1) {
+                // Empty or apart: each half-plane is its own span
+                if (aLo <= aHi) _fill_span(cy + y, cx + aLo, cx + aHi, color);
+                if (bLo <= bHi) _fill_span(cy + y, cx + bLo, cx + bHi, color);
+            } else {
+                _fill_span(cy + y, cx + (aLo < bLo ? aLo : bLo), cx + (aHi > bHi ? aHi : bHi), color);
+            }
+        }
+    }
+}
+
+// Arc vertices in device coordinates, stepping the angle by a rotation of
+// (cos, sin) rather than calling cosf()/sinf() for each vertex
+typedef struct {
+    float cx, cy, a, b;
+    double c, s, stepC, stepS;
+} ArcWalk;
+
+static void _arc_walk_init(ArcWalk* walk, float cx, float cy, float a, float b,
+                           float start, float step) {
+    walk->cx = cx;
+    walk->cy = cy;
+    walk->a = a;
+    walk->b = b;
+    walk->c = cos(start);
+    walk->s = sin(start);
+    walk->stepC = cos(step);
+    walk->stepS = sin(step);
+}
+
+// The current vertex, then advance to the next
+static void _arc_walk_next(ArcWalk* walk, int* x, int* y) {
+    float fx = walk->cx + walk->a * (float)walk->c;
+    float fy = walk->cy + walk->b * (float)walk->s;
+    _transform_point(&fx, &fy);
+    *x = _round_coord(fx);
+    *y = _round_coord(fy);
+
+    double c = walk->c * walk->stepC - walk->s * walk->stepS;
+    walk->s = walk->s * walk->stepC + walk->c * walk->stepS;
+    walk->c = c;
+}
+
+// A detail of 0 or less picks the segment count from the on-screen radius
 void arcDetail(int x, int y, int w, int h, float start, float stop, int mode, int detail) {
+    P5C_TRACE_ZONE("arc");
     if (w <= 0 || h <= 0) return;
+    _count_primitives(P5C_STAT_ARC, 1);
 
     int a = w / 2;
     int b = h / 2;
@@ -360,66 +1048,69 @@ void arcDetail(int x, int y, int w, int h, float start, float stop, int mode, in
     float startAngle = _normalize_angle(start);
     float stopAngle = _normalize_angle(stop);
     if (stopAngle < startAngle) stopAngle += 2 * M_PI;
+    // Past a full turn the arc only retraces itself
+    if (stopAngle - startAngle > 2 * M_PI) stopAngle = startAngle + 2 * M_PI;
+
+    int segments = detail;
+    if (segments <= 0) {
+        float scaleX = hypotf(currentMatrix.m[0][0], currentMatrix.m[1][0]);
+        float scaleY = hypotf(currentMatrix.m[0][1], currentMatrix.m[1][1]);
+        float r = fmaxf(a * scaleX, b * scaleY);
+        segments = _curve_segments(r, stopAngle - startAngle);
+    }
+    float angleStep = (stopAngle - startAngle) / segments;
 
-    if (detail <= 0) detail = 25;
-    if (detail > 360) detail = 360;
-
-    float angleStep = (stopAngle - startAngle) / detail;
-    int px[362];
-    int py[362];
-    int count = 0;
+    // The center in device coordinates
+    int dcx, dcy;
+    _transform_vertex(cx, cy, &dcx, &dcy);
 
-    for (int i = 0; i <= detail; i++) {
-        float angle = startAngle + i * angleStep;
-        px[count] = cx + (int)(a * cosf(angle));
-        py[count] = cy + (int)(b * sinf(angle));
-        count++;
-    }
+    ArcWalk walk;
+    int x0, y0, x1, y1;
 
     // --- FILL ---
     if (useFill) {
-        if (mode == PIE) {
-            for (int i = 0; i < count - 1; i++) {
-                triangle(cx, cy, px[i], py[i], px[i + 1], py[i + 1]);
-            }
-        }
-        else if (mode == CHORD) {
-            // Build a filled polygon strip between arc points and closing chord
-            for (int i = 0; i < count - 2; i++) {
-                triangle(px[i], py[i], px[i + 1], py[i + 1], px[i + 2], py[i + 2]);
+        if (mode == OPEN && currentMatrix.kind != MATRIX_AFFINE) {
+            _fill_arc_sector(dcx, dcy, a, b, startAngle, stopAngle);
+        } else {
+            // Pie wedges fan out from the center and chords from the first
+            // vertex. The OPEN sector covers the same area as the wedges,
+            // which stay correct when the matrix rotates or shears the arc
+            int savedStroke = useStroke;
+            useStroke = 0;
+            _arc_walk_init(&walk, (float)cx, (float)cy, (float)a, (float)b, startAngle, angleStep);
+            _arc_walk_next(&walk, &x0, &y0);
+            int fanX = dcx, fanY = dcy;
+            if (mode == CHORD) {
+                fanX = x0;
+                fanY = y0;
             }
-        }
-        else { // OPEN
-            // Fill the arc segment by vertical scanlines inside bounding ellipse
-            for (int sy = -b; sy <= b; sy++) {
-                float ry = (float)(sy) / b;
-                float dx = a * sqrtf(fmaxf(0.0f, 1.0f - ry * ry));
-                int xStart = (int)(-dx);
-                int xEnd = (int)(dx);
-
-                for (int sx = xStart; sx <= xEnd; sx++) {
-                    float angle = atan2f((float)sy, (float)sx);
-                    if (angle < 0) angle += 2 * M_PI;
-
-                    if (angle >= startAngle && angle <= stopAngle) {
-                        _set_pixel(cx + sx, cy + sy, fillColor.r, fillColor.g, fillColor.b);
-                    }
-                }
+            for (int i = 0; i < segments; i++) {
+                _arc_walk_next(&walk, &x1, &y1);
+                if (mode != CHORD || i > 0) _draw_triangle(fanX, fanY, x0, y0, x1, y1);
+                x0 = x1;
+                y0 = y1;
             }
+            useStroke = savedStroke;
         }
     }
 
     // --- STROKE ---
     if (useStroke) {
-        for (int i = 0; i < count - 1; i++) {
-            line(px[i], py[i], px[i + 1], py[i + 1]);
+        _arc_walk_init(&walk, (float)cx, (float)cy, (float)a, (float)b, startAngle, angleStep);
+        _arc_walk_next(&walk, &x0, &y0);
+        int firstX = x0, firstY = y0;
+        for (int i = 0; i < segments; i++) {
+            _arc_walk_next(&walk, &x1, &y1);
+            _draw_line(x0, y0, x1, y1);
+            x0 = x1;
+            y0 = y1;
         }
 
         if (mode == CHORD) {
-            line(px[0], py[0], px[count - 1], py[count - 1]);
+            _draw_line(firstX, firstY, x0, y0);
         } else if (mode == PIE) {
-            line(cx, cy, px[0], py[0]);
-            line(cx, cy, px[count - 1], py[count - 1]);
+            _draw_line(dcx, dcy, firstX, firstY);
+            _draw_line(dcx, dcy, x0, y0);
         }
     }
 }
@@ -427,247 +1118,3779 @@ void arcDetail(int x, int y, int w, int h, float start, float stop, int mode, in
 
 // Shorthand wrappers
 void arc(int x, int y, int w, int h, float start, float stop) {
-    arcDetail(x, y, w, h, start, stop, OPEN, 25);
+    arcDetail(x, y, w, h, start, stop, OPEN, 0);
 }
 
 void arcMode(int x, int y, int w, int h, float start, float stop, int mode) {
-    arcDetail(x, y, w, h, start, stop, mode, 25);
+    arcDetail(x, y, w, h, start, stop, mode, 0);
+}
+
+// Triangles are filled with edge functions. A pixel (x, y) is inside when
+// all three E(x, y) = A x + B y + C are non-negative; pixels exactly on an
+// edge belong to the triangle only for top and left edges, so triangles that
+// share an edge cover every pixel along it exactly once. Vertices are given
+// in 1/16 pixel (thick strokes need the precision; triangle() passes whole
+// pixels), which keeps the edge functions exact integers.
+#define SUBPIXEL_ONE 16
+
+// Larger coordinates could overflow the 64-bit edge values
+#define TRIANGLE_MAX_COORD (1 << 26)
+
+typedef struct {
+    int64_t a, b, c;
+} TriangleEdge;
+
+// Edge function of the directed edge (x0, y0) -> (x1, y1) in subpixels,
+// positive on its right in screen space, with the fill rule folded into c.
+// A and B are scaled to whole pixel steps.
+static TriangleEdge _triangle_edge(int x0, int y0, int x1, int y1) {
+    TriangleEdge e;
+    e.a = (int64_t)y0 - y1;
+    e.b = (int64_t)x1 - x0;
+    e.c = -(e.a * x0 + e.b * y0);
+
+    // Left edges step up the screen, top edges are horizontal and run right
+    int topLeft = e.a > 0 || (e.a == 0 && e.b > 0);
+    if (!topLeft) e.c -= 1;
+    e.a *= SUBPIXEL_ONE;
+    e.b *= SUBPIXEL_ONE;
+    return e;
+}
+
+static inline int64_t _floor_div(int64_t a, int64_t b) {
+    // On-canvas triangles get by with the much cheaper 32-bit division
+    if (a == (int32_t)a && b == (int32_t)b) {
+        int32_t q = (int32_t)a / (int32_t)b;
+        return ((int32_t)a % (int32_t)b != 0 && (a < 0) != (b < 0)) ? q - 1 : q;
+    }
+    int64_t q = a / b;
+    return (a % b != 0 && (a < 0) != (b < 0)) ? q - 1 : q;
+}
+
+// floor(v / divisor) for v = v0, v0 + delta, v0 + 2 delta, ... with a single
+// division up front
+typedef struct {
+    int64_t quotient, remainder;
+    int64_t stepQuotient, stepRemainder;
+    int64_t divisor;
+} FloorStepper;
+
+static void _stepper_init(FloorStepper* s, int64_t v0, int64_t delta, int64_t divisor) {
+    s->divisor = divisor;
+    s->quotient = _floor_div(v0, divisor);
+    s->remainder = v0 - s->quotient * divisor;
+    s->stepQuotient = _floor_div(delta, divisor);
+    s->stepRemainder = delta - s->stepQuotient * divisor;
+}
+
+// The carry is taken with a mask; as a branch it mispredicts on most edges
+static inline void _stepper_next(FloorStepper* s) {
+    s->remainder += s->stepRemainder;
+    int64_t carry = -(int64_t)(s->remainder >= s->divisor);
+    s->remainder -= s->divisor & carry;
+    s->quotient += s->stepQuotient - carry;
 }
 
-// Helper function to sort three points by y-coordinate
-static void _sort_points_by_y(int* x1, int* y1, int* x2, int* y2, int* x3, int* y3) {
-    // Sort the points by y-coordinate, and use x-coordinate as a tiebreaker
-    if (*y1 > *y2 || (*y1 == *y2 && *x1 > *x2)) {
-        int temp_x = *x1, temp_y = *y1;
-        *x1 = *x2; *y1 = *y2;
-        *x2 = temp_x; *y2 = temp_y;
+// Fill the convex area inside all edges, within the given pixel bounds.
+// Each edge bounds every row on one side: E(x, y) >= 0 begins (A > 0) or
+// ends (A < 0) at x = -(B y + C) / A, rounded inwards. Stepping those
+// quotients from row to row gives each row's exact run without a division,
+// and the run is filled with the span writer, so every pixel is written
+// once. Triangles and parallelograms have at most two edges on each side.
+static void _fill_edges(const TriangleEdge* edges, int count, int minX, int minY, int maxX, int maxY,
+                        uint32_t color) {
+    if (minX < clipX0) minX = clipX0;
+    if (maxX > clipX1) maxX = clipX1;
+    if (minY < clipY0) minY = clipY0;
+    if (maxY > clipY1) maxY = clipY1;
+    if (minX > maxX || minY > maxY) return;
+
+    // There are one or two left edges (A > 0) and one or two right edges
+    // (A < 0); a lone one is used twice to keep the row loop free of
+    // branches. A horizontal edge only limits the rows.
+    for (int i = 0; i < count; i++) {
+        const TriangleEdge* e = &edges[i];
+        if (e->a != 0) continue;
+        // b y + c >= 0
+        if (e->b > 0) {
+            int64_t first = -_floor_div(e->c, e->b);
+            if (first > minY) minY = first > maxY ? maxY + 1 : (int)first;
+        } else {
+            int64_t last = _floor_div(e->c, -e->b);
+            if (last < maxY) maxY = last < minY ? minY - 1 : (int)last;
+        }
     }
-    if (*y2 > *y3 || (*y2 == *y3 && *x2 > *x3)) {
-        int temp_x = *x2, temp_y = *y2;
-        *x2 = *x3; *y2 = *y3;
-        *x3 = temp_x; *y3 = temp_y;
+
+    FloorStepper left[2], right[2];
+    int leftCount = 0, rightCount = 0;
+    for (int i = 0; i < count; i++) {
+        const TriangleEdge* e = &edges[i];
+        if (e->a == 0) continue;
+        int64_t rowValue = e->b * minY + e->c;
+        if (e->a > 0) {
+            if (leftCount < 2) _stepper_init(&left[leftCount++], rowValue, e->b, e->a);
+        } else {
+            if (rightCount < 2) _stepper_init(&right[rightCount++], rowValue, e->b, -e->a);
+        }
     }
-    if (*y1 > *y2 || (*y1 == *y2 && *x1 > *x2)) {
-        int temp_x = *x1, temp_y = *y1;
-        *x1 = *x2; *y1 = *y2;
-        *x2 = temp_x; *y2 = temp_y;
+    if (leftCount == 0 || rightCount == 0) return;
+    if (leftCount == 1) left[1] = left[0];
+    if (rightCount == 1) right[1] = right[0];
+
+    for (int y = minY; y <= maxY; y++) {
+        int64_t start = -left[0].quotient > -left[1].quotient ? -left[0].quotient : -left[1].quotient;
+        int64_t end = right[0].quotient < right[1].quotient ? right[0].quotient : right[1].quotient;
+        if (start < minX) start = minX;
+        if (end > maxX) end = maxX;
+        if (start <= end) {
+            _fill_span(y, (int)start, (int)end, color);
+        }
+        _stepper_next(&left[0]);
+        _stepper_next(&left[1]);
+        _stepper_next(&right[0]);
+        _stepper_next(&right[1]);
     }
 }
 
-// Draw a triangle
-void triangle(int x1, int y1, int x2, int y2, int x3, int y3) {
-    // Draw the outline if stroke is enabled
-    if (useStroke) {
-        line(x1, y1, x2, y2);
-        line(x2, y2, x3, y3);
-        line(x3, y3, x1, y1);
+// The pixel center at or before a subpixel coordinate
+static inline int _subpixel_floor(int v) {
+    return (int)_floor_div(v, SUBPIXEL_ONE);
+}
+
+// Fill a convex polygon of 3 or 4 vertices in subpixels, in either winding
+static void _fill_convex_subpixel(const int* xs, const int* ys, int n, uint32_t color) {
+    int64_t area = 0;
+    for (int i = 0; i < n; i++) {
+        int j = (i + 1) % n;
+        area += (int64_t)xs[i] * ys[j] - (int64_t)xs[j] * ys[i];
+    }
+    if (area == 0) return;
+
+    const int limit = TRIANGLE_MAX_COORD * SUBPIXEL_ONE;
+    int minX = xs[0], maxX = xs[0], minY = ys[0], maxY = ys[0];
+    for (int i = 0; i < n; i++) {
+        if (xs[i] <= -limit || xs[i] >= limit || ys[i] <= -limit || ys[i] >= limit) return;
+        if (xs[i] < minX) minX = xs[i];
+        if (xs[i] > maxX) maxX = xs[i];
+        if (ys[i] < minY) minY = ys[i];
+        if (ys[i] > maxY) maxY = ys[i];
     }
 
-    // Fill the triangle if fill is enabled
-    if (useFill) {
-        // Sort the vertices by y-coordinate
-        _sort_points_by_y(&x1, &y1, &x2, &y2, &x3, &y3);
-
-        // Handle flat bottom triangle
-        if (y2 == y3) {
-            // Fill flat bottom triangle
-            float slope1 = (float)(x2 - x1) / (y2 - y1);
-            float slope2 = (float)(x3 - x1) / (y3 - y1);
-            float x_start = x1;
-            float x_end = x1;
-
-            for (int y = y1; y <= y2; y++) {
-                for (int x = (int)x_start; x <= (int)x_end; x++) {
-                    _set_pixel(x, y, fillColor.r, fillColor.g, fillColor.b);
-                }
-                x_start += slope1;
-                x_end += slope2;
-            }
+    // Edges run clockwise on screen so that the inside is on their right
+    TriangleEdge edges[4];
+    for (int i = 0; i < n; i++) {
+        int j = area > 0 ? (i + 1) % n : (i + n - 1) % n;
+        edges[i] = _triangle_edge(xs[i], ys[i], xs[j], ys[j]);
+    }
+    _fill_edges(edges, n, -_subpixel_floor(-minX), -_subpixel_floor(-minY),
+                _subpixel_floor(maxX), _subpixel_floor(maxY), color);
+}
+
+// Fill a triangle given in device coordinates
+static void _fill_triangle(int x1, int y1, int x2, int y2, int x3, int y3) {
+    if (abs(x1) >= TRIANGLE_MAX_COORD || abs(y1) >= TRIANGLE_MAX_COORD ||
+        abs(x2) >= TRIANGLE_MAX_COORD || abs(y2) >= TRIANGLE_MAX_COORD ||
+        abs(x3) >= TRIANGLE_MAX_COORD || abs(y3) >= TRIANGLE_MAX_COORD) {
+        return;
+    }
+    int xs[3] = {x1 * SUBPIXEL_ONE, x2 * SUBPIXEL_ONE, x3 * SUBPIXEL_ONE};
+    int ys[3] = {y1 * SUBPIXEL_ONE, y2 * SUBPIXEL_ONE, y3 * SUBPIXEL_ONE};
+    _fill_convex_subpixel(xs, ys, 3, _pack_color(fillColor, fillAlpha));
+}
+
+// Fill the pixels within d / 2 of (x, y). Even diameters are centered
+// half a pixel up and left, where a stroke of that weight along (x, y)
+// puts its middle, so a point of weight 2 is a 2 x 2 block.
+static void _fill_disc(int x, int y, int d, uint32_t color) {
+    // Discs this large or this far out never touch a canvas
+    if (d >= TRIANGLE_MAX_COORD || abs(x) >= TRIANGLE_MAX_COORD || abs(y) >= TRIANGLE_MAX_COORD) return;
+    int even = !(d & 1);
+    int64_t d2 = (int64_t)d * d;
+    int rows = d / 2;
+    if (_outside_clip(x - rows, y - rows, x + rows, y + rows)) return;
+    int top = y - rows < clipY0 ? clipY0 - y : -rows;
+    int bottom = y + rows - even > clipY1 ? clipY1 - y : rows - even;
+    for (int dy = top; dy <= bottom; dy++) {
+        // Columns dx with (2 dx + even)^2 <= d^2 - (2 dy + even)^2
+        int64_t ty = 2 * dy + even;
+        int64_t rest = d2 - ty * ty;
+        int64_t root = (int64_t)sqrt((double)rest);
+        while (root * root > rest) root--;
+        while ((root + 1) * (root + 1) <= rest) root++;
+        int half = (int)(even ? (root - 1) / 2 : root / 2);
+        _fill_span(y + dy, x - half - even, x + half, color);
+    }
+}
+
+// Clip the segment from (x1, y1) to (x2, y2) to the square within limit of
+// the origin, Liang-Barsky style. Returns 0 when none of it is inside.
+static int _clip_segment(double* x1, double* y1, double* x2, double* y2, double limit) {
+    double dx = *x2 - *x1, dy = *y2 - *y1;
+    double p[4] = {-dx, dx, -dy, dy};
+    double q[4] = {*x1 + limit, limit - *x1, *y1 + limit, limit - *y1};
+    double t0 = 0.0, t1 = 1.0;
+    for (int i = 0; i < 4; i++) {
+        if (p[i] == 0.0) {
+            if (q[i] < 0.0) return 0;
+            continue;
         }
-        // Handle flat top triangle
-        else if (y1 == y2) {
-            // Fill flat top triangle
-            float slope1 = (float)(x3 - x1) / (y3 - y1);
-            float slope2 = (float)(x3 - x2) / (y3 - y2);
-            float x_start = x1;
-            float x_end = x2;
-
-            for (int y = y1; y <= y3; y++) {
-                for (int x = (int)x_start; x <= (int)x_end; x++) {
-                    _set_pixel(x, y, fillColor.r, fillColor.g, fillColor.b);
-                }
-                x_start += slope1;
-                x_end += slope2;
-            }
+        double t = q[i] / p[i];
+        if (p[i] < 0.0) {
+            if (t > t1) return 0;
+            if (t > t0) t0 = t;
+        } else {
+            if (t < t0) return 0;
+            if (t < t1) t1 = t;
         }
-        // Handle general triangle - split into flat bottom and flat top
-        else {
-            // Calculate the new vertex (x4,y4) that creates the flat side
-            int y4 = y2;
-            int x4 = x1 + ((y2 - y1) * (x3 - x1)) / (y3 - y1);
-
-            // Fill flat bottom triangle (v1, v2, v4)
-            float slope1 = (float)(x2 - x1) / (y2 - y1);
-            float slope2 = (float)(x4 - x1) / (y4 - y1);
-            float x_start = x1;
-            float x_end = x1;
-
-            for (int y = y1; y <= y2; y++) {
-                for (int x = (int)x_start; x <= (int)x_end; x++) {
-                    _set_pixel(x, y, fillColor.r, fillColor.g, fillColor.b);
-                }
-                x_start += slope1;
-                x_end += slope2;
-            }
+    }
+    double sx = *x1, sy = *y1;
+    *x1 = sx + t0 * dx;
+    *y1 = sy + t0 * dy;
+    *x2 = sx + t1 * dx;
+    *y2 = sy + t1 * dy;
+    return 1;
+}
+
+// Fill a stroke of the current weight from (x1, y1) to (x2, y2) as a
+// parallelogram. It reaches half a pixel past each end, covering the end
+// pixels as the one-pixel line does, and half the weight to either side at
+// every angle.
+static void _fill_thick_line(int x1, int y1, int x2, int y2, uint32_t color) {
+    // Vertical and horizontal strokes are the rectangle the parallelogram
+    // would cover
+    int w = strokeWeightValue;
+    if (x1 == x2 && y1 != y2) {
+        int top = y1 < y2 ? y1 : y2, bottom = y1 < y2 ? y2 : y1;
+        if (top < clipY0) top = clipY0;
+        if (bottom > clipY1) bottom = clipY1;
+        for (int y = top; y <= bottom; y++) {
+            _fill_span(y, x1 - w / 2, x1 - w / 2 + w - 1, color);
+        }
+        return;
+    }
+    if (y1 == y2 && x1 != x2) {
+        int top = y1 - w / 2 < clipY0 ? clipY0 : y1 - w / 2;
+        int bottom = y1 - w / 2 + w - 1 > clipY1 ? clipY1 : y1 - w / 2 + w - 1;
+        for (int y = top; y <= bottom; y++) {
+            _fill_span(y, x1 < x2 ? x1 : x2, x1 < x2 ? x2 : x1, color);
+        }
+        return;
+    }
+
+    // Far endpoints are moved along the stroke to TRIANGLE_MAX_COORD / 2,
+    // still well off any canvas, so the subpixel corners cannot overflow
+    if (w >= TRIANGLE_MAX_COORD) return;
+    int limit = TRIANGLE_MAX_COORD / 2;
+    if (abs(x1) > limit || abs(y1) > limit || abs(x2) > limit || abs(y2) > limit) {
+        double fx1 = x1, fy1 = y1, fx2 = x2, fy2 = y2;
+        if (!_clip_segment(&fx1, &fy1, &fx2, &fy2, limit)) return;
+        x1 = (int)lrint(fx1);
+        y1 = (int)lrint(fy1);
+        x2 = (int)lrint(fx2);
+        y2 = (int)lrint(fy2);
+    }
+
+    float dx = (float)(x2 - x1);
+    float dy = (float)(y2 - y1);
+    float length = sqrtf(dx * dx + dy * dy);
+    if (length == 0.0f) {
+        _fill_disc(x1, y1, w, color);
+        return;
+    }
+
+    // Along and across the stroke in subpixels; one rounded offset for
+    // every corner keeps opposite sides exactly parallel
+    float along = 0.5f * SUBPIXEL_ONE / length;
+    float across = 0.5f * w * SUBPIXEL_ONE / length;
+    int ex = (int)lrintf(dx * along), ey = (int)lrintf(dy * along);
+    int nx = (int)lrintf(-dy * across), ny = (int)lrintf(dx * across);
+
+    int sx1 = x1 * SUBPIXEL_ONE - ex, sy1 = y1 * SUBPIXEL_ONE - ey;
+    int sx2 = x2 * SUBPIXEL_ONE + ex, sy2 = y2 * SUBPIXEL_ONE + ey;
+    int xs[4] = {sx1 + nx, sx2 + nx, sx2 - nx, sx1 - nx};
+    int ys[4] = {sy1 + ny, sy2 + ny, sy2 - ny, sy1 - ny};
+    _fill_convex_subpixel(xs, ys, 4, color);
+}
+
+// Draw a triangle given in device coordinates
+static void _draw_triangle(int x1, int y1, int x2, int y2, int x3, int y3) {
+    if (recordingCommands) {
+        _record_command(COMMAND_TRIANGLE, x1, y1, x2, y2, x3, y3);
+        return;
+    }
+
+    // Draw the outline if stroke is enabled
+    if (useStroke) {
+        _draw_line(x1, y1, x2, y2);
+        _draw_line(x2, y2, x3, y3);
+        _draw_line(x3, y3, x1, y1);
+    }
+
+    // Fill the triangle if fill is enabled
+    if (useFill) {
+        _fill_triangle(x1, y1, x2, y2, x3, y3);
+    }
+}
+
+// Draw a triangle
+void triangle(int x1, int y1, int x2, int y2, int x3, int y3) {
+    P5C_TRACE_ZONE("triangle");
+    _count_primitives(P5C_STAT_TRIANGLE, 1);
+    // Transform the vertices once; the rasterizers work in device pixels
+    _transform_vertex(x1, y1, &x1, &y1);
+    _transform_vertex(x2, y2, &x2, &y2);
+    _transform_vertex(x3, y3, &x3, &y3);
+    _draw_triangle(x1, y1, x2, y2, x3, y3);
+}
+
+// Batched primitives: the same shapes as the single calls, with the per-call
+// work hoisted out of the loop. Elements are drawn in array order, so the
+// result is identical to calling point()/line()/ellipse()/rect() in a loop.
+// While drawing is being recorded (tiles or display lists) they fall back to
+// exactly those single calls.
+#define ELLIPSE_CACHE_SIZE 64
+#define MAX_CACHED_ELLIPSE 512
+
+// Spans of one ellipse size and stroke weight, shared by every ellipse of
+// that size in any batch
+typedef struct {
+    int w, h, weight; // What this entry describes, w is 0 when empty
+    int rows;
+    int* outer;       // _ellipse_spans() output
+    int* inner;
+} EllipseShape;
+
+static EllipseShape ellipseCache[ELLIPSE_CACHE_SIZE];
+
+static inline void _plot_unclipped(int x, int y, uint32_t color) {
+    uint32_t* p = &framebuffer[(size_t)y * width + x];
+    *p = (color >> 24) == 0xFF ? color : _blend_pixel(*p, color);
+    dirtyTiles[(y >> DIRTY_TILE_SHIFT) * dirtyCols + (x >> DIRTY_TILE_SHIFT)] = 1;
+    frameCounters.pixels++;
+}
+
+// Can the batch kernels write the framebuffer directly?
+static int _batch_direct(void) {
+    return framebuffer && !recordingCommands && !recordingList;
+}
+
+// _draw_line() for a one-pixel line known to lie inside the clip rectangle
+static void _draw_line_unclipped(int x1, int y1, int x2, int y2, uint32_t color) {
+    int dx = abs(x2 - x1);
+    int dy = abs(y2 - y1);
+    int sx = x1 < x2 ? 1 : -1;
+    int sy = y1 < y2 ? 1 : -1;
+    int stride = width;
+
+    // Bresenham always steps along the major axis and has taken
+    // k(i) = floor((2 i minor + major - 1) / (2 major)) minor steps at step i.
+    // A 16.48 fixed-point accumulator gives exactly that while major < 2^15,
+    // without the serial error term.
+    int xMajor = dx > dy;
+    int major = xMajor ? dx : dy;
+    int minor = xMajor ? dy : dx;
+    ptrdiff_t majorStep = xMajor ? sx : sy * (ptrdiff_t)stride;
+    ptrdiff_t minorStep = xMajor ? sy * (ptrdiff_t)stride : sx;
+    uint32_t* start = framebuffer + (size_t)y1 * stride + x1;
+    frameCounters.pixels += (uint64_t)major + 1;
+
+    // Mark the tiles under the line's box; a long thin diagonal would mark
+    // too many, so those are marked per step
+    uint8_t* dirty = dirtyTiles;
+    int cols = dirtyCols;
+    int tx0 = (x1 < x2 ? x1 : x2) >> DIRTY_TILE_SHIFT;
+    int tx1 = (x1 < x2 ? x2 : x1) >> DIRTY_TILE_SHIFT;
+    int ty0 = (y1 < y2 ? y1 : y2) >> DIRTY_TILE_SHIFT;
+    int ty1 = (y1 < y2 ? y2 : y1) >> DIRTY_TILE_SHIFT;
+    int markBox = (tx1 - tx0 <= 1 || ty1 - ty0 <= 1) && major < 32768;
+    if (markBox) {
+        for (int ty = ty0; ty <= ty1; ty++) {
+            memset(dirty + ty * cols + tx0, 1, tx1 - tx0 + 1);
+        }
+    }
+
+    if (markBox) {
+        uint64_t scale = (((uint64_t)1 << 48) + 2 * major - 1) / (2 * (uint64_t)major + (major == 0));
+        uint64_t acc = (uint64_t)(major > 0 ? major - 1 : 0) * scale;
+        uint64_t inc = 2 * (uint64_t)minor * scale;
+        for (int i = 0; i <= major; i++, acc += inc) {
+            start[i * majorStep + (ptrdiff_t)(acc >> 48) * minorStep] = color;
+        }
+        return;
+    }
+
+    int err = major - minor;
+    uint32_t* p = start;
+    int majorX = xMajor ? sx : 0, majorY = xMajor ? 0 : sy;
+    int minorX = xMajor ? 0 : sx, minorY = xMajor ? sy : 0;
+    for (int i = 0; i <= major; i++) {
+        *p = color;
+        dirty[(y1 >> DIRTY_TILE_SHIFT) * cols + (x1 >> DIRTY_TILE_SHIFT)] = 1;
+
+        int move = -(2 * err < major);
+        err += (major & move) - minor;
+        p += majorStep + (minorStep & move);
+        x1 += majorX + (minorX & move);
+        y1 += majorY + (minorY & move);
+    }
+}
+
+// Draw a device-space line with the current stroke, skipping clipping when possible
+static void _batch_line(int x1, int y1, int x2, int y2) {
+    int minX = x1 < x2 ? x1 : x2, maxX = x1 < x2 ? x2 : x1;
+    int minY = y1 < y2 ? y1 : y2, maxY = y1 < y2 ? y2 : y1;
+    if (!useSmooth && strokeAlpha == 255 && strokeWeightValue <= 1 && _inside_clip(minX, minY, maxX, maxY)) {
+        _draw_line_unclipped(x1, y1, x2, y2, _pack_color(strokeColor, 255));
+    } else {
+        _draw_line(x1, y1, x2, y2);
+    }
+}
+
+// Look up or build the cached spans of a w x h ellipse; NULL if too large
+static const EllipseShape* _ellipse_shape(int w, int h, int weight) {
+    if (w > MAX_CACHED_ELLIPSE || h > MAX_CACHED_ELLIPSE) return NULL;
+
+    // Circles up to the cache size each get their own slot
+    EllipseShape* shape = &ellipseCache[(unsigned)((w * 8 + h) * 3 + weight) % ELLIPSE_CACHE_SIZE];
+    if (shape->w == w && shape->h == h && shape->weight == weight) return shape;
+
+    int rows = h / 2 + weight / 2 + 1;
+    int* outer = (int*)malloc(2 * rows * sizeof(int));
+    if (!outer) return NULL;
+    _ellipse_spans(w / 2, h / 2, weight, outer, outer + rows);
+
+    free(shape->outer);
+    shape->w = w;
+    shape->h = h;
+    shape->weight = weight;
+    shape->rows = rows;
+    shape->outer = outer;
+    shape->inner = outer + rows;
+    return shape;
+}
+
+// _draw_ellipse() from a cached shape
+static void _batch_ellipse(int x, int y, int w, int h) {
+    int weight = useStroke ? strokeWeightValue : 0;
+    int cx = x + w / 2, cy = y + h / 2;
+    int reachX = w / 2 + weight / 2, reachY = h / 2 + weight / 2;
+    if (_outside_clip(cx - reachX, cy - reachY, cx + reachX, cy + reachY)) return;
+    const EllipseShape* shape = (w == h && w <= 2) ? NULL : _ellipse_shape(w, h, weight);
+    if (!shape) {
+        _draw_ellipse(x, y, w, h);
+        return;
+    }
+    if (useFill || useStroke) {
+        _draw_ellipse_spans(cx, cy, shape->rows, shape->outer, shape->inner, useFill, useStroke);
+    }
+}
+
+// Draw n points; colors (optional) replaces the stroke color per point
+void points(const float* xs, const float* ys, const Color* colors, int n) {
+    P5C_TRACE_ZONE("points");
+    if (!useStroke || n <= 0) return;
+    Color saved = strokeColor;
+    _count_primitives(P5C_STAT_POINT, n);
+
+    if (!_batch_direct() || strokeWeightValue != 1) {
+        primitiveDepth++;
+        for (int i = 0; i < n; i++) {
+            if (colors) strokeColor = colors[i];
+            point((int)xs[i], (int)ys[i]);
+        }
+        primitiveDepth--;
+        strokeColor = saved;
+        return;
+    }
+
+    uint32_t color = _pack_color(strokeColor, strokeAlpha);
+    for (int i = 0; i < n; i++) {
+        int x, y;
+        _transform_vertex((int)xs[i], (int)ys[i], &x, &y);
+        if (colors) color = _pack_color(colors[i], strokeAlpha);
+        if (_inside_clip(x, y, x, y)) {
+            _plot_unclipped(x, y, color);
+        }
+    }
+}
+
+// Draw n lines from (x1s[i], y1s[i]) to (x2s[i], y2s[i]); colors (optional)
+// replaces the stroke color per line
+void lines(const float* x1s, const float* y1s, const float* x2s, const float* y2s, const Color* colors, int n) {
+    P5C_TRACE_ZONE("lines");
+    if (!useStroke || n <= 0) return;
+    Color saved = strokeColor;
+    int direct = _batch_direct();
+    _count_primitives(P5C_STAT_LINE, n);
+
+    primitiveDepth++;
+    for (int i = 0; i < n; i++) {
+        if (colors) strokeColor = colors[i];
+        if (!direct) {
+            line((int)x1s[i], (int)y1s[i], (int)x2s[i], (int)y2s[i]);
+            continue;
+        }
+        int x1, y1, x2, y2;
+        _transform_vertex((int)x1s[i], (int)y1s[i], &x1, &y1);
+        _transform_vertex((int)x2s[i], (int)y2s[i], &x2, &y2);
+        _batch_line(x1, y1, x2, y2);
+    }
+    primitiveDepth--;
+    strokeColor = saved;
+}
+
+// Draw n ellipses by bounding box; colors (optional) replaces the fill color
+void ellipses(const float* xs, const float* ys, const float* ws, const float* hs, const Color* colors, int n) {
+    P5C_TRACE_ZONE("ellipses");
+    if (n <= 0) return;
+    Color saved = fillColor;
+
+    // Rotated or scaled ellipses take the general path of ellipse()
+    int direct = _batch_direct() && currentMatrix.kind != MATRIX_AFFINE;
+
+    _count_primitives(P5C_STAT_ELLIPSE, n);
+    primitiveDepth++;
+    for (int i = 0; i < n; i++) {
+        int w = (int)ws[i], h = (int)hs[i];
+        if (colors) fillColor = colors[i];
+        if (!direct) {
+            ellipse((int)xs[i], (int)ys[i], w, h);
+            continue;
+        }
+        if (w <= 0 || h <= 0) continue;
+        int x, y;
+        _transform_vertex((int)xs[i], (int)ys[i], &x, &y);
+        _batch_ellipse(x, y, w, h);
+    }
+    primitiveDepth--;
+    fillColor = saved;
+}
+
+// Draw n rectangles; colors (optional) replaces the fill color per rectangle
+void rects(const float* xs, const float* ys, const float* ws, const float* hs, const Color* colors, int n) {
+    P5C_TRACE_ZONE("rects");
+    if (n <= 0) return;
+    Color saved = fillColor;
+
+    // rect() fills exactly the w x h box; empty rects keep its outline behaviour
+    int direct = _batch_direct() && currentMatrix.kind != MATRIX_AFFINE;
+    for (int i = 0; direct && i < n; i++) {
+        if ((int)ws[i] < 1 || (int)hs[i] < 1) direct = 0;
+    }
+    _count_primitives(P5C_STAT_RECT, n);
+    if (!direct) {
+        primitiveDepth++;
+        for (int i = 0; i < n; i++) {
+            if (colors) fillColor = colors[i];
+            rect((int)xs[i], (int)ys[i], (int)ws[i], (int)hs[i]);
+        }
+        primitiveDepth--;
+        fillColor = saved;
+        return;
+    }
+
+    uint32_t color = _pack_color(fillColor, fillAlpha);
+    for (int i = 0; i < n; i++) {
+        int x0, y0, x1, y1;
+        int x = (int)xs[i], y = (int)ys[i];
+        _transform_vertex(x, y, &x0, &y0);
+        _transform_vertex(x + (int)ws[i] - 1, y + (int)hs[i] - 1, &x1, &y1);
+
+        if (useFill) {
+            if (colors) color = _pack_color(colors[i], fillAlpha);
+            int top = y0 > clipY0 ? y0 : clipY0;
+            int bottom = y1 < clipY1 ? y1 : clipY1;
+            for (int row = top; row <= bottom; row++) {
+                _fill_span(row, x0, x1, color);
+            }
+        }
+        if (useStroke) {
+            _batch_line(x0, y0, x1, y0);
+            _batch_line(x1, y0, x1, y1);
+            _batch_line(x1, y1, x0, y1);
+            _batch_line(x0, y1, x0, y0);
+        }
+    }
+}
+
+// Allocate pixel memory, cache-line aligned so the SIMD kernels can use aligned stores
+static uint32_t* _alloc_pixels(size_t bytes) {
+#ifdef P5C_WINDOWS
+    return (uint32_t*)_aligned_malloc(bytes, FRAMEBUFFER_ALIGN);
+#else
+    void* memory = NULL;
+    return posix_memalign(&memory, FRAMEBUFFER_ALIGN, bytes) == 0 ? (uint32_t*)memory : NULL;
+#endif
+}
+
+static void _free_pixels(uint32_t* pixels) {
+#ifdef P5C_WINDOWS
+    _aligned_free(pixels);
+#else
+    free(pixels);
+#endif
+}
+
+// Initialize the framebuffer
+static void _init_framebuffer(void) {
+    _free_framebuffer();
+
+    framebuffer = _alloc_pixels((size_t)width * height * sizeof(uint32_t));
+    if (!framebuffer) {
+        fprintf(stderr, "Failed to allocate framebuffer\n");
+        exit(1);
+    }
+    _init_dirty_tiles();
+    _reset_clip();
+    _clear_framebuffer(0, 0, 0);
+    _init_tile_renderer();
+}
+
+#ifdef P5C_X11_BACKEND
+// Use memory provided by the presentation backend as the framebuffer
+static void _adopt_framebuffer(uint32_t* memory) {
+    // Carry over what setup() drew
+    _flush_commands();
+    int drawn = framebuffer != NULL;
+    if (drawn) memcpy(memory, framebuffer, (size_t)width * height * sizeof(uint32_t));
+    _free_framebuffer();
+    framebuffer = memory;
+    framebufferExternal = 1;
+    _init_dirty_tiles();
+    _reset_clip();
+    if (!drawn) _clear_framebuffer(0, 0, 0);
+    _init_tile_renderer();
+}
+#endif
+
+
+// Let the calling thread write anywhere on the canvas
+static void _reset_clip(void) {
+    clipX0 = 0;
+    clipY0 = 0;
+    clipX1 = width - 1;
+    clipY1 = height - 1;
+}
+
+// x * a / 255, rounded, for 8-bit x and a
+static inline uint32_t _mul_div255(uint32_t x, uint32_t a) {
+    uint32_t t = x * a + 128;
+    return (t + (t >> 8)) >> 8;
+}
+
+// Composite one premultiplied pixel over another. _mul_div255() is applied
+// to two channels per multiply: each 16-bit half stays below 65536.
+static inline uint32_t _blend_pixel(uint32_t dst, uint32_t src) {
+    uint32_t inv = 255 - (src >> 24);
+    uint32_t rb = (dst & 0x00FF00FF) * inv + 0x00800080;
+    uint32_t ag = ((dst >> 8) & 0x00FF00FF) * inv + 0x00800080;
+    rb = ((rb + ((rb >> 8) & 0x00FF00FF)) >> 8) & 0x00FF00FF;
+    ag = (ag + ((ag >> 8) & 0x00FF00FF)) & 0xFF00FF00;
+    return src + (rb | ag);
+}
+
+// Pack a color into the framebuffer's 0xAARRGGBB layout, premultiplied by
+// alpha so that translucent colors composite with _blend_pixel()
+static uint32_t _pack_color(Color c, uint8_t alpha) {
+    if (alpha == 255) {
+        return 0xFF000000u | ((uint32_t)c.r << 16) | ((uint32_t)c.g << 8) | c.b;
+    }
+    return ((uint32_t)alpha << 24) | (_mul_div255(c.r, alpha) << 16) |
+           (_mul_div255(c.g, alpha) << 8) | _mul_div255(c.b, alpha);
+}
+
+// Mark the tiles under an already clipped span as dirty
+static void _mark_dirty_span(int y, int x0, int x1) {
+    if (dirtyAll) return;
+    uint8_t* row = dirtyTiles + (y >> DIRTY_TILE_SHIFT) * dirtyCols;
+    int c0 = x0 >> DIRTY_TILE_SHIFT;
+    int c1 = x1 >> DIRTY_TILE_SHIFT;
+    if (c1 - c0 <= 1) {
+        // Most spans are short; skip the call
+        row[c0] = 1;
+        row[c1] = 1;
+    } else {
+        memset(row + c0, 1, c1 - c0 + 1);
+    }
+}
+
+// Mark the whole canvas as needing presentation
+static void _mark_all_dirty(void) {
+    dirtyAll = 1;
+}
+
+// Allocate the dirty tile map for the current canvas size
+static void _init_dirty_tiles(void) {
+    dirtyCols = (width + DIRTY_TILE_SIZE - 1) >> DIRTY_TILE_SHIFT;
+    dirtyRows = (height + DIRTY_TILE_SIZE - 1) >> DIRTY_TILE_SHIFT;
+    dirtyTiles = (uint8_t*)calloc((size_t)dirtyCols * dirtyRows, 1);
+    dirtyOpen = (DirtyRect*)malloc(dirtyCols * sizeof(DirtyRect));
+    dirtyNext = (DirtyRect*)malloc(dirtyCols * sizeof(DirtyRect));
+    if (!dirtyTiles || !dirtyOpen || !dirtyNext) {
+        fprintf(stderr, "Failed to allocate dirty tile map\n");
+        exit(1);
+    }
+    dirtyAll = 1;
+}
+
+static void _free_dirty_tiles(void) {
+    free(dirtyTiles);
+    free(dirtyOpen);
+    free(dirtyNext);
+    dirtyTiles = NULL;
+    dirtyOpen = NULL;
+    dirtyNext = NULL;
+}
+
+// Convert a rectangle of tiles to pixels, trimmed to the canvas
+static void _present_tile_rect(const DirtyRect* r, void (*present)(int x, int y, int w, int h)) {
+    int x = r->x << DIRTY_TILE_SHIFT;
+    int y = r->y << DIRTY_TILE_SHIFT;
+    int w = r->w << DIRTY_TILE_SHIFT;
+    int h = r->h << DIRTY_TILE_SHIFT;
+    if (x + w > width) w = width - x;
+    if (y + h > height) h = height - y;
+    present(x, y, w, h);
+}
+
+// Hand every dirty region to present() and reset the tracking for the next
+// frame. Runs of dirty tiles on a tile row become rectangles, and a run that
+// spans the same columns as one on the row above extends it downwards.
+// Returns the number of rectangles presented.
+static int _present_dirty_rects(void (*present)(int x, int y, int w, int h)) {
+    if (!dirtyTiles) return 0;
+
+    if (dirtyAll) {
+        present(0, 0, width, height);
+        dirtyAll = 0;
+        memset(dirtyTiles, 0, (size_t)dirtyCols * dirtyRows);
+        return 1;
+    }
+
+    int presented = 0;
+    int openCount = 0;
+
+    for (int row = 0; row < dirtyRows; row++) {
+        uint8_t* tiles = dirtyTiles + row * dirtyCols;
+        int nextCount = 0;
+        int o = 0;
+
+        for (int col = 0; col < dirtyCols; col++) {
+            if (!tiles[col]) continue;
+
+            // Extent of this run of dirty tiles
+            int start = col;
+            while (col + 1 < dirtyCols && tiles[col + 1]) col++;
+            memset(tiles + start, 0, col - start + 1);
+
+            // Open rectangles left of this run can no longer grow
+            while (o < openCount && dirtyOpen[o].x < start) {
+                _present_tile_rect(&dirtyOpen[o++], present);
+                presented++;
+            }
+
+            if (o < openCount && dirtyOpen[o].x == start && dirtyOpen[o].w == col - start + 1) {
+                dirtyNext[nextCount] = dirtyOpen[o++];
+                dirtyNext[nextCount].h++;
+            } else {
+                dirtyNext[nextCount].x = start;
+                dirtyNext[nextCount].y = row;
+                dirtyNext[nextCount].w = col - start + 1;
+                dirtyNext[nextCount].h = 1;
+            }
+            nextCount++;
+        }
+
+        // Anything still open was not continued on this row
+        while (o < openCount) {
+            _present_tile_rect(&dirtyOpen[o++], present);
+            presented++;
+        }
+
+        DirtyRect* swap = dirtyOpen;
+        dirtyOpen = dirtyNext;
+        dirtyNext = swap;
+        openCount = nextCount;
+    }
+
+    for (int o = 0; o < openCount; o++) {
+        _present_tile_rect(&dirtyOpen[o], present);
+        presented++;
+    }
+
+    return presented;
+}
+
+// Set a pixel in the framebuffer (device coordinates)
+static void _set_pixel(int x, int y, uint32_t color) {
+    if (!framebuffer || (color >> 24) == 0) return;
+
+    // Bounds checking against the canvas or the worker's tile
+    if (x < clipX0 || x > clipX1 || y < clipY0 || y > clipY1) return;
+
+    uint32_t* p = &framebuffer[y * width + x];
+    *p = (color >> 24) == 0xFF ? color : _blend_pixel(*p, color);
+    dirtyTiles[(y >> DIRTY_TILE_SHIFT) * dirtyCols + (x >> DIRTY_TILE_SHIFT)] = 1;
+    frameCounters.pixels++;
+    if (recordingList) _capture_span(y, x, x, color);
+}
+
+// Store n copies of a packed color starting at dst
+static void _fill_row(uint32_t* dst, size_t n, uint32_t color) {
+#ifdef P5C_SSE2
+    // Store single pixels until dst is 16-byte aligned, then 4 at a time
+    while (n > 0 && ((uintptr_t)dst & 15)) {
+        *dst++ = color;
+        n--;
+    }
+    __m128i c = _mm_set1_epi32((int)color);
+    for (; n >= 16; n -= 16, dst += 16) {
+        _mm_store_si128((__m128i*)dst, c);
+        _mm_store_si128((__m128i*)(dst + 4), c);
+        _mm_store_si128((__m128i*)(dst + 8), c);
+        _mm_store_si128((__m128i*)(dst + 12), c);
+    }
+    for (; n >= 4; n -= 4, dst += 4) {
+        _mm_store_si128((__m128i*)dst, c);
+    }
+#endif
+    while (n-- > 0) {
+        *dst++ = color;
+    }
+}
+
+#ifdef P5C_SSE2
+// Composite color over 4 pixels; inv holds 255 - alpha in every 16-bit lane
+static inline __m128i _blend4_color(__m128i d, __m128i src, __m128i inv) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i half = _mm_set1_epi16(128);
+    __m128i lo = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(d, zero), inv), half);
+    __m128i hi = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(d, zero), inv), half);
+    lo = _mm_srli_epi16(_mm_add_epi16(lo, _mm_srli_epi16(lo, 8)), 8);
+    hi = _mm_srli_epi16(_mm_add_epi16(hi, _mm_srli_epi16(hi, 8)), 8);
+    return _mm_adds_epu8(src, _mm_packus_epi16(lo, hi));
+}
+#endif
+
+#ifdef P5C_AVX2
+// _blend_row_color() with 8 pixels per 256-bit register
+__attribute__((target("avx2")))
+static void _blend_row_color_avx2(uint32_t* dst, int n, uint32_t color) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i half = _mm256_set1_epi16(128);
+    const __m256i inv = _mm256_set1_epi16((short)(255 - (color >> 24)));
+    const __m256i src = _mm256_set1_epi32((int)color);
+
+    for (; n >= 8; n -= 8, dst += 8) {
+        __m256i d = _mm256_loadu_si256((const __m256i*)dst);
+        __m256i lo = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpacklo_epi8(d, zero), inv), half);
+        __m256i hi = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpackhi_epi8(d, zero), inv), half);
+        lo = _mm256_srli_epi16(_mm256_add_epi16(lo, _mm256_srli_epi16(lo, 8)), 8);
+        hi = _mm256_srli_epi16(_mm256_add_epi16(hi, _mm256_srli_epi16(hi, 8)), 8);
+        _mm256_storeu_si256((__m256i*)dst, _mm256_adds_epu8(src, _mm256_packus_epi16(lo, hi)));
+    }
+    // Short spans, such as the halves of a row split between two triangles
+    if (n >= 4) {
+        __m128i d = _mm_loadu_si128((const __m128i*)dst);
+        _mm_storeu_si128((__m128i*)dst, _blend4_color(d, _mm256_castsi256_si128(src), _mm256_castsi256_si128(inv)));
+        n -= 4;
+        dst += 4;
+    }
+    while (n-- > 0) {
+        *dst = _blend_pixel(*dst, color);
+        dst++;
+    }
+}
+#endif
+
+// Composite a premultiplied color over n pixels: dst * (255 - alpha) / 255
+// is the same in every pixel, so the kernels share one multiplier
+static void _blend_row_color(uint32_t* dst, int n, uint32_t color) {
+#ifdef P5C_AVX2
+    if (__builtin_cpu_supports("avx2")) {
+        _blend_row_color_avx2(dst, n, color);
+        return;
+    }
+#endif
+#ifdef P5C_SSE2
+    const __m128i inv = _mm_set1_epi16((short)(255 - (color >> 24)));
+    const __m128i src = _mm_set1_epi32((int)color);
+
+    // 8 pixels per iteration as two independent groups of 4
+    for (; n >= 8; n -= 8, dst += 8) {
+        __m128i d0 = _mm_loadu_si128((const __m128i*)dst);
+        __m128i d1 = _mm_loadu_si128((const __m128i*)(dst + 4));
+        _mm_storeu_si128((__m128i*)dst, _blend4_color(d0, src, inv));
+        _mm_storeu_si128((__m128i*)(dst + 4), _blend4_color(d1, src, inv));
+    }
+    if (n >= 4) {
+        __m128i d = _mm_loadu_si128((const __m128i*)dst);
+        _mm_storeu_si128((__m128i*)dst, _blend4_color(d, src, inv));
+        n -= 4;
+        dst += 4;
+    }
+#endif
+    while (n-- > 0) {
+        *dst = _blend_pixel(*dst, color);
+        dst++;
+    }
+}
+
+// Fill the horizontal span [x0, x1] on row y (device coordinates) with a
+// packed color; translucent colors are composited over the pixels
+static void _fill_span(int y, int x0, int x1, uint32_t color) {
+    if (!framebuffer || (color >> 24) == 0) return;
+
+    // Clip once for the whole span
+    if (y < clipY0 || y > clipY1) return;
+    if (x0 < clipX0) x0 = clipX0;
+    if (x1 > clipX1) x1 = clipX1;
+    if (x0 > x1) return;
+
+    uint32_t* dst = framebuffer + (size_t)y * width + x0;
+    if ((color >> 24) == 0xFF) {
+        _fill_row(dst, x1 - x0 + 1, color);
+    } else {
+        _blend_row_color(dst, x1 - x0 + 1, color);
+    }
+    _mark_dirty_span(y, x0, x1);
+    _count_span(x1 - x0 + 1);
+    if (recordingList) _capture_span(y, x0, x1, color);
+}
+
+// Smooth lines blend the stroke color into the pixels they partly cover:
+// dst + (color - dst) * coverage on all four channels, which is also right
+// for the premultiplied pixels of transparent layers. Coverage 0-255 is
+// widened to 0-256 so that full coverage gives exactly the stroke color.
+static inline uint32_t _lerp_pixel(uint32_t dst, uint32_t color, int coverage) {
+    uint32_t c = coverage + (coverage >> 7);
+    uint32_t rb = ((color & 0x00FF00FF) * c + (dst & 0x00FF00FF) * (256 - c)) >> 8;
+    uint32_t ag = (((color >> 8) & 0x00FF00FF) * c + ((dst >> 8) & 0x00FF00FF) * (256 - c)) >> 8;
+    return (rb & 0x00FF00FF) | ((ag & 0x00FF00FF) << 8);
+}
+
+#ifdef P5C_SSE2
+// _lerp_pixel() for 4 pixels with the coverages in the low bytes of cov
+static inline __m128i _lerp4(__m128i d, __m128i color16, __m128i cov) {
+    const __m128i zero = _mm_setzero_si128();
+
+    // Widen each coverage to 0-256 and spread it over the pixel's 4 channels
+    cov = _mm_add_epi32(cov, _mm_srli_epi32(cov, 7));
+    cov = _mm_packs_epi32(cov, cov);
+    cov = _mm_unpacklo_epi16(cov, cov);
+    __m128i covLo = _mm_unpacklo_epi32(cov, cov);
+    __m128i covHi = _mm_unpackhi_epi32(cov, cov);
+    const __m128i full = _mm_set1_epi16(256);
+
+    __m128i lo = _mm_add_epi16(_mm_mullo_epi16(color16, covLo),
+                               _mm_mullo_epi16(_mm_unpacklo_epi8(d, zero), _mm_sub_epi16(full, covLo)));
+    __m128i hi = _mm_add_epi16(_mm_mullo_epi16(color16, covHi),
+                               _mm_mullo_epi16(_mm_unpackhi_epi8(d, zero), _mm_sub_epi16(full, covHi)));
+    return _mm_packus_epi16(_mm_srli_epi16(lo, 8), _mm_srli_epi16(hi, 8));
+}
+#endif
+
+// Blend color into the pixels x0..x0+n-1 of row y with per-pixel coverage
+static void _blend_coverage_span(int y, int x0, const uint8_t* coverage, int n, uint32_t color) {
+    if (!framebuffer || y < clipY0 || y > clipY1) return;
+    if (x0 < clipX0) {
+        coverage += clipX0 - x0;
+        n -= clipX0 - x0;
+        x0 = clipX0;
+    }
+    if (x0 + n - 1 > clipX1) n = clipX1 - x0 + 1;
+    if (n <= 0) return;
+
+    uint32_t* dst = framebuffer + (size_t)y * width + x0;
+    int i = 0;
+#ifdef P5C_SSE2
+    __m128i color16 = _mm_unpacklo_epi8(_mm_set1_epi32((int)color), _mm_setzero_si128());
+    for (; i + 4 <= n; i += 4) {
+        uint32_t packed;
+        memcpy(&packed, coverage + i, 4);
+        __m128i cov = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128((int)packed), _mm_setzero_si128()),
+                                         _mm_setzero_si128());
+        __m128i d = _mm_loadu_si128((const __m128i*)(dst + i));
+        _mm_storeu_si128((__m128i*)(dst + i), _lerp4(d, color16, cov));
+    }
+#endif
+    for (; i < n; i++) {
+        dst[i] = _lerp_pixel(dst[i], color, coverage[i]);
+    }
+
+    _mark_dirty_span(y, x0, x0 + n - 1);
+    _count_span(n);
+    if (recordingList) {
+        for (i = 0; i < n; i++) {
+            _capture_span(y, x0 + i, x0 + i, dst[i]);
+        }
+    }
+}
+
+// Blend color into one pixel with the given coverage
+static inline void _blend_coverage_pixel(int x, int y, uint32_t color, int coverage) {
+    uint8_t c = (uint8_t)coverage;
+    if (coverage > 0) _blend_coverage_span(y, x, &c, 1, color);
+}
+
+// Wu's line: along the major axis, the two pixels straddling the exact line
+// share the coverage by how close each is to it. Coverage is scaled by the
+// stroke alpha, which makes translucent smooth lines
+static void _draw_line_wu(int x1, int y1, int x2, int y2, uint32_t color, int alpha) {
+    int dx = x2 - x1;
+    int dy = y2 - y1;
+
+    if (abs(dx) >= abs(dy)) {
+        if (dx < 0) {
+            int t = x1; x1 = x2; x2 = t;
+            t = y1; y1 = y2; y2 = t;
+            dx = -dx;
+            dy = -dy;
+        }
+        // The row of the line in 16.16 fixed point, from the first column
+        // inside the clip rectangle
+        int32_t gradient = dx ? (int32_t)(((int64_t)dy << 16) / dx) : 0;
+        int first = x1 < clipX0 ? clipX0 : x1;
+        int last = x2 > clipX1 ? clipX1 : x2;
+        int32_t yf = (int32_t)(((int64_t)y1 << 16) + (int64_t)(first - x1) * gradient);
+        for (int x = first; x <= last; x++, yf += gradient) {
+            int row = yf >> 16;
+            int frac = (yf >> 8) & 0xFF;
+            _blend_coverage_pixel(x, row, color, _mul_div255(255 - frac, alpha));
+            _blend_coverage_pixel(x, row + 1, color, _mul_div255(frac, alpha));
+        }
+    } else {
+        if (dy < 0) {
+            int t = x1; x1 = x2; x2 = t;
+            t = y1; y1 = y2; y2 = t;
+            dx = -dx;
+            dy = -dy;
+        }
+        // Both pixels of a row are neighbours, so they blend as one span
+        int32_t gradient = (int32_t)(((int64_t)dx << 16) / dy);
+        int first = y1 < clipY0 ? clipY0 : y1;
+        int last = y2 > clipY1 ? clipY1 : y2;
+        int32_t xf = (int32_t)(((int64_t)x1 << 16) + (int64_t)(first - y1) * gradient);
+        for (int y = first; y <= last; y++, xf += gradient) {
+            int frac = (xf >> 8) & 0xFF;
+            uint8_t coverage[2] = {(uint8_t)_mul_div255(255 - frac, alpha), (uint8_t)_mul_div255(frac, alpha)};
+            _blend_coverage_span(y, xf >> 16, coverage, frac ? 2 : 1, color);
+        }
+    }
+}
+
+// Lines wider than a pixel cover what lies within half the stroke weight of
+// the segment (round caps). A pixel's coverage falls off linearly over the
+// one pixel around that distance.
+#define SMOOTH_SPAN_CHUNK 256
+
+static void _draw_line_wide(int x1, int y1, int x2, int y2, uint32_t color, int alpha) {
+    float radius = strokeWeightValue * 0.5f;
+    float reach = radius + 0.5f;
+    float dx = (float)(x2 - x1);
+    float dy = (float)(y2 - y1);
+    float lengthSq = dx * dx + dy * dy;
+    float length = sqrtf(lengthSq);
+    float invLengthSq = lengthSq > 0.0f ? 1.0f / lengthSq : 0.0f;
+
+    int minX = (x1 < x2 ? x1 : x2) - (int)ceilf(reach);
+    int maxX = (x1 > x2 ? x1 : x2) + (int)ceilf(reach);
+    int minY = (y1 < y2 ? y1 : y2) - (int)ceilf(reach);
+    int maxY = (y1 > y2 ? y1 : y2) + (int)ceilf(reach);
+    if (minY < clipY0) minY = clipY0;
+    if (maxY > clipY1) maxY = clipY1;
+    if (minX < clipX0) minX = clipX0;
+    if (maxX > clipX1) maxX = clipX1;
+
+    // Half the width of the stroke band measured along a row
+    float bandHalf = fabsf(dy) > 0.0f ? reach * length / fabsf(dy) : 0.0f;
+
+    uint8_t coverage[SMOOTH_SPAN_CHUNK];
+    for (int y = minY; y <= maxY; y++) {
+        float py = (float)(y - y1);
+
+        // The band around the infinite line limits the row, unless the line is
+        // too flat for that to help
+        int rowX0 = minX, rowX1 = maxX;
+        if (fabsf(dy) > 0.0f && bandHalf < (float)(maxX - minX)) {
+            float center = x1 + py * dx / dy;
+            int bandX0 = (int)floorf(center - bandHalf);
+            int bandX1 = (int)ceilf(center + bandHalf);
+            if (bandX0 > rowX0) rowX0 = bandX0;
+            if (bandX1 < rowX1) rowX1 = bandX1;
+        }
+
+        for (int x0 = rowX0; x0 <= rowX1; x0 += SMOOTH_SPAN_CHUNK) {
+            int n = rowX1 - x0 + 1 < SMOOTH_SPAN_CHUNK ? rowX1 - x0 + 1 : SMOOTH_SPAN_CHUNK;
+            int covered = 0;
+            int i = 0;
+#ifdef P5C_SSE2
+            // The same arithmetic as the loop below, 4 pixels at a time
+            __m128 vdx = _mm_set1_ps(dx), vdy = _mm_set1_ps(dy), vpy = _mm_set1_ps(py);
+            __m128 pyDy = _mm_mul_ps(vpy, vdy);
+            __m128 invLen = _mm_set1_ps(invLengthSq);
+            __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.0f);
+            __m128 vreach = _mm_set1_ps(reach);
+            __m128 scale = _mm_set1_ps((float)alpha), half = _mm_set1_ps(0.5f);
+            __m128 px = _mm_add_ps(_mm_set1_ps((float)(x0 - x1)), _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f));
+            __m128i anyCovered = _mm_setzero_si128();
+            for (; i + 4 <= n; i += 4, px = _mm_add_ps(px, _mm_set1_ps(4.0f))) {
+                __m128 t = _mm_mul_ps(_mm_add_ps(_mm_mul_ps(px, vdx), pyDy), invLen);
+                t = _mm_min_ps(_mm_max_ps(t, zero), one);
+                __m128 ex = _mm_sub_ps(px, _mm_mul_ps(t, vdx));
+                __m128 ey = _mm_sub_ps(vpy, _mm_mul_ps(t, vdy));
+                __m128 c = _mm_sub_ps(vreach, _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(ex, ex), _mm_mul_ps(ey, ey))));
+                c = _mm_min_ps(_mm_max_ps(c, zero), one);
+                __m128i value = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(c, scale), half));
+                anyCovered = _mm_or_si128(anyCovered, value);
+                value = _mm_packs_epi32(value, value);
+                int packed = _mm_cvtsi128_si32(_mm_packus_epi16(value, value));
+                memcpy(coverage + i, &packed, 4);
+            }
+            covered = _mm_movemask_epi8(_mm_cmpeq_epi32(anyCovered, _mm_setzero_si128())) != 0xFFFF;
+#endif
+            for (; i < n; i++) {
+                // Distance from the pixel center to the nearest point of the segment
+                float px = (float)(x0 + i - x1);
+                float t = (px * dx + py * dy) * invLengthSq;
+                t = t < 0.0f ? 0.0f : (t > 1.0f ? 1.0f : t);
+                float ex = px - t * dx;
+                float ey = py - t * dy;
+                float c = reach - sqrtf(ex * ex + ey * ey);
+                c = c < 0.0f ? 0.0f : (c > 1.0f ? 1.0f : c);
+                int value = (int)(c * alpha + 0.5f);
+                coverage[i] = (uint8_t)value;
+                covered |= value;
+            }
+            if (covered) _blend_coverage_span(y, x0, coverage, n, color);
+        }
+    }
+}
+
+// Anti-aliased _draw_line() at device coordinates
+static void _draw_line_smooth(int x1, int y1, int x2, int y2) {
+    uint32_t color = _pack_color(strokeColor, 255);
+    if (strokeWeightValue <= 1) {
+        _draw_line_wu(x1, y1, x2, y2, color, strokeAlpha);
+    } else {
+        _draw_line_wide(x1, y1, x2, y2, color, strokeAlpha);
+    }
+}
+
+// Release the framebuffer allocated by _init_framebuffer
+static void _free_framebuffer(void) {
+    _free_dirty_tiles();
+    if (!framebuffer) return;
+    if (framebufferExternal) {
+        // The backend that provided the memory releases it
+        framebuffer = NULL;
+        framebufferExternal = 0;
+        return;
+    }
+    _free_pixels(framebuffer);
+    framebuffer = NULL;
+}
+
+#ifdef P5C_AVX2
+// Store n copies of color with 32-byte non-temporal stores
+__attribute__((target("avx2")))
+static void _stream_fill_avx2(uint32_t* dst, size_t n, uint32_t color) {
+    while (n > 0 && ((uintptr_t)dst & 31)) {
+        *dst++ = color;
+        n--;
+    }
+    __m256i c = _mm256_set1_epi32((int)color);
+    for (; n >= 32; n -= 32, dst += 32) {
+        _mm256_stream_si256((__m256i*)dst, c);
+        _mm256_stream_si256((__m256i*)(dst + 8), c);
+        _mm256_stream_si256((__m256i*)(dst + 16), c);
+        _mm256_stream_si256((__m256i*)(dst + 24), c);
+    }
+    for (; n >= 8; n -= 8, dst += 8) {
+        _mm256_stream_si256((__m256i*)dst, c);
+    }
+    _mm_sfence();
+    while (n-- > 0) {
+        *dst++ = color;
+    }
+}
+#endif
+
+// Store n copies of color, streaming past the cache where possible
+static void _stream_fill(uint32_t* dst, size_t n, uint32_t color) {
+#ifdef P5C_AVX2
+    if (__builtin_cpu_supports("avx2")) {
+        _stream_fill_avx2(dst, n, color);
+        return;
+    }
+#endif
+#ifdef P5C_SSE2
+    while (n > 0 && ((uintptr_t)dst & 15)) {
+        *dst++ = color;
+        n--;
+    }
+    __m128i c = _mm_set1_epi32((int)color);
+    for (; n >= 16; n -= 16, dst += 16) {
+        _mm_stream_si128((__m128i*)dst, c);
+        _mm_stream_si128((__m128i*)(dst + 4), c);
+        _mm_stream_si128((__m128i*)(dst + 8), c);
+        _mm_stream_si128((__m128i*)(dst + 12), c);
+    }
+    for (; n >= 4; n -= 4, dst += 4) {
+        _mm_stream_si128((__m128i*)dst, c);
+    }
+    _mm_sfence();
+#endif
+    while (n-- > 0) {
+        *dst++ = color;
+    }
+}
+
+// Clear the framebuffer with a specific color
+static void _clear_framebuffer(uint8_t r, uint8_t g, uint8_t b) {
+    if (!framebuffer) return;
+
+    uint32_t color = (0xFF << 24) | (r << 16) | (g << 8) | b;
+    if (recordingCommands) {
+        _record_command(COMMAND_CLEAR, (int)color, 0, 0, 0, 0, 0);
+        _mark_all_dirty();
+        return;
+    }
+    size_t count = (size_t)width * height;
+#ifdef P5C_DEBUG
+    fprintf(stderr, "p5c: clearing %zu pixels with color (%d, %d, %d)\n", count, r, g, b);
+#endif
+
+    // Small canvases stay in cache for the drawing that follows; large ones
+    // would only evict it, so write them around the cache
+    if (count * sizeof(uint32_t) >= STREAMING_CLEAR_BYTES) {
+        _stream_fill(framebuffer, count, color);
+    } else {
+        _fill_row(framebuffer, count, color);
+    }
+    _mark_all_dirty();
+    frameCounters.pixels += count;
+    frameCounters.spans += (uint64_t)height;
+
+    if (recordingList) {
+        for (int y = 0; y < height; y++) {
+            _capture_span(y, 0, width - 1, color);
+        }
+    }
+}
+
+// Math utilities
+float map(float value, float start1, float stop1, float start2, float stop2) {
+    return start2 + (stop2 - start2) * ((value - start1) / (stop1 - start1));
+}
+
+// Check if a key is currently pressed
+int keyIsDown(char k) {
+    // For special keys (arrow keys, etc.)
+    if (k == ARROW_UP || k == ARROW_DOWN || k == ARROW_LEFT || k == ARROW_RIGHT) {
+        return specialKeyStates[(unsigned char)k];
+    }
+
+    // For regular ASCII keys
+    unsigned char index = (unsigned char)k;
+    return keyStates[index];
+}
+
+float randomf(float min, float max) {
+    return min + (max - min) * ((float)rand() / RAND_MAX);
+}
+
+float constrain(float value, float min, float max) {
+    if (value < min) return min;
+    if (value > max) return max;
+    return value;
+}
+
+float dist(float x1, float y1, float x2, float y2) {
+    float dx = x2 - x1;
+    float dy = y2 - y1;
+    return sqrt(dx * dx + dy * dy);
+}
+
+// Set the angle mode (RADIANS or DEGREES)
+void angleMode(int mode) {
+    if (mode == RADIANS || mode == DEGREES) {
+        currentAngleMode = mode;
+    }
+}
+
+// Matrix functions
+static void _init_matrix(Matrix* m) {
+    // Initialize to identity matrix
+    memset(m->m, 0, sizeof(m->m));
+    m->m[0][0] = 1.0f;
+    m->m[1][1] = 1.0f;
+    m->m[2][2] = 1.0f;
+    m->kind = MATRIX_IDENTITY;
+}
+
+// Recompute the kind flag after the matrix has changed
+static void _classify_matrix(Matrix* m) {
+    if (m->m[0][0] != 1.0f || m->m[0][1] != 0.0f ||
+        m->m[1][0] != 0.0f || m->m[1][1] != 1.0f) {
+        m->kind = MATRIX_AFFINE;
+    } else if (m->m[0][2] != 0.0f || m->m[1][2] != 0.0f) {
+        m->kind = MATRIX_TRANSLATE;
+    } else {
+        m->kind = MATRIX_IDENTITY;
+    }
+}
+
+static void _transform_point(float* x, float* y) {
+    switch (currentMatrix.kind) {
+        case MATRIX_IDENTITY:
+            return;
+        case MATRIX_TRANSLATE:
+            *x += currentMatrix.m[0][2];
+            *y += currentMatrix.m[1][2];
+            return;
+        default: {
+            float tx = *x * currentMatrix.m[0][0] + *y * currentMatrix.m[0][1] + currentMatrix.m[0][2];
+            float ty = *x * currentMatrix.m[1][0] + *y * currentMatrix.m[1][1] + currentMatrix.m[1][2];
+            *x = tx;
+            *y = ty;
+            return;
+        }
+    }
+}
+
+void resetMatrix(void) {
+    _init_matrix(&currentMatrix);
+}
+
+void push(void) {
+    if (matrixStackSize >= MAX_MATRIX_STACK) {
+        fprintf(stderr, "Error: Matrix stack overflow\n");
+        return;
+    }
+    memcpy(&matrixStack[matrixStackSize], &currentMatrix, sizeof(Matrix));
+    matrixStackSize++;
+}
+
+void pop(void) {
+    if (matrixStackSize <= 0) {
+        fprintf(stderr, "Error: Matrix stack underflow\n");
+        return;
+    }
+    matrixStackSize--;
+    memcpy(&currentMatrix, &matrixStack[matrixStackSize], sizeof(Matrix));
+}
+
+void translate(float x, float y) {
+    currentMatrix.m[0][2] += x * currentMatrix.m[0][0] + y * currentMatrix.m[0][1];
+    currentMatrix.m[1][2] += x * currentMatrix.m[1][0] + y * currentMatrix.m[1][1];
+    _classify_matrix(&currentMatrix);
+}
+
+// Multiply the current matrix by [a c e; b d f; 0 0 1]
+void applyMatrix(float a, float b, float c, float d, float e, float f) {
+    float m00 = currentMatrix.m[0][0];
+    float m01 = currentMatrix.m[0][1];
+    float m10 = currentMatrix.m[1][0];
+    float m11 = currentMatrix.m[1][1];
+
+    currentMatrix.m[0][0] = m00 * a + m01 * b;
+    currentMatrix.m[0][1] = m00 * c + m01 * d;
+    currentMatrix.m[0][2] += m00 * e + m01 * f;
+    currentMatrix.m[1][0] = m10 * a + m11 * b;
+    currentMatrix.m[1][1] = m10 * c + m11 * d;
+    currentMatrix.m[1][2] += m10 * e + m11 * f;
+    _classify_matrix(&currentMatrix);
+}
+
+// Rotate the coordinate system (clockwise on screen, honours angleMode)
+void rotate(float angle) {
+    float theta = _normalize_angle(angle);
+    float c = cosf(theta);
+    float s = sinf(theta);
+    applyMatrix(c, s, -s, c, 0.0f, 0.0f);
+}
+
+// Scale the coordinate system along each axis
+void scale(float sx, float sy) {
+    applyMatrix(sx, 0.0f, 0.0f, sy, 0.0f, 0.0f);
+}
+
+// Minimal threading layer for the background workers
+#ifdef P5C_TRACE
+static void _trace_open(void);
+#endif
+
+#ifdef P5C_WINDOWS
+typedef HANDLE P5Thread;
+typedef CRITICAL_SECTION P5Mutex;
+typedef CONDITION_VARIABLE P5Cond;
+
+typedef struct {
+    void* (*fn)(void*);
+    void* arg;
+} ThreadStart;
+
+static DWORD WINAPI _thread_trampoline(LPVOID param) {
+    ThreadStart start = *(ThreadStart*)param;
+    free(param);
+    start.fn(start.arg);
+    return 0;
+}
+
+static int _thread_start(P5Thread* thread, void* (*fn)(void*), void* arg) {
+#ifdef P5C_TRACE
+    _trace_open();
+#endif
+    ThreadStart* start = (ThreadStart*)malloc(sizeof(ThreadStart));
+    if (!start) return 0;
+    start->fn = fn;
+    start->arg = arg;
+    *thread = CreateThread(NULL, 0, _thread_trampoline, start, 0, NULL);
+    if (!*thread) {
+        free(start);
+        return 0;
+    }
+    return 1;
+}
+
+static void _thread_join(P5Thread thread) {
+    WaitForSingleObject(thread, INFINITE);
+    CloseHandle(thread);
+}
+
+static void _mutex_init(P5Mutex* m) { InitializeCriticalSection(m); }
+static void _mutex_destroy(P5Mutex* m) { DeleteCriticalSection(m); }
+static void _mutex_lock(P5Mutex* m) { EnterCriticalSection(m); }
+static void _mutex_unlock(P5Mutex* m) { LeaveCriticalSection(m); }
+static void _cond_init(P5Cond* c) { InitializeConditionVariable(c); }
+static void _cond_destroy(P5Cond* c) { (void)c; }
+static void _cond_wait(P5Cond* c, P5Mutex* m) { SleepConditionVariableCS(c, m, INFINITE); }
+static void _cond_signal(P5Cond* c) { WakeConditionVariable(c); }
+static void _cond_broadcast(P5Cond* c) { WakeAllConditionVariable(c); }
+#else
+typedef pthread_t P5Thread;
+typedef pthread_mutex_t P5Mutex;
+typedef pthread_cond_t P5Cond;
+
+static int _thread_start(P5Thread* thread, void* (*fn)(void*), void* arg) {
+#ifdef P5C_TRACE
+    _trace_open();
+#endif
+    return pthread_create(thread, NULL, fn, arg) == 0;
+}
+
+static void _thread_join(P5Thread thread) { pthread_join(thread, NULL); }
+static void _mutex_init(P5Mutex* m) { pthread_mutex_init(m, NULL); }
+static void _mutex_destroy(P5Mutex* m) { pthread_mutex_destroy(m); }
+static void _mutex_lock(P5Mutex* m) { pthread_mutex_lock(m); }
+static void _mutex_unlock(P5Mutex* m) { pthread_mutex_unlock(m); }
+static void _cond_init(P5Cond* c) { pthread_cond_init(c, NULL); }
+static void _cond_destroy(P5Cond* c) { pthread_cond_destroy(c); }
+static void _cond_wait(P5Cond* c, P5Mutex* m) { pthread_cond_wait(c, m); }
+static void _cond_signal(P5Cond* c) { pthread_cond_signal(c); }
+static void _cond_broadcast(P5Cond* c) { pthread_cond_broadcast(c); }
+#endif
+
+// Monotonic time in nanoseconds
+static uint64_t _monotonic_ns(void) {
+#ifdef P5C_WINDOWS
+    static LARGE_INTEGER frequency;
+    LARGE_INTEGER counter;
+    if (frequency.QuadPart == 0) QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+    return (uint64_t)(counter.QuadPart / frequency.QuadPart) * 1000000000ull +
+           (uint64_t)(counter.QuadPart % frequency.QuadPart) * 1000000000ull / frequency.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+// Tracing (-DP5C_TRACE). Each thread appends its finished zones to a ring
+// of its own and never waits: a full ring drops the zone and counts it. A
+// writer thread drains every ring into the trace file each TRACE_DRAIN_MS
+// as Chrome trace events, in the JSON array format, which viewers load even
+// when the closing bracket is missing after a crash.
+#ifdef P5C_TRACE
+#define TRACE_RING_SIZE (1 << 16)
+#define TRACE_DRAIN_MS 10
+
+typedef struct {
+    const char* name;
+    uint64_t start;
+    uint64_t end;
+} TraceEvent;
+
+typedef struct TraceRing {
+    TraceEvent events[TRACE_RING_SIZE];
+    uint32_t head;           // Next event to write, advanced by the owning thread
+    uint32_t tail;           // Next event to drain, advanced by the drain
+    uint64_t dropped;        // Zones lost to a full ring
+    int tid;
+    const char* threadName;
+    int announced;           // thread_name metadata written
+    struct TraceRing* next;
+} TraceRing;
+
+static P5C_THREAD_LOCAL TraceRing* traceRing;
+static P5C_THREAD_LOCAL const char* traceThreadName;
+static int traceState;       // 0 not opened, 1 recording, -1 failed or closed
+static FILE* traceFile;
+static uint64_t traceStart;
+static TraceRing* traceRings;
+static int traceThreadCount;
+static P5Mutex traceMutex;   // Guards traceRings, the drain and traceFile
+static P5Thread traceThread;
+static int traceStopping;
+
+// Name the calling thread in the trace; call before its first zone
+#define TRACE_THREAD(name) (traceThreadName = (name))
+
+// Write the events each ring has gained since the last drain
+static void _trace_drain(void) {
+    for (TraceRing* ring = traceRings; ring; ring = ring->next) {
+        if (!ring->announced) {
+            fprintf(traceFile, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,"
+                    "\"args\":{\"name\":\"%s\"}}", ring->tid, ring->threadName);
+            ring->announced = 1;
+        }
+        uint32_t tail = ring->tail;
+        uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        for (; tail != head; tail++) {
+            const TraceEvent* e = &ring->events[tail & (TRACE_RING_SIZE - 1)];
+            // Zones opened just before the trace began are cut at its start
+            uint64_t start = e->start > traceStart ? e->start - traceStart : 0;
+            uint64_t end = e->end > traceStart ? e->end - traceStart : 0;
+            fputs(",\n{\"name\":\"", traceFile);
+            for (const char* c = e->name; *c; c++) {
+                if (*c == '"' || *c == '\\') fputc('\\', traceFile);
+                if ((unsigned char)*c >= 0x20) fputc(*c, traceFile);
+            }
+            fprintf(traceFile, "\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}", ring->tid,
+                    start / 1e3, (end - start) / 1e3);
+        }
+        __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+    }
+}
+
+static void* _trace_writer(void* arg) {
+    (void)arg;
+    while (!__atomic_load_n(&traceStopping, __ATOMIC_ACQUIRE)) {
+#ifdef P5C_WINDOWS
+        Sleep(TRACE_DRAIN_MS);
+#else
+        struct timespec ts = {0, TRACE_DRAIN_MS * 1000000L};
+        nanosleep(&ts, NULL);
+#endif
+        _mutex_lock(&traceMutex);
+        _trace_drain();
+        _mutex_unlock(&traceMutex);
+    }
+    return NULL;
+}
+
+// Drain what the rings hold and push it to the file, so a finished run is
+// complete on disk even if the process never exits normally
+static void _trace_flush(void) {
+    if (traceState != 1) return;
+    _mutex_lock(&traceMutex);
+    _trace_drain();
+    fflush(traceFile);
+    _mutex_unlock(&traceMutex);
+}
+
+// At exit: stop the writer, write the last events and close the array
+static void _trace_close(void) {
+    if (traceState != 1) return;
+    __atomic_store_n(&traceStopping, 1, __ATOMIC_RELEASE);
+    _thread_join(traceThread);
+
+    _mutex_lock(&traceMutex);
+    _trace_drain();
+    uint64_t dropped = 0;
+    for (TraceRing* ring = traceRings; ring; ring = ring->next) {
+        dropped += __atomic_load_n(&ring->dropped, __ATOMIC_RELAXED);
+    }
+    fputs("\n]\n", traceFile);
+    if (fclose(traceFile) != 0) {
+        fprintf(stderr, "p5c: failed to write the trace\n");
+    }
+    traceState = -1;
+    _mutex_unlock(&traceMutex);
+
+    if (dropped > 0) {
+        fprintf(stderr, "p5c: trace dropped %llu zones, its rings were full\n", (unsigned long long)dropped);
+    }
+}
+
+// Open the trace file and start the writer. _thread_start() calls this, so
+// the trace is open before there is a second thread to race for it.
+static void _trace_open(void) {
+    if (traceState != 0) return;
+    traceState = -1;
+
+    const char* path = getenv("P5C_TRACE_FILE");
+    if (!path || !*path) path = "p5c_trace.json";
+    traceFile = fopen(path, "w");
+    if (!traceFile) {
+        fprintf(stderr, "p5c: cannot open %s for writing\n", path);
+        return;
+    }
+    traceStart = _monotonic_ns();
+    fputs("[\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"p5c\"}}", traceFile);
+    _mutex_init(&traceMutex);
+    if (!_thread_start(&traceThread, _trace_writer, NULL)) {
+        fprintf(stderr, "p5c: failed to start trace thread\n");
+        fclose(traceFile);
+        return;
+    }
+    traceState = 1;
+    atexit(_trace_close);
+}
+
+// Give the calling thread its ring on its first zone
+static TraceRing* _trace_register(void) {
+    _trace_open();
+    if (traceState != 1) return NULL;
+    TraceRing* ring = (TraceRing*)calloc(1, sizeof(TraceRing));
+    if (!ring) return NULL;
+    ring->threadName = traceThreadName ? traceThreadName : "main";
+
+    _mutex_lock(&traceMutex);
+    ring->tid = ++traceThreadCount;
+    ring->next = traceRings;
+    traceRings = ring;
+    _mutex_unlock(&traceMutex);
+    traceRing = ring;
+    return ring;
+}
+
+uint64_t p5c_trace_begin(void) {
+    return _monotonic_ns();
+}
+
+void p5c_trace_end(P5TraceZone* zone) {
+    uint64_t end = _monotonic_ns();
+    TraceRing* ring = traceRing ? traceRing : _trace_register();
+    if (!ring) return;
+
+    uint32_t head = ring->head;
+    if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == TRACE_RING_SIZE) {
+        __atomic_store_n(&ring->dropped, ring->dropped + 1, __ATOMIC_RELAXED);
+        return;
+    }
+    TraceEvent* e = &ring->events[head & (TRACE_RING_SIZE - 1)];
+    e->name = zone->name;
+    e->start = zone->start;
+    e->end = end;
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+#else
+#define TRACE_THREAD(name) ((void)0)
+#endif
+
+// Frame pacing. Frame n is due at base + n * 1e9 / targetFrameRate ns, so
+// the rate is exact and late frames do not push the later ones back. The
+// wait sleeps to an absolute time just before the deadline and spins the
+// rest, leaving room for how late the sleeps have been waking up. A frame
+// up to PACER_MAX_LAG periods late is caught up by running the next ones
+// without waiting; later than that, the missed deadlines are dropped.
+#define PACER_MAX_LAG 2
+#define PACER_MIN_SPIN_NS 50000ull
+#define PACER_MAX_SPIN_NS 2000000ull
+
+typedef struct {
+    uint64_t startNs;      // run() began, for millis()
+    uint64_t base;         // Deadline of frame 0 at the current rate
+    uint64_t index;        // Frames since base
+    int rate;              // targetFrameRate the grid was laid out for
+    uint64_t frameStart;   // When the current frame began
+    uint64_t wakeLatency;  // Average lateness of the sleeps in ns
+    uint64_t dropped;      // Deadlines skipped to catch up
+    uint64_t slept;        // Time spent in _pacer_wait() since the frame began
+    int simulated;         // Headless: time advances one period per frame
+} FramePacer;
+
+static FramePacer pacer;
+
+static inline void _spin_pause(void) {
+#ifdef P5C_SSE2
+    _mm_pause();
+#endif
+}
+
+static uint64_t _pacer_deadline(void) {
+    return pacer.base + pacer.index * 1000000000ull / (uint64_t)pacer.rate;
+}
+
+// Start the frame clock; simulated clocks run one period per frame with no
+// waiting, which keeps headless renders deterministic
+static void _pacer_start(int simulated) {
+    memset(&pacer, 0, sizeof(pacer));
+    pacer.simulated = simulated;
+    pacer.startNs = _monotonic_ns();
+    pacer.base = pacer.startNs;
+    pacer.rate = targetFrameRate;
+    pacer.frameStart = pacer.startNs;
+    pacer.wakeLatency = PACER_MIN_SPIN_NS;
+}
+
+#ifndef P5C_HEADLESS
+// Lay the frame grid out from now, just before the first frame, so the
+// time setup() and window creation took is neither the first deltaTime nor
+// dropped frames. startNs stays put: millis() counts from run().
+static void _pacer_first_frame(void) {
+    pacer.base = _monotonic_ns();
+    pacer.index = 0;
+    pacer.rate = targetFrameRate;
+    pacer.frameStart = pacer.base;
+    pacer.dropped = 0;
+}
+
+// Sleep until the next frame is due, or until the file descriptor fd (-1
+// for none) has input to read. Returns 1 for input, 0 at the deadline.
+static int _pacer_wait(int fd) {
+    if (pacer.simulated) return 0;
+    uint64_t deadline = _pacer_deadline();
+    uint64_t now = _monotonic_ns();
+    if (now >= deadline) return 0;
+    uint64_t entered = now;
+    P5C_TRACE_ZONE("sleep");
+
+    uint64_t spin = 2 * pacer.wakeLatency;
+    if (spin < PACER_MIN_SPIN_NS) spin = PACER_MIN_SPIN_NS;
+    if (spin > PACER_MAX_SPIN_NS) spin = PACER_MAX_SPIN_NS;
+    if (deadline - now > spin) {
+        uint64_t wake = deadline - spin;
+#ifdef P5C_WINDOWS
+        (void)fd;
+        Sleep((DWORD)((wake - now) / 1000000));
+#else
+        // poll() counts whole milliseconds: wait for input up to the last
+        // one, then sleep the rest precisely
+        if (fd >= 0 && wake - now >= 1000000) {
+            struct pollfd p;
+            p.fd = fd;
+            p.events = POLLIN;
+            p.revents = 0;
+            if (poll(&p, 1, (int)((wake - now) / 1000000)) != 0) {
+                pacer.slept += _monotonic_ns() - entered;
+                return 1;
+            }
+        }
+        struct timespec ts;
+        ts.tv_sec = (time_t)(wake / 1000000000ull);
+        ts.tv_nsec = (long)(wake % 1000000000ull);
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {
+        }
+#endif
+        // Track how late the sleeps wake, averaged over 8 frames
+        now = _monotonic_ns();
+        uint64_t late = now > wake ? now - wake : 0;
+        pacer.wakeLatency += late / 8 - pacer.wakeLatency / 8;
+    }
+    while ((now = _monotonic_ns()) < deadline) {
+        _spin_pause();
+    }
+    pacer.slept += now - entered;
+    return 0;
+}
+#endif
+
+// A frame begins: set deltaTime and move on to the next deadline
+static void _pacer_begin_frame(void) {
+    if (pacer.rate != targetFrameRate) {
+        // frameRate() changed: lay the grid out again from this deadline
+        pacer.base = _pacer_deadline();
+        pacer.index = 0;
+        pacer.rate = targetFrameRate;
+    }
+    uint64_t period = 1000000000ull / (uint64_t)pacer.rate;
+    uint64_t now = pacer.simulated ? pacer.frameStart + period : _monotonic_ns();
+    deltaTime = (float)((now - pacer.frameStart) / 1e6);
+    pacer.frameStart = now;
+
+    pacer.index++;
+    uint64_t next = _pacer_deadline();
+    if (!pacer.simulated && now > next + PACER_MAX_LAG * period) {
+        // Too far behind to catch up: skip to the first deadline after now
+        uint64_t missed = (now - next) / period + 1;
+        pacer.dropped += missed;
+        pacer.index += missed;
+    }
+}
+
+// Milliseconds since run() started, on the frame clock when headless
+unsigned long millis(void) {
+    uint64_t now = pacer.simulated ? pacer.frameStart : _monotonic_ns();
+    return (unsigned long)((now - pacer.startNs) / 1000000ull);
+}
+
+// Frame statistics. The loops call _stats_begin_frame() as each frame starts,
+// which closes the record of the one before; draw time runs to the end of
+// _finish_frame() and present time from there to _stats_presented().
+#define STATS_HISTORY 128 // Frames in the overlay's graph
+
+static P5FrameStats frameStats;    // The last completed frame
+static FrameCounters tileCounters; // Tile workers' counts, under tileMutex
+static uint64_t statsFrameStart = 0;
+static uint64_t statsMark = 0;     // End of the last timed stage
+static uint64_t statsDrawNs = 0;
+static uint64_t statsPresentNs = 0;
+
+// Overlay: the graph's frame, draw and present times, and the pixels it
+// covers, put back once the frame has been presented
+#define OVERLAY_X 4
+#define OVERLAY_Y 4
+#define OVERLAY_WIDTH (STATS_HISTORY + 8)
+#define OVERLAY_HEIGHT 62
+#define OVERLAY_GRAPH_HEIGHT 40
+
+static int overlayEnabled = -1; // -1 until p5c_stats_overlay() or P5C_STATS decides
+static float statsHistory[STATS_HISTORY][3];
+static int statsHistoryCount = 0;
+static uint32_t overlaySaved[OVERLAY_WIDTH * OVERLAY_HEIGHT];
+static uint32_t* overlayCanvas = NULL; // Framebuffer the saved pixels belong to
+static int overlayW = 0;
+static int overlayH = 0;
+
+// Add the time since the last stage ended to a stage's total
+static void _stats_mark(uint64_t* total) {
+    uint64_t now = _monotonic_ns();
+    *total += now - statsMark;
+    statsMark = now;
+}
+
+static void _stats_presented(void) {
+    _stats_mark(&statsPresentNs);
+}
+
+// Put back the pixels under the last frame's overlay
+static void _remove_stats_overlay(void) {
+    if (!overlayCanvas) return;
+    if (overlayCanvas == framebuffer && overlayW <= width - OVERLAY_X && overlayH <= height - OVERLAY_Y) {
+        for (int row = 0; row < overlayH; row++) {
+            memcpy(framebuffer + (size_t)(OVERLAY_Y + row) * width + OVERLAY_X, overlaySaved + row * overlayW,
+                   overlayW * sizeof(uint32_t));
+            _mark_dirty_span(OVERLAY_Y + row, OVERLAY_X, OVERLAY_X + overlayW - 1);
+        }
+    }
+    overlayCanvas = NULL;
+}
+
+// Fill in frameStats for the frame that just ended
+static void _stats_close_frame(uint64_t now) {
+    if (statsFrameStart == 0) return;
+    frameStats.frame = frameCount - 1;
+    frameStats.frameMs = (now - statsFrameStart) / 1e6;
+    frameStats.drawMs = statsDrawNs / 1e6;
+    frameStats.presentMs = statsPresentNs / 1e6;
+    frameStats.sleepMs = pacer.slept / 1e6;
+    frameStats.pixels = frameCounters.pixels + tileCounters.pixels;
+    frameStats.spans = frameCounters.spans + tileCounters.spans;
+    for (int i = 0; i < P5C_STAT_PRIMITIVES; i++) {
+        frameStats.primitives[i] = frameCounters.primitives[i];
+    }
+    frameStats.framesDropped = (int)pacer.dropped;
+
+    float* sample = statsHistory[statsHistoryCount++ % STATS_HISTORY];
+    sample[0] = (float)frameStats.frameMs;
+    sample[1] = (float)frameStats.drawMs;
+    sample[2] = (float)frameStats.presentMs;
+}
+
+static void _stats_begin_frame(void) {
+    uint64_t now = _monotonic_ns();
+    _remove_stats_overlay();
+    _stats_close_frame(now);
+
+    // Drawing before the first frame, in setup(), is not counted
+    memset(&frameCounters, 0, sizeof(frameCounters));
+    memset(&tileCounters, 0, sizeof(tileCounters));
+    statsDrawNs = 0;
+    statsPresentNs = 0;
+    pacer.slept = 0;
+    statsFrameStart = now;
+    statsMark = now;
+}
+
+P5FrameStats p5c_get_frame_stats(void) {
+    return frameStats;
+}
+
+void p5c_stats_overlay(int enabled) {
+    overlayEnabled = enabled != 0;
+}
+
+// 3x5 glyphs, one bit per pixel from the top-left, for the overlay's text
+static const char overlayChars[] = "0123456789.FPSM";
+static const uint16_t overlayGlyphs[] = {
+    0x7B6F, 0x2C97, 0x73E7, 0x73CF, 0x5BC9, 0x79CF, 0x79EF, 0x7249,
+    0x7BEF, 0x7BCF, 0x0002, 0x79A4, 0x6BA4, 0x388E, 0x5F6D,
+};
+
+// Draw text at twice the glyph size, 8 pixels per character
+static void _overlay_text(int x, int y, const char* text, uint32_t color) {
+    for (; *text; text++, x += 8) {
+        const char* found = strchr(overlayChars, *text);
+        if (!found) continue;
+        uint16_t glyph = overlayGlyphs[found - overlayChars];
+        for (int row = 0; row < 5; row++) {
+            for (int col = 0; col < 3; col++) {
+                if (!(glyph & (0x4000 >> (row * 3 + col)))) continue;
+                _fill_span(y + row * 2, x + col * 2, x + col * 2 + 1, color);
+                _fill_span(y + row * 2 + 1, x + col * 2, x + col * 2 + 1, color);
+            }
+        }
+    }
+}
+
+// Draw the frame rate and a graph of recent frame times in the top-left
+// corner: the whole frame in grey with the draw (orange) and present (blue)
+// times at the bottom of each bar, against a line at the target period
+static void _draw_stats_overlay(void) {
+    if (overlayEnabled < 0) {
+        const char* env = getenv("P5C_STATS");
+        overlayEnabled = env && atoi(env) > 0;
+    }
+    if (!overlayEnabled || headlessFrames > 0 || !framebuffer) return;
+
+    overlayW = width - OVERLAY_X < OVERLAY_WIDTH ? width - OVERLAY_X : OVERLAY_WIDTH;
+    overlayH = height - OVERLAY_Y < OVERLAY_HEIGHT ? height - OVERLAY_Y : OVERLAY_HEIGHT;
+    if (overlayW <= 0 || overlayH <= 0) return;
+    for (int row = 0; row < overlayH; row++) {
+        memcpy(overlaySaved + row * overlayW, framebuffer + (size_t)(OVERLAY_Y + row) * width + OVERLAY_X,
+               overlayW * sizeof(uint32_t));
+    }
+    overlayCanvas = framebuffer;
+
+    // The overlay is neither counted nor captured by an open display list
+    FrameCounters savedCounters = frameCounters;
+    int savedRecording = recordingList;
+    recordingList = 0;
+
+    Color black = {0, 0, 0}, white = {255, 255, 255}, grey = {110, 110, 110};
+    Color orange = {255, 150, 30}, blue = {60, 140, 255}, green = {60, 220, 90};
+    for (int row = 0; row < OVERLAY_HEIGHT; row++) {
+        _fill_span(OVERLAY_Y + row, OVERLAY_X, OVERLAY_X + OVERLAY_WIDTH - 1, _pack_color(black, 192));
+    }
+
+    int samples = statsHistoryCount < STATS_HISTORY ? statsHistoryCount : STATS_HISTORY;
+    float total = 0.0f;
+    for (int i = 0; i < samples; i++) {
+        total += statsHistory[i][0];
+    }
+    char text[32];
+    snprintf(text, sizeof(text), "%.1f FPS %.1f MS", samples > 0 ? 1000.0f * samples / total : 0.0f,
+             samples > 0 ? statsHistory[(statsHistoryCount - 1) % STATS_HISTORY][0] : 0.0f);
+    _overlay_text(OVERLAY_X + 4, OVERLAY_Y + 4, text, _pack_color(white, 255));
+
+    // Two target periods fill the graph's height
+    float period = 1000.0f / (targetFrameRate > 0 ? targetFrameRate : 60);
+    float scale = OVERLAY_GRAPH_HEIGHT / (2.0f * period);
+    int bottom = OVERLAY_Y + OVERLAY_HEIGHT - 5;
+    for (int i = 0; i < samples; i++) {
+        const float* sample = statsHistory[(statsHistoryCount - samples + i) % STATS_HISTORY];
+        int x = OVERLAY_X + 4 + (STATS_HISTORY - samples) + i;
+        int frame = (int)(sample[0] * scale + 0.5f);
+        int draw = (int)(sample[1] * scale + 0.5f);
+        int present = (int)((sample[1] + sample[2]) * scale + 0.5f);
+        if (frame > OVERLAY_GRAPH_HEIGHT) frame = OVERLAY_GRAPH_HEIGHT;
+        if (present > frame) present = frame;
+        if (draw > present) draw = present;
+        for (int h = 0; h < frame; h++) {
+            Color c = h < draw ? orange : h < present ? blue : grey;
+            _fill_span(bottom - h, x, x, _pack_color(c, 255));
+        }
+    }
+    int target = bottom - (int)(period * scale + 0.5f);
+    _fill_span(target, OVERLAY_X + 4, OVERLAY_X + 3 + STATS_HISTORY, _pack_color(green, 255));
+
+    recordingList = savedRecording;
+    frameCounters = savedCounters;
+}
+
+// Display lists: between beginRecord() and endRecord() every span and pixel
+// the drawing functions write is also captured, already transformed and
+// clipped. drawRecord() replays them as plain span fills. Spans are bucketed
+// by row, keeping their order within a row, which is all overdraw depends on.
+typedef struct {
+    int x0, x1;
+    uint32_t color;
+} RecordSpan;
+
+struct P5Record {
+    int width, height;  // Canvas size the spans were clipped to
+    int* rowStart;      // Row y holds spans[rowStart[y] .. rowStart[y + 1])
+    RecordSpan* spans;
+    int spanCount;
+    int x0, y0, x1, y1; // Bounds of all spans
+};
+
+// Spans captured so far, in the order they were written
+typedef struct {
+    int y, x0, x1;
+    uint32_t color;
+} CapturedSpan;
+
+static CapturedSpan* capturedSpans = NULL;
+static int capturedCount = 0;
+static int capturedCapacity = 0;
+static int capturedOverflow = 0;
+static int resumeCommands = 0; // Tiled recording to restore at endRecord()
+
+// Add a clipped span to the display list being recorded
+static void _capture_span(int y, int x0, int x1, uint32_t color) {
+    // Pixels written left to right along a row (lines, outlines) join the last span
+    if (capturedCount > 0) {
+        CapturedSpan* last = &capturedSpans[capturedCount - 1];
+        if (last->y == y && last->color == color && last->x1 + 1 == x0) {
+            last->x1 = x1;
+            return;
+        }
+    }
+
+    if (capturedCount == capturedCapacity) {
+        int capacity = capturedCapacity ? capturedCapacity * 2 : 4096;
+        CapturedSpan* grown = (CapturedSpan*)realloc(capturedSpans, capacity * sizeof(CapturedSpan));
+        if (!grown) {
+            capturedOverflow = 1;
+            return;
+        }
+        capturedSpans = grown;
+        capturedCapacity = capacity;
+    }
+    CapturedSpan* span = &capturedSpans[capturedCount++];
+    span->y = y;
+    span->x0 = x0;
+    span->x1 = x1;
+    span->color = color;
+}
+
+// Start capturing drawing into a display list
+void beginRecord(void) {
+    if (recordingList) {
+        fprintf(stderr, "Error: beginRecord() called while already recording\n");
+        return;
+    }
+
+    // Capture needs the real pixel writes, so draw immediately while recording
+    _flush_commands();
+    resumeCommands = recordingCommands;
+    recordingCommands = 0;
+
+    capturedCount = 0;
+    capturedOverflow = 0;
+    recordingList = 1;
+}
+
+// Finish recording and return the display list (NULL without beginRecord())
+P5Record* endRecord(void) {
+    if (!recordingList) {
+        fprintf(stderr, "Error: endRecord() called without beginRecord()\n");
+        return NULL;
+    }
+    recordingList = 0;
+    recordingCommands = resumeCommands;
+
+    if (capturedOverflow) {
+        fprintf(stderr, "p5c: out of memory recording display list\n");
+        return NULL;
+    }
+
+    P5Record* record = (P5Record*)calloc(1, sizeof(P5Record));
+    if (!record) return NULL;
+    record->width = width;
+    record->height = height;
+    record->rowStart = (int*)calloc(height + 1, sizeof(int));
+    record->spans = (RecordSpan*)malloc((capturedCount > 0 ? capturedCount : 1) * sizeof(RecordSpan));
+    if (!record->rowStart || !record->spans) {
+        freeRecord(record);
+        return NULL;
+    }
+
+    // Counting sort by row; stable, so each row keeps its drawing order
+    record->x0 = width;
+    record->y0 = height;
+    record->x1 = -1;
+    record->y1 = -1;
+    for (int i = 0; i < capturedCount; i++) {
+        const CapturedSpan* span = &capturedSpans[i];
+        record->rowStart[span->y + 1]++;
+        if (span->x0 < record->x0) record->x0 = span->x0;
+        if (span->x1 > record->x1) record->x1 = span->x1;
+        if (span->y < record->y0) record->y0 = span->y;
+        if (span->y > record->y1) record->y1 = span->y;
+    }
+    for (int y = 0; y < height; y++) {
+        record->rowStart[y + 1] += record->rowStart[y];
+    }
+    int* next = (int*)malloc((height > 0 ? height : 1) * sizeof(int));
+    if (!next) {
+        freeRecord(record);
+        return NULL;
+    }
+    memcpy(next, record->rowStart, height * sizeof(int));
+    for (int i = 0; i < capturedCount; i++) {
+        const CapturedSpan* span = &capturedSpans[i];
+        RecordSpan* dst = &record->spans[next[span->y]++];
+        dst->x0 = span->x0;
+        dst->x1 = span->x1;
+        dst->color = span->color;
+    }
+    free(next);
+    record->spanCount = capturedCount;
+
+    // The capture buffer is only needed while recording
+    free(capturedSpans);
+    capturedSpans = NULL;
+    capturedCapacity = 0;
+    capturedCount = 0;
+    return record;
+}
+
+// Fill a display list's spans inside the current clip rectangle
+static void _replay_record(const P5Record* record) {
+    int y0 = record->y0 > clipY0 ? record->y0 : clipY0;
+    int y1 = record->y1 < clipY1 ? record->y1 : clipY1;
+    for (int y = y0; y <= y1; y++) {
+        for (int i = record->rowStart[y]; i < record->rowStart[y + 1]; i++) {
+            const RecordSpan* span = &record->spans[i];
+            _fill_span(y, span->x0, span->x1, span->color);
+        }
+    }
+}
+
+// Draw a display list where it was recorded
+void drawRecord(P5Record* record) {
+    P5C_TRACE_ZONE("drawRecord");
+    if (!record || !framebuffer || !record->spans || record->spanCount == 0) return;
+
+    // On a target of another size (a layer inside beginDraw(), or the
+    // canvas after size()) the replay is clipped to it; the rows it reads
+    // stay within the list's own bounds either way
+    _count_primitives(P5C_STAT_RECORD, 1);
+
+    if (recordingCommands) {
+        _record_display_list(record);
+    } else {
+        _replay_record(record);
+    }
+}
+
+void freeRecord(P5Record* record) {
+    if (!record) return;
+    free(record->rowStart);
+    free(record->spans);
+    free(record);
+}
+
+// Offscreen graphics: a P5Graphics owns a pixel buffer that the drawing
+// functions write to between beginDraw() and endDraw(). Redirecting swaps
+// the canvas globals (pixels, size, dirty map, clip and matrix), so every
+// drawing path works unchanged. Pixels are premultiplied 0xAARRGGBB and
+// start out transparent.
+struct P5Graphics {
+    int width, height;
+    uint32_t* pixels;
+    uint8_t* dirtyTiles; // Written by the pixel paths, never presented
+    int dirtyCols, dirtyRows;
+};
+
+// The main canvas while a graphics buffer is being drawn into
+typedef struct {
+    uint32_t* framebuffer;
+    int width, height;
+    uint8_t* dirtyTiles;
+    int dirtyCols, dirtyRows, dirtyAll;
+    Matrix matrix;
+    int matrixStackSize;
+    int recordingCommands;
+} SavedCanvas;
+
+static SavedCanvas savedCanvas;
+
+P5Graphics* createGraphics(int w, int h) {
+    if (w <= 0 || h <= 0) return NULL;
+
+    P5Graphics* g = (P5Graphics*)calloc(1, sizeof(P5Graphics));
+    if (!g) return NULL;
+    g->width = w;
+    g->height = h;
+    g->pixels = _alloc_pixels((size_t)w * h * sizeof(uint32_t));
+    g->dirtyCols = (w + DIRTY_TILE_SIZE - 1) >> DIRTY_TILE_SHIFT;
+    g->dirtyRows = (h + DIRTY_TILE_SIZE - 1) >> DIRTY_TILE_SHIFT;
+    g->dirtyTiles = (uint8_t*)calloc((size_t)g->dirtyCols * g->dirtyRows, 1);
+    if (!g->pixels || !g->dirtyTiles) {
+        fprintf(stderr, "Failed to allocate graphics buffer\n");
+        freeGraphics(g);
+        return NULL;
+    }
+    memset(g->pixels, 0, (size_t)w * h * sizeof(uint32_t));
+    return g;
+}
+
+void freeGraphics(P5Graphics* g) {
+    if (!g) return;
+    if (g == activeGraphics) endDraw();
+    _free_pixels(g->pixels);
+    free(g->dirtyTiles);
+    free(g);
+}
+
+// Redirect drawing into g, with a fresh transform, until endDraw()
+void beginDraw(P5Graphics* g) {
+    if (!g) return;
+    if (activeGraphics) {
+        fprintf(stderr, "Error: beginDraw() called before endDraw()\n");
+        return;
+    }
+
+    // Commands queued for the canvas may read g, so finish them first, and
+    // draw into g immediately
+    _flush_commands();
+    savedCanvas.recordingCommands = recordingCommands;
+    recordingCommands = 0;
+
+    savedCanvas.framebuffer = framebuffer;
+    savedCanvas.width = width;
+    savedCanvas.height = height;
+    savedCanvas.dirtyTiles = dirtyTiles;
+    savedCanvas.dirtyCols = dirtyCols;
+    savedCanvas.dirtyRows = dirtyRows;
+    savedCanvas.dirtyAll = dirtyAll;
+    savedCanvas.matrix = currentMatrix;
+    savedCanvas.matrixStackSize = matrixStackSize;
+
+    framebuffer = g->pixels;
+    width = g->width;
+    height = g->height;
+    dirtyTiles = g->dirtyTiles;
+    dirtyCols = g->dirtyCols;
+    dirtyRows = g->dirtyRows;
+    dirtyAll = 1;
+    _reset_clip();
+    resetMatrix();
+    activeGraphics = g;
+}
+
+// Send drawing back to the canvas
+void endDraw(void) {
+    if (!activeGraphics) return;
+
+    framebuffer = savedCanvas.framebuffer;
+    width = savedCanvas.width;
+    height = savedCanvas.height;
+    dirtyTiles = savedCanvas.dirtyTiles;
+    dirtyCols = savedCanvas.dirtyCols;
+    dirtyRows = savedCanvas.dirtyRows;
+    dirtyAll = savedCanvas.dirtyAll;
+    currentMatrix = savedCanvas.matrix;
+    matrixStackSize = savedCanvas.matrixStackSize;
+    recordingCommands = savedCanvas.recordingCommands;
+    _reset_clip();
+    activeGraphics = NULL;
+}
+
+// Make every pixel transparent black
+void clear(void) {
+    P5C_TRACE_ZONE("clear");
+    if (!framebuffer) return;
+    _flush_commands();
+    memset(framebuffer, 0, (size_t)width * height * sizeof(uint32_t));
+    _mark_all_dirty();
+    frameCounters.pixels += (uint64_t)width * height;
+}
+
+// Copy n pixels from src to dst
+static void _copy_row(uint32_t* dst, const uint32_t* src, int n) {
+#ifdef P5C_SSE2
+    // Align the stores; the source alignment depends on the blit position
+    while (n > 0 && ((uintptr_t)dst & 15)) {
+        *dst++ = *src++;
+        n--;
+    }
+    for (; n >= 16; n -= 16, dst += 16, src += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i*)src);
+        __m128i b = _mm_loadu_si128((const __m128i*)(src + 4));
+        __m128i c = _mm_loadu_si128((const __m128i*)(src + 8));
+        __m128i d = _mm_loadu_si128((const __m128i*)(src + 12));
+        _mm_store_si128((__m128i*)dst, a);
+        _mm_store_si128((__m128i*)(dst + 4), b);
+        _mm_store_si128((__m128i*)(dst + 8), c);
+        _mm_store_si128((__m128i*)(dst + 12), d);
+    }
+    for (; n >= 4; n -= 4, dst += 4, src += 4) {
+        _mm_store_si128((__m128i*)dst, _mm_loadu_si128((const __m128i*)src));
+    }
+#endif
+    while (n-- > 0) {
+        *dst++ = *src++;
+    }
+}
+
+#ifdef P5C_SSE2
+// Composite 4 premultiplied pixels over dst
+static inline void _blend4(uint32_t* dst, __m128i s) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i opaque = _mm_set1_epi32(0xFF);
+    const __m128i half = _mm_set1_epi16(128);
+
+    // Spread 255 - alpha of each pixel over its four 16-bit channels
+    __m128i inv = _mm_sub_epi32(opaque, _mm_srli_epi32(s, 24));
+    inv = _mm_packs_epi32(inv, inv);
+    inv = _mm_unpacklo_epi16(inv, inv);
+    __m128i invLo = _mm_unpacklo_epi32(inv, inv);
+    __m128i invHi = _mm_unpackhi_epi32(inv, inv);
+
+    __m128i d = _mm_loadu_si128((const __m128i*)dst);
+    __m128i lo = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(d, zero), invLo), half);
+    __m128i hi = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(d, zero), invHi), half);
+    lo = _mm_srli_epi16(_mm_add_epi16(lo, _mm_srli_epi16(lo, 8)), 8);
+    hi = _mm_srli_epi16(_mm_add_epi16(hi, _mm_srli_epi16(hi, 8)), 8);
+    _mm_storeu_si128((__m128i*)dst, _mm_adds_epu8(s, _mm_packus_epi16(lo, hi)));
+}
+#endif
+
+// Composite n premultiplied pixels over dst (source over)
+static void _blend_row(uint32_t* dst, const uint32_t* src, int n) {
+#ifdef P5C_SSE2
+    const __m128i alphaMask = _mm_set1_epi32((int)0xFF000000u);
+
+    for (; n >= 16; n -= 16, dst += 16, src += 16) {
+        __m128i s0 = _mm_loadu_si128((const __m128i*)src);
+        __m128i s1 = _mm_loadu_si128((const __m128i*)(src + 4));
+        __m128i s2 = _mm_loadu_si128((const __m128i*)(src + 8));
+        __m128i s3 = _mm_loadu_si128((const __m128i*)(src + 12));
+
+        // Whole runs of transparent or opaque pixels need no arithmetic
+        __m128i any = _mm_and_si128(_mm_or_si128(_mm_or_si128(s0, s1), _mm_or_si128(s2, s3)), alphaMask);
+        if (_mm_movemask_epi8(_mm_cmpeq_epi32(any, _mm_setzero_si128())) == 0xFFFF) {
+            continue;
+        }
+        __m128i all = _mm_and_si128(_mm_and_si128(_mm_and_si128(s0, s1), _mm_and_si128(s2, s3)), alphaMask);
+        if (_mm_movemask_epi8(_mm_cmpeq_epi32(all, alphaMask)) == 0xFFFF) {
+            _mm_storeu_si128((__m128i*)dst, s0);
+            _mm_storeu_si128((__m128i*)(dst + 4), s1);
+            _mm_storeu_si128((__m128i*)(dst + 8), s2);
+            _mm_storeu_si128((__m128i*)(dst + 12), s3);
+            continue;
+        }
+
+        _blend4(dst, s0);
+        _blend4(dst + 4, s1);
+        _blend4(dst + 8, s2);
+        _blend4(dst + 12, s3);
+    }
+    for (; n >= 4; n -= 4, dst += 4, src += 4) {
+        _blend4(dst, _mm_loadu_si128((const __m128i*)src));
+    }
+#endif
+    for (; n > 0; n--, dst++, src++) {
+        uint32_t alpha = *src >> 24;
+        if (alpha == 255) {
+            *dst = *src;
+        } else if (alpha != 0) {
+            *dst = _blend_pixel(*dst, *src);
+        }
+    }
+}
+
+// Draw g with its top-left corner at device (x, y), inside the clip rectangle
+static void _blit_graphics(const P5Graphics* g, int x, int y, int blend) {
+    int x0 = x > clipX0 ? x : clipX0;
+    int y0 = y > clipY0 ? y : clipY0;
+    int x1 = x + g->width - 1 < clipX1 ? x + g->width - 1 : clipX1;
+    int y1 = y + g->height - 1 < clipY1 ? y + g->height - 1 : clipY1;
+    if (x0 > x1 || y0 > y1) return;
+
+    for (int row = y0; row <= y1; row++) {
+        uint32_t* dst = framebuffer + (size_t)row * width + x0;
+        const uint32_t* src = g->pixels + (size_t)(row - y) * g->width + (x0 - x);
+        if (blend) {
+            _blend_row(dst, src, x1 - x0 + 1);
+        } else {
+            _copy_row(dst, src, x1 - x0 + 1);
+        }
+        _mark_dirty_span(row, x0, x1);
+        _count_span(x1 - x0 + 1);
+        if (recordingList) {
+            // A display list stores spans, so capture the result pixel by pixel
+            for (int col = x0; col <= x1; col++) {
+                _capture_span(row, col, col, dst[col - x0]);
+            }
+        }
+    }
+}
+
+static void _draw_graphics(P5Graphics* g, int x, int y, int blend) {
+    P5C_TRACE_ZONE("image");
+    if (!g || !framebuffer || g == activeGraphics) return;
+    _count_primitives(P5C_STAT_IMAGE, 1);
+
+    // Graphics are placed by translation only; rotation and scale are ignored
+    _transform_vertex(x, y, &x, &y);
+    if (recordingCommands) {
+        _record_graphics(g, x, y, blend);
+    } else {
+        _blit_graphics(g, x, y, blend);
+    }
+}
+
+// Copy g onto the canvas, replacing what is underneath
+void image(P5Graphics* g, int x, int y) {
+    _draw_graphics(g, x, y, 0);
+}
+
+// Composite g onto the canvas, respecting its transparency
+void imageBlend(P5Graphics* g, int x, int y) {
+    _draw_graphics(g, x, y, 1);
+}
+
+// Tiled rendering: with more than one thread, draw calls are recorded into
+// a per-frame command buffer with the style they were issued with. At the
+// end of the frame each command is binned into the 64x64 tiles its bounds
+// touch, and a worker pool replays every tile's commands in submission
+// order, clipped to the tile, so the result matches serial drawing exactly.
+typedef struct {
+    int type;
+    int v[6];               // Device coordinates; offset and count into commandVertices for polygons
+    float start, stop;      // Sector angles
+    const P5Record* record; // Display list
+    const P5Graphics* graphics;
+    Color fill, stroke;
+    uint8_t fillAlpha, strokeAlpha;
+    int useFill, useStroke, weight, smooth;
+    int x0, y0, x1, y1;     // Inclusive pixel bounds
+} DrawCommand;
+
+static int tileThreads = 1;      // Threads rasterizing a frame, the main thread included
+static int tileThreadsSet = 0;   // p5c_threads() was called, so P5C_THREADS is ignored
+static DrawCommand* commands = NULL;
+static int commandCount = 0;
+static int commandCapacity = 0;
+static int* commandVertices = NULL; // Polygon vertices as x, y pairs
+static int vertexCount = 0;
+static int vertexCapacity = 0;
+
+// Per-tile command lists: binItems[binStart[t] .. binStart[t + 1]) for tile t
+static int binCols = 0;
+static int binRows = 0;
+static int* binStart = NULL;
+static int* binFill = NULL;
+static int* binItems = NULL;
+static int binItemCapacity = 0;
+static int* busyTiles = NULL; // Tiles with at least one command
+static int busyTileCount = 0;
+
+// Worker pool
+static P5Thread* tileWorkers = NULL;
+static int tileWorkerCount = 0;
+static P5Mutex tileMutex;
+static P5Cond tileStart;
+static P5Cond tileDone;
+static int tileGeneration = 0; // Bumped for every frame handed to the workers
+static int tileNext = 0;       // Next entry of busyTiles to rasterize
+static int tileBusy = 0;       // Workers still rasterizing this frame
+static int tileStopping = 0;
+
+static int _cpu_count(void) {
+#ifdef P5C_WINDOWS
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return (int)info.dwNumberOfProcessors;
+#else
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? (int)count : 1;
+#endif
+}
+
+// Append a command carrying the current style; NULL if out of memory
+static DrawCommand* _new_command(int type) {
+    if (commandCount == commandCapacity) {
+        int capacity = commandCapacity ? commandCapacity * 2 : 1024;
+        DrawCommand* grown = (DrawCommand*)realloc(commands, capacity * sizeof(DrawCommand));
+        if (!grown) {
+            fprintf(stderr, "p5c: out of memory recording draw commands\n");
+            return NULL;
+        }
+        commands = grown;
+        commandCapacity = capacity;
+    }
+
+    DrawCommand* cmd = &commands[commandCount++];
+    cmd->type = type;
+    cmd->fill = fillColor;
+    cmd->stroke = strokeColor;
+    cmd->fillAlpha = fillAlpha;
+    cmd->strokeAlpha = strokeAlpha;
+    cmd->useFill = useFill;
+    cmd->useStroke = useStroke;
+    cmd->weight = strokeWeightValue;
+    cmd->smooth = useSmooth;
+    return cmd;
+}
+
+// Grow bounds by the stroke reach plus a pixel for rounding in the fillers
+static void _pad_bounds(DrawCommand* cmd, int stroked) {
+    int pad = 1 + (stroked ? cmd->weight / 2 : 0);
+    cmd->x0 -= pad;
+    cmd->y0 -= pad;
+    cmd->x1 += pad;
+    cmd->y1 += pad;
+}
+
+static void _record_command(int type, int v0, int v1, int v2, int v3, int v4, int v5) {
+    if (type == COMMAND_CLEAR) {
+        // Nothing recorded earlier in the frame can show through a clear
+        commandCount = 0;
+        vertexCount = 0;
+    }
+
+    DrawCommand* cmd = _new_command(type);
+    if (!cmd) return;
+    cmd->v[0] = v0; cmd->v[1] = v1; cmd->v[2] = v2;
+    cmd->v[3] = v3; cmd->v[4] = v4; cmd->v[5] = v5;
+
+    switch (type) {
+        case COMMAND_CLEAR:
+            cmd->x0 = 0;
+            cmd->y0 = 0;
+            cmd->x1 = width - 1;
+            cmd->y1 = height - 1;
+            break;
+        case COMMAND_POINT:
+            cmd->x0 = cmd->x1 = v0;
+            cmd->y0 = cmd->y1 = v1;
+            _pad_bounds(cmd, 1);
+            break;
+        case COMMAND_LINE:
+        case COMMAND_TRIANGLE: {
+            int n = type == COMMAND_LINE ? 2 : 3;
+            cmd->x0 = cmd->x1 = v0;
+            cmd->y0 = cmd->y1 = v1;
+            for (int i = 1; i < n; i++) {
+                int x = cmd->v[i * 2], y = cmd->v[i * 2 + 1];
+                if (x < cmd->x0) cmd->x0 = x;
+                if (x > cmd->x1) cmd->x1 = x;
+                if (y < cmd->y0) cmd->y0 = y;
+                if (y > cmd->y1) cmd->y1 = y;
+            }
+            _pad_bounds(cmd, cmd->useStroke);
+            break;
+        }
+        case COMMAND_ELLIPSE:
+            cmd->x0 = v0;
+            cmd->y0 = v1;
+            cmd->x1 = v0 + v2;
+            cmd->y1 = v1 + v3;
+            _pad_bounds(cmd, cmd->useStroke);
+            break;
+    }
+}
+
+static void _record_polygon(const int* xs, const int* ys, int n) {
+    if (vertexCount + n * 2 > vertexCapacity) {
+        int capacity = vertexCapacity ? vertexCapacity : 4096;
+        while (capacity < vertexCount + n * 2) capacity *= 2;
+        int* grown = (int*)realloc(commandVertices, capacity * sizeof(int));
+        if (!grown) {
+            fprintf(stderr, "p5c: out of memory recording draw commands\n");
+            return;
+        }
+        commandVertices = grown;
+        vertexCapacity = capacity;
+    }
+
+    DrawCommand* cmd = _new_command(COMMAND_POLYGON);
+    if (!cmd) return;
+    cmd->v[0] = vertexCount;
+    cmd->v[1] = n;
+    cmd->x0 = cmd->x1 = xs[0];
+    cmd->y0 = cmd->y1 = ys[0];
+    for (int i = 0; i < n; i++) {
+        commandVertices[vertexCount++] = xs[i];
+        commandVertices[vertexCount++] = ys[i];
+        if (xs[i] < cmd->x0) cmd->x0 = xs[i];
+        if (xs[i] > cmd->x1) cmd->x1 = xs[i];
+        if (ys[i] < cmd->y0) cmd->y0 = ys[i];
+        if (ys[i] > cmd->y1) cmd->y1 = ys[i];
+    }
+    _pad_bounds(cmd, 0);
+}
+
+// Display lists are drawn by the workers too; the list must outlive the frame
+static void _record_display_list(const P5Record* record) {
+    DrawCommand* cmd = _new_command(COMMAND_RECORD);
+    if (!cmd) return;
+    cmd->record = record;
+    cmd->x0 = record->x0;
+    cmd->y0 = record->y0;
+    cmd->x1 = record->x1;
+    cmd->y1 = record->y1;
+}
+
+// A graphics buffer must not change before the frame is rasterized;
+// beginDraw() flushes, which guarantees that
+static void _record_graphics(const P5Graphics* g, int x, int y, int blend) {
+    DrawCommand* cmd = _new_command(COMMAND_IMAGE);
+    if (!cmd) return;
+    cmd->graphics = g;
+    cmd->v[0] = x;
+    cmd->v[1] = y;
+    cmd->v[2] = blend;
+    cmd->x0 = x;
+    cmd->y0 = y;
+    cmd->x1 = x + g->width - 1;
+    cmd->y1 = y + g->height - 1;
+}
+
+static void _record_sector(int cx, int cy, int a, int b, float start, float stop) {
+    DrawCommand* cmd = _new_command(COMMAND_SECTOR);
+    if (!cmd) return;
+    cmd->v[0] = cx;
+    cmd->v[1] = cy;
+    cmd->v[2] = a;
+    cmd->v[3] = b;
+    cmd->start = start;
+    cmd->stop = stop;
+    cmd->x0 = cx - a;
+    cmd->y0 = cy - b;
+    cmd->x1 = cx + a;
+    cmd->y1 = cy + b;
+    _pad_bounds(cmd, 0);
+}
+
+// Replay one command with the rasterizers, under its recorded style
+static void _execute_command(const DrawCommand* cmd) {
+    fillColor = cmd->fill;
+    strokeColor = cmd->stroke;
+    fillAlpha = cmd->fillAlpha;
+    strokeAlpha = cmd->strokeAlpha;
+    useFill = cmd->useFill;
+    useStroke = cmd->useStroke;
+    strokeWeightValue = cmd->weight;
+    useSmooth = cmd->smooth;
+
+    const int* v = cmd->v;
+    switch (cmd->type) {
+        case COMMAND_CLEAR:
+            for (int y = clipY0; y <= clipY1; y++) {
+                _fill_span(y, clipX0, clipX1, (uint32_t)v[0]);
+            }
+            break;
+        case COMMAND_POINT:
+            _draw_point(v[0], v[1]);
+            break;
+        case COMMAND_LINE:
+            _draw_line(v[0], v[1], v[2], v[3]);
+            break;
+        case COMMAND_TRIANGLE:
+            _draw_triangle(v[0], v[1], v[2], v[3], v[4], v[5]);
+            break;
+        case COMMAND_ELLIPSE:
+            _draw_ellipse(v[0], v[1], v[2], v[3]);
+            break;
+        case COMMAND_POLYGON: {
+            // Gather the interleaved vertices back into the layout the filler takes
+            int n = v[1];
+            int xs[MAX_ELLIPSE_SEGMENTS];
+            int ys[MAX_ELLIPSE_SEGMENTS];
+            for (int i = 0; i < n; i++) {
+                xs[i] = commandVertices[v[0] + i * 2];
+                ys[i] = commandVertices[v[0] + i * 2 + 1];
+            }
+            _fill_convex_polygon(xs, ys, n);
+            break;
+        }
+        case COMMAND_SECTOR:
+            _fill_arc_sector(v[0], v[1], v[2], v[3], cmd->start, cmd->stop);
+            break;
+        case COMMAND_RECORD:
+            _replay_record(cmd->record);
+            break;
+        case COMMAND_IMAGE:
+            _blit_graphics(cmd->graphics, v[0], v[1], v[2]);
+            break;
+    }
+}
+
+// Rasterize every command binned into a tile, clipped to that tile
+static void _rasterize_tile(int tile) {
+    P5C_TRACE_ZONE("tile");
+    int tx = tile % binCols;
+    int ty = tile / binCols;
+    clipX0 = tx << BIN_TILE_SHIFT;
+    clipY0 = ty << BIN_TILE_SHIFT;
+    clipX1 = clipX0 + BIN_TILE_SIZE - 1 < width ? clipX0 + BIN_TILE_SIZE - 1 : width - 1;
+    clipY1 = clipY0 + BIN_TILE_SIZE - 1 < height ? clipY0 + BIN_TILE_SIZE - 1 : height - 1;
+
+    for (int i = binStart[tile]; i < binStart[tile + 1]; i++) {
+        _execute_command(&commands[binItems[i]]);
+    }
+}
+
+// Take tiles from the shared queue until none are left
+static void _rasterize_tiles(void) {
+    P5C_TRACE_ZONE("rasterize");
+    while (1) {
+        _mutex_lock(&tileMutex);
+        int next = tileNext < busyTileCount ? tileNext++ : -1;
+        _mutex_unlock(&tileMutex);
+        if (next < 0) break;
+        _rasterize_tile(busyTiles[next]);
+    }
+}
+
+static void* _tile_worker(void* arg) {
+    (void)arg;
+    TRACE_THREAD("tile worker");
+    int seen = 0;
+
+    _mutex_lock(&tileMutex);
+    while (1) {
+        while (tileGeneration == seen && !tileStopping) {
+            _cond_wait(&tileStart, &tileMutex);
+        }
+        if (tileStopping) break;
+        seen = tileGeneration;
+        _mutex_unlock(&tileMutex);
+
+        _rasterize_tiles();
+
+        _mutex_lock(&tileMutex);
+        // Hand this frame's counts to the frame loop
+        tileCounters.pixels += frameCounters.pixels;
+        tileCounters.spans += frameCounters.spans;
+        frameCounters.pixels = 0;
+        frameCounters.spans = 0;
+        if (--tileBusy == 0) {
+            _cond_signal(&tileDone);
+        }
+    }
+    _mutex_unlock(&tileMutex);
+    return NULL;
+}
+
+// Size the bins for the canvas and start recording if threads were requested
+static void _init_tile_renderer(void) {
+    if (!tileThreadsSet) {
+        const char* env = getenv("P5C_THREADS");
+        if (env) {
+            int count = atoi(env);
+            tileThreads = count > 0 ? count : _cpu_count();
+        }
+    }
+    if (tileThreads <= 1) return;
+
+    binCols = (width + BIN_TILE_SIZE - 1) >> BIN_TILE_SHIFT;
+    binRows = (height + BIN_TILE_SIZE - 1) >> BIN_TILE_SHIFT;
+    free(binStart);
+    free(binFill);
+    free(busyTiles);
+    binStart = (int*)malloc((binCols * binRows + 1) * sizeof(int));
+    binFill = (int*)malloc(binCols * binRows * sizeof(int));
+    busyTiles = (int*)malloc(binCols * binRows * sizeof(int));
+    if (!binStart || !binFill || !busyTiles) {
+        fprintf(stderr, "Failed to allocate tile bins\n");
+        exit(1);
+    }
+
+    if (!tileWorkers) {
+        tileWorkers = (P5Thread*)malloc((tileThreads - 1) * sizeof(P5Thread));
+        if (!tileWorkers) return;
+        _mutex_init(&tileMutex);
+        _cond_init(&tileStart);
+        _cond_init(&tileDone);
+        tileStopping = 0;
+        for (int i = 0; i < tileThreads - 1; i++) {
+            if (!_thread_start(&tileWorkers[tileWorkerCount], _tile_worker, NULL)) break;
+            tileWorkerCount++;
+        }
+    }
+
+    recordingCommands = 1;
+}
+
+// Bin the recorded commands into tiles; returns 0 if the bins cannot grow
+static int _bin_commands(void) {
+    int tiles = binCols * binRows;
+    memset(binStart, 0, (tiles + 1) * sizeof(int));
+
+    // Count commands per tile, then turn the counts into start offsets
+    for (int c = 0; c < commandCount; c++) {
+        const DrawCommand* cmd = &commands[c];
+        int tx0 = (cmd->x0 < 0 ? 0 : cmd->x0) >> BIN_TILE_SHIFT;
+        int ty0 = (cmd->y0 < 0 ? 0 : cmd->y0) >> BIN_TILE_SHIFT;
+        int tx1 = (cmd->x1 >= width ? width - 1 : cmd->x1) >> BIN_TILE_SHIFT;
+        int ty1 = (cmd->y1 >= height ? height - 1 : cmd->y1) >> BIN_TILE_SHIFT;
+        for (int ty = ty0; ty <= ty1; ty++) {
+            for (int tx = tx0; tx <= tx1; tx++) {
+                binStart[ty * binCols + tx + 1]++;
+            }
+        }
+    }
+    busyTileCount = 0;
+    for (int t = 0; t < tiles; t++) {
+        if (binStart[t + 1] > 0) busyTiles[busyTileCount++] = t;
+        binStart[t + 1] += binStart[t];
+    }
+
+    int items = binStart[tiles];
+    if (items > binItemCapacity) {
+        int* grown = (int*)realloc(binItems, items * sizeof(int));
+        if (!grown) return 0;
+        binItems = grown;
+        binItemCapacity = items;
+    }
+
+    // Fill the lists in submission order, which keeps every tile's painter order
+    memcpy(binFill, binStart, tiles * sizeof(int));
+    for (int c = 0; c < commandCount; c++) {
+        const DrawCommand* cmd = &commands[c];
+        int tx0 = (cmd->x0 < 0 ? 0 : cmd->x0) >> BIN_TILE_SHIFT;
+        int ty0 = (cmd->y0 < 0 ? 0 : cmd->y0) >> BIN_TILE_SHIFT;
+        int tx1 = (cmd->x1 >= width ? width - 1 : cmd->x1) >> BIN_TILE_SHIFT;
+        int ty1 = (cmd->y1 >= height ? height - 1 : cmd->y1) >> BIN_TILE_SHIFT;
+        for (int ty = ty0; ty <= ty1; ty++) {
+            for (int tx = tx0; tx <= tx1; tx++) {
+                binItems[binFill[ty * binCols + tx]++] = c;
+            }
+        }
+    }
+    return 1;
+}
+
+// Rasterize everything recorded so far into the framebuffer
+static void _flush_commands(void) {
+    if (!recordingCommands || commandCount == 0) return;
+
+    // The rasterizers must draw, not record, while the frame is replayed
+    recordingCommands = 0;
+
+    // The main thread rasterizes too; keep the sketch's style for after
+    Color savedFill = fillColor;
+    Color savedStroke = strokeColor;
+    uint8_t savedFillAlpha = fillAlpha;
+    uint8_t savedStrokeAlpha = strokeAlpha;
+    int savedUseFill = useFill;
+    int savedUseStroke = useStroke;
+    int savedWeight = strokeWeightValue;
+    int savedSmooth = useSmooth;
+
+    if (_bin_commands()) {
+        _mutex_lock(&tileMutex);
+        tileNext = 0;
+        tileBusy = tileWorkerCount;
+        tileGeneration++;
+        _cond_broadcast(&tileStart);
+        _mutex_unlock(&tileMutex);
+
+        _rasterize_tiles();
+
+        _mutex_lock(&tileMutex);
+        while (tileBusy > 0) {
+            _cond_wait(&tileDone, &tileMutex);
+        }
+        _mutex_unlock(&tileMutex);
+    } else {
+        // Out of memory for the bins: replay serially on the whole canvas
+        _reset_clip();
+        for (int c = 0; c < commandCount; c++) {
+            _execute_command(&commands[c]);
+        }
+    }
+
+    _reset_clip();
+    fillColor = savedFill;
+    strokeColor = savedStroke;
+    fillAlpha = savedFillAlpha;
+    strokeAlpha = savedStrokeAlpha;
+    useFill = savedUseFill;
+    useStroke = savedUseStroke;
+    strokeWeightValue = savedWeight;
+    useSmooth = savedSmooth;
+
+    commandCount = 0;
+    vertexCount = 0;
+    recordingCommands = 1;
+}
+
+// Stop the worker pool and release the command buffers
+static void _tile_shutdown(void) {
+    _flush_commands();
+    recordingCommands = 0;
+
+    if (tileWorkers) {
+        _mutex_lock(&tileMutex);
+        tileStopping = 1;
+        _cond_broadcast(&tileStart);
+        _mutex_unlock(&tileMutex);
+        for (int i = 0; i < tileWorkerCount; i++) {
+            _thread_join(tileWorkers[i]);
+        }
+        _cond_destroy(&tileStart);
+        _cond_destroy(&tileDone);
+        _mutex_destroy(&tileMutex);
+        free(tileWorkers);
+        tileWorkers = NULL;
+        tileWorkerCount = 0;
+    }
+
+    free(commands);
+    free(commandVertices);
+    free(binStart);
+    free(binFill);
+    free(binItems);
+    free(busyTiles);
+    commands = NULL;
+    commandVertices = NULL;
+    binStart = binFill = binItems = busyTiles = NULL;
+    commandCount = commandCapacity = 0;
+    vertexCount = vertexCapacity = 0;
+    binItemCapacity = 0;
+}
+
+// Rasterize with count threads (0 for one per CPU, 1 to draw immediately)
+void p5c_threads(int count) {
+    tileThreads = count > 0 ? count : _cpu_count();
+    tileThreadsSet = 1;
+}
+
+// Frame export: captured frames are copied into a ring of preallocated
+// buffers and encoded to PPM or QOI by a writer thread, so file I/O never
+// runs on the frame loop. The loop only waits when every buffer is in use.
+#define DEFAULT_EXPORT_RING_SIZE 8
+#define MAX_EXPORT_PATH 512
+
+typedef struct {
+    uint32_t* pixels;
+    size_t capacity; // Pixels the buffer holds
+    int width;
+    int height;
+    char path[MAX_EXPORT_PATH];
+} ExportSlot;
+
+static ExportSlot* exportSlots = NULL;
+static int exportRingSize = DEFAULT_EXPORT_RING_SIZE;
+static int exportHead = 0;  // Next slot the frame loop fills
+static int exportTail = 0;  // Next slot the writer encodes
+static int exportCount = 0; // Filled slots waiting for the writer
+static int exportStopping = 0;
+static int exportRunning = 0;
+static P5Thread exportThread;
+static P5Mutex exportMutex;
+static P5Cond exportNotEmpty;
+static P5Cond exportNotFull;
+static P5ExportStats exportStats;
+
+// Active saveFrames() sequence
+static char exportPattern[MAX_EXPORT_PATH];
+static int exportFramesLeft = 0;
+static int exportFrameIndex = 0;
+
+// Write the framebuffer as a binary PPM (P6)
+static int _write_ppm(FILE* f, const uint32_t* pixels, int w, int h) {
+    uint8_t* row = (uint8_t*)malloc((size_t)w * 3);
+    if (!row) return 0;
+
+    fprintf(f, "P6\n%d %d\n255\n", w, h);
+    for (int y = 0; y < h; y++) {
+        const uint32_t* src = pixels + (size_t)y * w;
+        for (int x = 0; x < w; x++) {
+            row[x * 3 + 0] = (uint8_t)(src[x] >> 16);
+            row[x * 3 + 1] = (uint8_t)(src[x] >> 8);
+            row[x * 3 + 2] = (uint8_t)src[x];
+        }
+        if (fwrite(row, 3, w, f) != (size_t)w) {
+            free(row);
+            return 0;
+        }
+    }
+
+    free(row);
+    return 1;
+}
+
+// Write the framebuffer as a 3-channel QOI image (https://qoiformat.org)
+static int _write_qoi(FILE* f, const uint32_t* pixels, int w, int h) {
+    size_t count = (size_t)w * h;
+    // Worst case is one 4-byte QOI_OP_RGB per pixel plus header and end marker
+    uint8_t* out = (uint8_t*)malloc(14 + count * 4 + 8);
+    if (!out) return 0;
+
+    size_t p = 0;
+    out[p++] = 'q'; out[p++] = 'o'; out[p++] = 'i'; out[p++] = 'f';
+    out[p++] = (uint8_t)(w >> 24); out[p++] = (uint8_t)(w >> 16);
+    out[p++] = (uint8_t)(w >> 8); out[p++] = (uint8_t)w;
+    out[p++] = (uint8_t)(h >> 24); out[p++] = (uint8_t)(h >> 16);
+    out[p++] = (uint8_t)(h >> 8); out[p++] = (uint8_t)h;
+    out[p++] = 3; // RGB
+    out[p++] = 0; // sRGB with linear alpha
+
+    uint32_t index[64] = {0};
+    uint32_t prev = 0xFF000000u;
+    int run = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        uint32_t px = pixels[i] | 0xFF000000u;
+
+        if (px == prev) {
+            run++;
+            if (run == 62 || i == count - 1) {
+                out[p++] = (uint8_t)(0xC0 | (run - 1)); // QOI_OP_RUN
+                run = 0;
+            }
+            continue;
+        }
+        if (run > 0) {
+            out[p++] = (uint8_t)(0xC0 | (run - 1));
+            run = 0;
+        }
+
+        int r = (px >> 16) & 0xFF, g = (px >> 8) & 0xFF, b = px & 0xFF;
+        int hash = (r * 3 + g * 5 + b * 7 + 255 * 11) % 64;
+
+        if (index[hash] == px) {
+            out[p++] = (uint8_t)hash; // QOI_OP_INDEX
+        } else {
+            index[hash] = px;
+
+            int dr = (int8_t)(r - (int)((prev >> 16) & 0xFF));
+            int dg = (int8_t)(g - (int)((prev >> 8) & 0xFF));
+            int db = (int8_t)(b - (int)(prev & 0xFF));
+            int drg = dr - dg;
+            int dbg = db - dg;
+
+            if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1) {
+                out[p++] = (uint8_t)(0x40 | ((dr + 2) << 4) | ((dg + 2) << 2) | (db + 2)); // QOI_OP_DIFF
+            } else if (dg >= -32 && dg <= 31 && drg >= -8 && drg <= 7 && dbg >= -8 && dbg <= 7) {
+                out[p++] = (uint8_t)(0x80 | (dg + 32)); // QOI_OP_LUMA
+                out[p++] = (uint8_t)(((drg + 8) << 4) | (dbg + 8));
+            } else {
+                out[p++] = 0xFE; // QOI_OP_RGB
+                out[p++] = (uint8_t)r;
+                out[p++] = (uint8_t)g;
+                out[p++] = (uint8_t)b;
+            }
+        }
+        prev = px;
+    }
+
+    static const uint8_t padding[8] = {0, 0, 0, 0, 0, 0, 0, 1};
+    memcpy(out + p, padding, sizeof(padding));
+    p += sizeof(padding);
+
+    int ok = fwrite(out, 1, p, f) == p;
+    free(out);
+    return ok;
+}
+
+// Encode one slot, picking the format from the file extension (PPM by default)
+static int _write_export_slot(const ExportSlot* slot) {
+    P5C_TRACE_ZONE("encode frame");
+    FILE* f = fopen(slot->path, "wb");
+    if (!f) {
+        fprintf(stderr, "p5c: cannot open %s for writing\n", slot->path);
+        return 0;
+    }
+
+    const char* ext = strrchr(slot->path, '.');
+    int ok;
+    if (ext && (strcmp(ext, ".qoi") == 0 || strcmp(ext, ".QOI") == 0)) {
+        ok = _write_qoi(f, slot->pixels, slot->width, slot->height);
+    } else {
+        ok = _write_ppm(f, slot->pixels, slot->width, slot->height);
+    }
+
+    if (fclose(f) != 0) ok = 0;
+    if (!ok) {
+        fprintf(stderr, "p5c: failed to write %s\n", slot->path);
+    }
+    return ok;
+}
+
+// Writer thread: encode queued frames until asked to stop and drained
+static void* _export_writer(void* arg) {
+    (void)arg;
+    TRACE_THREAD("export writer");
+
+    _mutex_lock(&exportMutex);
+    while (1) {
+        while (exportCount == 0 && !exportStopping) {
+            _cond_wait(&exportNotEmpty, &exportMutex);
+        }
+        if (exportCount == 0) break;
+
+        // The frame loop never touches a filled slot, so encode unlocked
+        ExportSlot* slot = &exportSlots[exportTail];
+        _mutex_unlock(&exportMutex);
+        int ok = _write_export_slot(slot);
+        _mutex_lock(&exportMutex);
+
+        if (ok) {
+            exportStats.framesWritten++;
+        } else {
+            exportStats.framesDropped++;
+        }
+        exportTail = (exportTail + 1) % exportRingSize;
+        exportCount--;
+        _cond_signal(&exportNotFull);
+    }
+    _mutex_unlock(&exportMutex);
+    return NULL;
+}
+
+// Allocate the ring and start the writer thread on first use
+static void _export_free_slots(void) {
+    if (!exportSlots) return;
+    for (int i = 0; i < exportRingSize; i++) {
+        free(exportSlots[i].pixels);
+    }
+    free(exportSlots);
+    exportSlots = NULL;
+}
+
+static int _export_start(void) {
+    if (exportRunning) return 1;
+    if (!framebuffer) return 0;
+
+    exportSlots = (ExportSlot*)calloc(exportRingSize, sizeof(ExportSlot));
+    if (!exportSlots) return 0;
+    size_t pixels = (size_t)width * height;
+    for (int i = 0; i < exportRingSize; i++) {
+        exportSlots[i].pixels = (uint32_t*)malloc(pixels * sizeof(uint32_t));
+        if (!exportSlots[i].pixels) {
+            fprintf(stderr, "p5c: failed to allocate export buffers\n");
+            _export_free_slots();
+            return 0;
+        }
+        exportSlots[i].capacity = pixels;
+    }
+
+    exportHead = exportTail = exportCount = 0;
+    exportStopping = 0;
+    _mutex_init(&exportMutex);
+    _cond_init(&exportNotEmpty);
+    _cond_init(&exportNotFull);
+    if (!_thread_start(&exportThread, _export_writer, NULL)) {
+        fprintf(stderr, "p5c: failed to start export thread\n");
+        _cond_destroy(&exportNotEmpty);
+        _cond_destroy(&exportNotFull);
+        _mutex_destroy(&exportMutex);
+        _export_free_slots();
+        return 0;
+    }
+    exportRunning = 1;
+    return 1;
+}
+
+// Copy the framebuffer into the next free ring slot and queue it for path
+static void _export_enqueue(const char* path) {
+    P5C_TRACE_ZONE("export capture");
+    if (!_export_start()) {
+        exportStats.framesDropped++;
+        return;
+    }
+
+    _mutex_lock(&exportMutex);
+    if (exportCount == exportRingSize) {
+        // Ring full: this is the only place the frame loop waits on disk I/O
+        uint64_t start = _monotonic_ns();
+        exportStats.stalls++;
+        while (exportCount == exportRingSize) {
+            _cond_wait(&exportNotFull, &exportMutex);
+        }
+        exportStats.stallSeconds += (_monotonic_ns() - start) * 1e-9;
+    }
+    ExportSlot* slot = &exportSlots[exportHead];
+    _mutex_unlock(&exportMutex);
+
+    // The writer only reads slots it has been handed, so copy unlocked. The
+    // target may be larger than when the ring was allocated: a layer being
+    // drawn into, or the canvas after size()
+    size_t pixels = (size_t)width * height;
+    if (pixels > slot->capacity) {
+        uint32_t* grown = (uint32_t*)realloc(slot->pixels, pixels * sizeof(uint32_t));
+        if (!grown) {
+            fprintf(stderr, "p5c: failed to allocate export buffers\n");
+            _mutex_lock(&exportMutex);
+            exportStats.framesDropped++;
+            _mutex_unlock(&exportMutex);
+            return;
+        }
+        slot->pixels = grown;
+        slot->capacity = pixels;
+    }
+    memcpy(slot->pixels, framebuffer, pixels * sizeof(uint32_t));
+    slot->width = width;
+    slot->height = height;
+    snprintf(slot->path, sizeof(slot->path), "%s", path);
+
+    _mutex_lock(&exportMutex);
+    exportHead = (exportHead + 1) % exportRingSize;
+    exportCount++;
+    exportStats.framesQueued++;
+    _cond_signal(&exportNotEmpty);
+    _mutex_unlock(&exportMutex);
+}
+
+// Called once per frame after draw(): capture the frame if a sequence is active
+static void _export_capture_frame(void) {
+    if (exportFramesLeft <= 0) return;
+
+    char path[MAX_EXPORT_PATH];
+    snprintf(path, sizeof(path), exportPattern, exportFrameIndex);
+    _export_enqueue(path);
+    exportFrameIndex++;
+    exportFramesLeft--;
+}
+
+// Flush queued frames, stop the writer and report how the ring coped
+static void _export_shutdown(void) {
+    exportFramesLeft = 0;
+    if (!exportRunning) return;
+
+    _mutex_lock(&exportMutex);
+    exportStopping = 1;
+    _cond_broadcast(&exportNotEmpty);
+    _mutex_unlock(&exportMutex);
+    _thread_join(exportThread);
+
+    _cond_destroy(&exportNotEmpty);
+    _cond_destroy(&exportNotFull);
+    _mutex_destroy(&exportMutex);
+    _export_free_slots();
+    exportRunning = 0;
+
+    if (exportStats.stalls > 0 || exportStats.framesDropped > 0) {
+        fprintf(stderr, "p5c: exported %d of %d frames, %d dropped, %d stalls (%.1f ms waiting for the writer)\n",
+                exportStats.framesWritten, exportStats.framesQueued, exportStats.framesDropped,
+                exportStats.stalls, exportStats.stallSeconds * 1000.0);
+    }
+}
+
+// Save the current canvas to path (.ppm or .qoi)
+void saveCanvas(const char* path) {
+    if (!path) return;
+    _flush_commands();
+    _export_enqueue(path);
+}
+
+// Save the next count frames, naming them with a printf pattern such as
+// "frames/frame_%04d.qoi" that receives the frame index starting at 0
+void saveFrames(const char* pattern, int count) {
+    if (!pattern || count <= 0) return;
+    snprintf(exportPattern, sizeof(exportPattern), "%s", pattern);
+    exportFramesLeft = count;
+    exportFrameIndex = 0;
+}
+
+// Number of frame buffers in the export ring (takes effect before the first save)
+void p5c_export_ring_size(int buffers) {
+    if (buffers > 0 && !exportRunning) {
+        exportRingSize = buffers;
+    }
+}
+
+P5ExportStats p5c_get_export_stats(void) {
+    P5ExportStats stats;
+    if (exportRunning) _mutex_lock(&exportMutex);
+    stats = exportStats;
+    if (exportRunning) _mutex_unlock(&exportMutex);
+    return stats;
+}
+
+// Video streaming: each frame is converted to I420 on the frame loop and
+// written as YUV4MPEG2 by a writer thread. Two I420 buffers alternate so the
+// next frame converts while the previous one is still being written.
+#define VIDEO_BUFFERS 2
+
+static int videoFd = -1;
+static int videoTried = 0; // Start attempted; failures are not retried every frame
+static int videoRunning = 0;
+static int videoFailed = 0;
+static int videoStopping = 0;
+static int videoWidth = 0;
+static int videoHeight = 0;
+static size_t videoFrameBytes = 0;
+static uint8_t* videoBuffers[VIDEO_BUFFERS];
+static int videoHead = 0;
+static int videoTail = 0;
+static int videoCount = 0;
+static P5Thread videoThread;
+static P5Mutex videoMutex;
+static P5Cond videoNotEmpty;
+static P5Cond videoNotFull;
+static P5ExportStats videoStats;
+
+// BT.601 limited-range luma for one pixel
+static inline uint8_t _rgb_to_y(uint32_t c) {
+    int r = (c >> 16) & 0xFF, g = (c >> 8) & 0xFF, b = c & 0xFF;
+    return (uint8_t)(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+}
+
+// Chroma from the summed channels of a 2x2 block (four samples)
+static inline uint8_t _sum_to_u(int r, int g, int b) {
+    return (uint8_t)(((-38 * r - 74 * g + 112 * b + 512) >> 10) + 128);
+}
+
+static inline uint8_t _sum_to_v(int r, int g, int b) {
+    return (uint8_t)(((112 * r - 94 * g - 18 * b + 512) >> 10) + 128);
+}
+
+// Scalar chroma for block column cx; edge blocks repeat the last row/column
+static void _chroma_block(const uint32_t* row0, const uint32_t* row1, int w, int cx, uint8_t* u, uint8_t* v) {
+    int x0 = cx * 2;
+    int x1 = x0 + 1 < w ? x0 + 1 : x0;
+    uint32_t p[4] = { row0[x0], row0[x1], row1[x0], row1[x1] };
+    int r = 0, g = 0, b = 0;
+    for (int i = 0; i < 4; i++) {
+        r += (p[i] >> 16) & 0xFF;
+        g += (p[i] >> 8) & 0xFF;
+        b += p[i] & 0xFF;
+    }
+    *u = _sum_to_u(r, g, b);
+    *v = _sum_to_v(r, g, b);
+}
+
+#ifdef P5C_SSE2
+// Sum the two 32-bit halves of each madd pair: [a0+a1, a2+a3, b0+b1, b2+b3]
+static inline __m128i _sum_pairs(__m128i a, __m128i b) {
+    __m128 even = _mm_shuffle_ps(_mm_castsi128_ps(a), _mm_castsi128_ps(b), _MM_SHUFFLE(2, 0, 2, 0));
+    __m128 odd = _mm_shuffle_ps(_mm_castsi128_ps(a), _mm_castsi128_ps(b), _MM_SHUFFLE(3, 1, 3, 1));
+    return _mm_add_epi32(_mm_castps_si128(even), _mm_castps_si128(odd));
+}
+
+// Luma for 4 pixels as 32-bit lanes
+static inline __m128i _luma4(__m128i px, __m128i coeff) {
+    __m128i zero = _mm_setzero_si128();
+    __m128i lo = _mm_madd_epi16(_mm_unpacklo_epi8(px, zero), coeff);
+    __m128i hi = _mm_madd_epi16(_mm_unpackhi_epi8(px, zero), coeff);
+    __m128i y = _sum_pairs(lo, hi);
+    return _mm_add_epi32(_mm_srli_epi32(_mm_add_epi32(y, _mm_set1_epi32(128)), 8), _mm_set1_epi32(16));
+}
+
+// Summed BGRA of two horizontally adjacent 2x2 blocks from 4+4 pixels
+static inline __m128i _block_sums(__m128i top, __m128i bottom) {
+    __m128i zero = _mm_setzero_si128();
+    __m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(top, zero), _mm_unpacklo_epi8(bottom, zero));
+    __m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(top, zero), _mm_unpackhi_epi8(bottom, zero));
+    lo = _mm_add_epi16(lo, _mm_shuffle_epi32(lo, _MM_SHUFFLE(1, 0, 3, 2)));
+    hi = _mm_add_epi16(hi, _mm_shuffle_epi32(hi, _MM_SHUFFLE(1, 0, 3, 2)));
+    return _mm_unpacklo_epi64(lo, hi);
+}
+
+// Chroma for 4 blocks as 32-bit lanes
+static inline __m128i _chroma4(__m128i s01, __m128i s23, __m128i coeff) {
+    __m128i c = _sum_pairs(_mm_madd_epi16(s01, coeff), _mm_madd_epi16(s23, coeff));
+    c = _mm_srai_epi32(_mm_add_epi32(c, _mm_set1_epi32(512)), 10);
+    return _mm_add_epi32(c, _mm_set1_epi32(128));
+}
+#endif
+
+// Convert a pair of framebuffer rows to I420; row1 may equal row0 on the last odd row
+static void _convert_rows_i420(const uint32_t* row0, const uint32_t* row1, int w, int hasRow1,
+                               uint8_t* y0, uint8_t* y1, uint8_t* u, uint8_t* v) {
+    int x = 0;
+#ifdef P5C_SSE2
+    // Coefficients in memory order B, G, R, A
+    const __m128i yCoeff = _mm_setr_epi16(25, 129, 66, 0, 25, 129, 66, 0);
+    const __m128i uCoeff = _mm_setr_epi16(112, -74, -38, 0, 112, -74, -38, 0);
+    const __m128i vCoeff = _mm_setr_epi16(-18, -94, 112, 0, -18, -94, 112, 0);
+
+    for (; x + 8 <= w; x += 8) {
+        __m128i a0 = _mm_loadu_si128((const __m128i*)(row0 + x));
+        __m128i a1 = _mm_loadu_si128((const __m128i*)(row0 + x + 4));
+        __m128i b0 = _mm_loadu_si128((const __m128i*)(row1 + x));
+        __m128i b1 = _mm_loadu_si128((const __m128i*)(row1 + x + 4));
+
+        __m128i ya = _mm_packs_epi32(_luma4(a0, yCoeff), _luma4(a1, yCoeff));
+        _mm_storel_epi64((__m128i*)(y0 + x), _mm_packus_epi16(ya, ya));
+        if (hasRow1) {
+            __m128i yb = _mm_packs_epi32(_luma4(b0, yCoeff), _luma4(b1, yCoeff));
+            _mm_storel_epi64((__m128i*)(y1 + x), _mm_packus_epi16(yb, yb));
+        }
+
+        __m128i s01 = _block_sums(a0, b0);
+        __m128i s23 = _block_sums(a1, b1);
+        __m128i uv = _mm_packs_epi32(_chroma4(s01, s23, uCoeff), _chroma4(s01, s23, vCoeff));
+        uv = _mm_packus_epi16(uv, uv);
+        uint32_t uBytes = (uint32_t)_mm_cvtsi128_si32(uv);
+        uint32_t vBytes = (uint32_t)_mm_cvtsi128_si32(_mm_srli_si128(uv, 4));
+        memcpy(u + x / 2, &uBytes, 4);
+        memcpy(v + x / 2, &vBytes, 4);
+    }
+#endif
+    for (int i = x; i < w; i++) {
+        y0[i] = _rgb_to_y(row0[i]);
+        if (hasRow1) y1[i] = _rgb_to_y(row1[i]);
+    }
+    for (int cx = x / 2; cx < (w + 1) / 2; cx++) {
+        _chroma_block(row0, row1, w, cx, &u[cx], &v[cx]);
+    }
+}
+
+// Convert the whole framebuffer to planar I420
+static void _convert_i420(const uint32_t* src, int w, int h, uint8_t* dst) {
+    int cw = (w + 1) / 2;
+    uint8_t* yPlane = dst;
+    uint8_t* uPlane = dst + (size_t)w * h;
+    uint8_t* vPlane = uPlane + (size_t)cw * ((h + 1) / 2);
+
+    for (int y = 0; y < h; y += 2) {
+        int hasRow1 = y + 1 < h;
+        const uint32_t* row0 = src + (size_t)y * w;
+        const uint32_t* row1 = hasRow1 ? row0 + w : row0;
+        _convert_rows_i420(row0, row1, w, hasRow1,
+                           yPlane + (size_t)y * w, yPlane + (size_t)(y + 1) * w,
+                           uPlane + (size_t)(y / 2) * cw, vPlane + (size_t)(y / 2) * cw);
+    }
+}
+
+// Write all bytes, waiting on the descriptor if it is non-blocking
+static int _write_all(int fd, const uint8_t* data, size_t size) {
+    while (size > 0) {
+#ifdef P5C_WINDOWS
+        int n = _write(fd, data, size > INT_MAX ? INT_MAX : (unsigned)size);
+        if (n < 0) return 0;
+#else
+        ssize_t n = write(fd, data, size);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                struct pollfd pfd = { fd, POLLOUT, 0 };
+                poll(&pfd, 1, -1);
+                continue;
+            }
+            return 0;
+        }
+#endif
+        data += n;
+        size -= (size_t)n;
+    }
+    return 1;
+}
+
+// Writer thread: send queued I420 frames to the descriptor
+static void* _video_writer(void* arg) {
+    (void)arg;
+    TRACE_THREAD("video writer");
+#ifndef P5C_WINDOWS
+    // A closed pipe should end the stream, not the process
+    sigset_t pipeSignal;
+    sigemptyset(&pipeSignal);
+    sigaddset(&pipeSignal, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &pipeSignal, NULL);
+#endif
+
+    char header[128];
+    int headerSize = snprintf(header, sizeof(header), "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C420jpeg\n",
+                              videoWidth, videoHeight, targetFrameRate);
+    int ok = _write_all(videoFd, (const uint8_t*)header, (size_t)headerSize);
+
+    _mutex_lock(&videoMutex);
+    while (1) {
+        while (videoCount == 0 && !videoStopping) {
+            _cond_wait(&videoNotEmpty, &videoMutex);
+        }
+        if (videoCount == 0) break;
+
+        const uint8_t* frame = videoBuffers[videoTail];
+        _mutex_unlock(&videoMutex);
+        if (ok) {
+            P5C_TRACE_ZONE("write frame");
+            ok = _write_all(videoFd, (const uint8_t*)"FRAME\n", 6) &&
+                 _write_all(videoFd, frame, videoFrameBytes);
+            if (!ok) fprintf(stderr, "p5c: video stream closed, dropping further frames\n");
+        }
+        _mutex_lock(&videoMutex);
+
+        if (ok) {
+            videoStats.framesWritten++;
+        } else {
+            videoStats.framesDropped++;
+            videoFailed = 1;
+        }
+        videoTail = (videoTail + 1) % VIDEO_BUFFERS;
+        videoCount--;
+        _cond_signal(&videoNotFull);
+    }
+    _mutex_unlock(&videoMutex);
+    return NULL;
+}
 
-            // Fill flat top triangle (v2, v4, v3)
-            slope1 = (float)(x3 - x2) / (y3 - y2);
-            slope2 = (float)(x3 - x4) / (y3 - y4);
-            x_start = x2;
-            x_end = x4;
+static void _video_free_buffers(void) {
+    for (int i = 0; i < VIDEO_BUFFERS; i++) {
+        free(videoBuffers[i]);
+        videoBuffers[i] = NULL;
+    }
+}
 
-            for (int y = y2 + 1; y <= y3; y++) {
-                for (int x = (int)x_start; x <= (int)x_end; x++) {
-                    _set_pixel(x, y, fillColor.r, fillColor.g, fillColor.b);
-                }
-                x_start += slope1;
-                x_end += slope2;
-            }
-        }
+// Close the stream, leaving stdin, stdout and stderr open
+static void _video_close_fd(void) {
+    if (videoFd > 2) {
+#ifdef P5C_WINDOWS
+        _close(videoFd);
+#else
+        close(videoFd);
+#endif
     }
+    videoFd = -1;
 }
 
-// Initialize the framebuffer
-static void _init_framebuffer(void) {
-    if (framebuffer) {
-        free(framebuffer);
+// Open the stream on the first frame, once the canvas size is known
+static int _video_start(void) {
+    if (videoRunning) return 1;
+    if (videoTried) return 0;
+    videoTried = 1;
+
+    // A file opened here is closed again if the stream cannot start
+    int opened = 0;
+    const char* env = getenv("P5C_Y4M");
+    if (videoFd < 0 && env && env[0]) {
+        opened = 1;
+        if (strcmp(env, "-") == 0) {
+            videoFd = 1;
+        } else {
+#ifdef P5C_WINDOWS
+            videoFd = _open(env, _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY, 0644);
+#else
+            videoFd = open(env, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+#endif
+            if (videoFd < 0) {
+                fprintf(stderr, "p5c: cannot open %s for video output\n", env);
+            }
+        }
     }
-    framebuffer = (uint32_t*)malloc(width * height * sizeof(uint32_t));
+    if (videoFd < 0) return 0;
     if (!framebuffer) {
-        fprintf(stderr, "Failed to allocate framebuffer\n");
-        exit(1);
+        if (opened) _video_close_fd();
+        return 0;
     }
-    _clear_framebuffer(0, 0, 0);
-}
+#ifdef P5C_WINDOWS
+    _setmode(videoFd, _O_BINARY);
+#endif
 
-// Clear the framebuffer with a specific color
-static void _clear_framebuffer(uint8_t r, uint8_t g, uint8_t b) {
-    printf("Clearing framebuffer with color (%d, %d, %d)\n", r, g, b);
-    if (!framebuffer) return;
+    videoWidth = width;
+    videoHeight = height;
+    videoFrameBytes = (size_t)width * height + 2 * (size_t)((width + 1) / 2) * ((height + 1) / 2);
+    for (int i = 0; i < VIDEO_BUFFERS; i++) {
+        videoBuffers[i] = (uint8_t*)malloc(videoFrameBytes);
+        if (!videoBuffers[i]) {
+            fprintf(stderr, "p5c: failed to allocate video buffers\n");
+            _video_free_buffers();
+            if (opened) _video_close_fd();
+            return 0;
+        }
+    }
 
-    uint32_t color = (0xFF << 24) | (r << 16) | (g << 8) | b;
-    printf("Framebuffer size: %d\n", width * height);
-    for (int i = 0; i < width * height; i++) {
-        framebuffer[i] = color;
+    videoHead = videoTail = videoCount = 0;
+    videoStopping = 0;
+    videoFailed = 0;
+    _mutex_init(&videoMutex);
+    _cond_init(&videoNotEmpty);
+    _cond_init(&videoNotFull);
+    if (!_thread_start(&videoThread, _video_writer, NULL)) {
+        fprintf(stderr, "p5c: failed to start video thread\n");
+        _cond_destroy(&videoNotEmpty);
+        _cond_destroy(&videoNotFull);
+        _mutex_destroy(&videoMutex);
+        _video_free_buffers();
+        if (opened) _video_close_fd();
+        return 0;
     }
-    printf("Framebuffer cleared\n");
+    videoRunning = 1;
+    return 1;
 }
 
-// Set a pixel in the framebuffer
-static void _set_pixel(int x, int y, uint8_t r, uint8_t g, uint8_t b) {
-    if (!framebuffer) return;
-
-    // Transform the point
-    float fx = (float)x;
-    float fy = (float)y;
-    _transform_point(&fx, &fy);
+// Called once per frame after draw(): convert and queue the frame
+static void _video_capture_frame(void) {
+    if (!_video_start()) return;
+    P5C_TRACE_ZONE("video capture");
+    _mutex_lock(&videoMutex);
+    if (videoFailed || width != videoWidth || height != videoHeight) {
+        videoStats.framesDropped++;
+        _mutex_unlock(&videoMutex);
+        return;
+    }
+    if (videoCount == VIDEO_BUFFERS) {
+        uint64_t start = _monotonic_ns();
+        videoStats.stalls++;
+        while (videoCount == VIDEO_BUFFERS) {
+            _cond_wait(&videoNotFull, &videoMutex);
+        }
+        videoStats.stallSeconds += (_monotonic_ns() - start) * 1e-9;
+    }
+    uint8_t* frame = videoBuffers[videoHead];
+    _mutex_unlock(&videoMutex);
 
-    // Convert back to integers
-    x = (int)(fx + 0.5f);
-    y = (int)(fy + 0.5f);
+    _convert_i420(framebuffer, width, height, frame);
 
-    // Bounds checking
-    if (x < 0 || x >= width || y < 0 || y >= height) return;
+    _mutex_lock(&videoMutex);
+    videoHead = (videoHead + 1) % VIDEO_BUFFERS;
+    videoCount++;
+    videoStats.framesQueued++;
+    _cond_signal(&videoNotEmpty);
+    _mutex_unlock(&videoMutex);
+}
 
-    uint32_t color = (0xFF << 24) | (r << 16) | (g << 8) | b;
-    framebuffer[y * width + x] = color;
+// Drain the stream and stop the writer thread
+static void _video_shutdown(void) {
+    if (!videoRunning) return;
+
+    _mutex_lock(&videoMutex);
+    videoStopping = 1;
+    _cond_broadcast(&videoNotEmpty);
+    _mutex_unlock(&videoMutex);
+    _thread_join(videoThread);
+
+    _cond_destroy(&videoNotEmpty);
+    _cond_destroy(&videoNotFull);
+    _mutex_destroy(&videoMutex);
+    _video_free_buffers();
+    _video_close_fd();
+    videoTried = 0;
+    videoRunning = 0;
+
+    if (videoStats.stalls > 0 || videoStats.framesDropped > 0) {
+        fprintf(stderr, "p5c: streamed %d of %d frames, %d dropped, %d stalls (%.1f ms waiting for the writer)\n",
+                videoStats.framesWritten, videoStats.framesQueued, videoStats.framesDropped,
+                videoStats.stalls, videoStats.stallSeconds * 1000.0);
+    }
 }
 
-// Math utilities
-float map(float value, float start1, float stop1, float start2, float stop2) {
-    return start2 + (stop2 - start2) * ((value - start1) / (stop1 - start1));
+// Stream every frame as YUV4MPEG2 to fd (e.g. 1 for stdout piped into ffmpeg)
+void p5c_stream_y4m(int fd) {
+    if (videoRunning) return;
+    videoFd = fd;
+    videoTried = 0;
 }
 
-// Check if a key is currently pressed
-int keyIsDown(char k) {
-    // For special keys (arrow keys, etc.)
-    if (k == ARROW_UP || k == ARROW_DOWN || k == ARROW_LEFT || k == ARROW_RIGHT) {
-        return specialKeyStates[(unsigned char)k];
-    }
+P5ExportStats p5c_get_video_stats(void) {
+    P5ExportStats stats;
+    if (videoRunning) _mutex_lock(&videoMutex);
+    stats = videoStats;
+    if (videoRunning) _mutex_unlock(&videoMutex);
+    return stats;
+}
 
-    // For regular ASCII keys
-    unsigned char index = (unsigned char)k;
-    return keyStates[index];
+// End of a frame: complete the framebuffer, then capture it for export.
+// The stats overlay goes on after the capture, so exported frames leave it out
+static void _finish_frame(void) {
+    P5C_TRACE_ZONE("finish frame");
+    endDraw();
+    _flush_commands();
+    _export_capture_frame();
+    _video_capture_frame();
+    _stats_mark(&statsDrawNs);
+    _draw_stats_overlay();
 }
 
-float randomf(float min, float max) {
-    return min + (max - min) * ((float)rand() / RAND_MAX);
+// Stop the background threads, finishing any work they have queued
+static void _stop_frame_workers(void) {
+    _tile_shutdown();
+    _export_shutdown();
+    _video_shutdown();
+#ifdef P5C_TRACE
+    _trace_flush();
+#endif
 }
 
-float constrain(float value, float min, float max) {
-    if (value < min) return min;
-    if (value > max) return max;
-    return value;
+// Render frames offscreen instead of opening a window
+void p5c_headless(int frames) {
+    headlessFrames = frames > 0 ? frames : 1;
 }
 
-float dist(float x1, float y1, float x2, float y2) {
-    float dx = x2 - x1;
-    float dy = y2 - y1;
-    return sqrt(dx * dx + dy * dy);
+// The framebuffer pixels (width * height, 0xAARRGGBB, row-major)
+const uint32_t* p5c_get_pixels(void) {
+    _flush_commands();
+    return framebuffer;
 }
 
-// Set the angle mode (RADIANS or DEGREES)
-void angleMode(int mode) {
-    if (mode == RADIANS || mode == DEGREES) {
-        currentAngleMode = mode;
+// Headless mode is requested by p5c_headless(), by P5C_HEADLESS=<frames>
+// in the environment, or by building the library with -DP5C_HEADLESS
+static int _headless_requested(void) {
+    const char* env = getenv("P5C_HEADLESS");
+    if (env && headlessFrames == 0) {
+        p5c_headless(atoi(env));
     }
+#ifdef P5C_HEADLESS
+    if (headlessFrames == 0) {
+        p5c_headless(1);
+    }
+#endif
+    return headlessFrames > 0;
 }
 
-// Matrix functions
-static void _init_matrix(Matrix* m) {
-    // Initialize to identity matrix
-    memset(m->m, 0, sizeof(m->m));
-    m->m[0][0] = 1.0f;
-    m->m[1][1] = 1.0f;
-    m->m[2][2] = 1.0f;
+static void _discard_rect(int x, int y, int w, int h) {
+    (void)x; (void)y; (void)w; (void)h;
 }
 
-static void _transform_point(float* x, float* y) {
-    float tx = *x * currentMatrix.m[0][0] + *y * currentMatrix.m[0][1] + currentMatrix.m[0][2];
-    float ty = *x * currentMatrix.m[1][0] + *y * currentMatrix.m[1][1] + currentMatrix.m[1][2];
-    *x = tx;
-    *y = ty;
-}
+// Run setup() and draw() into the framebuffer with no window, no input and
+// no frame pacing. The framebuffer stays valid after returning so the
+// caller can read the final frame through p5c_get_pixels().
+static int _run_headless(void) {
+    _setup = setup;
+    _draw = draw;
+    _pacer_start(1);
 
-void resetMatrix(void) {
-    _init_matrix(&currentMatrix);
-}
+    // Initialize random seed
+    srand((unsigned int)time(NULL));
 
-void push(void) {
-    if (matrixStackSize >= MAX_MATRIX_STACK) {
-        fprintf(stderr, "Error: Matrix stack overflow\n");
-        return;
+    // setup() may draw, so the framebuffer exists before it runs
+    _init_framebuffer();
+
+    // Call user setup function
+    if (_setup) {
+        _setup();
     }
-    memcpy(&matrixStack[matrixStackSize], &currentMatrix, sizeof(Matrix));
-    matrixStackSize++;
-}
 
-void pop(void) {
-    if (matrixStackSize <= 0) {
-        fprintf(stderr, "Error: Matrix stack underflow\n");
-        return;
+    // Start tiled rendering if setup() called p5c_threads()
+    _init_tile_renderer();
+
+    // Initialize matrix
+    resetMatrix();
+
+    while (frameCount < headlessFrames) {
+        _pacer_begin_frame();
+        _stats_begin_frame();
+
+        // Call user draw function
+        if (_draw) {
+            P5C_TRACE_ZONE("draw");
+            _draw();
+        }
+
+        // Rasterize deferred drawing and hand the frame to the exporters
+        _finish_frame();
+
+        // Nothing to present: just reset dirty tracking for the next frame
+        _present_dirty_rects(_discard_rect);
+        _stats_presented();
+
+        frameCount++;
     }
-    matrixStackSize--;
-    memcpy(&currentMatrix, &matrixStack[matrixStackSize], sizeof(Matrix));
+    _stats_close_frame(_monotonic_ns());
+
+    // Finish rasterizing and writing exported frames before returning
+    _stop_frame_workers();
+    return 0;
 }
 
-void translate(float x, float y) {
-    currentMatrix.m[0][2] += x * currentMatrix.m[0][0] + y * currentMatrix.m[0][1];
-    currentMatrix.m[1][2] += x * currentMatrix.m[1][0] + y * currentMatrix.m[1][1];
+#ifdef P5C_HEADLESS
+
+int run(void) {
+    _headless_requested();
+    return _run_headless();
 }
 
+#endif /* P5C_HEADLESS */
+
 // Platform-specific window creation and main loop
-#ifdef P5C_WINDOWS
+#ifdef P5C_WIN32_BACKEND
 
 // Windows implementation
 LRESULT CALLBACK WindowProc(HWND hwnd, UINT uMsg, WPARAM wParam, LPARAM lParam) {
@@ -721,22 +4944,45 @@ LRESULT CALLBACK WindowProc(HWND hwnd, UINT uMsg, WPARAM wParam, LPARAM lParam)
     return DefWindowProc(hwnd, uMsg, wParam, lParam);
 }
 
+// Record whether anything changed; the blit below always covers the full canvas
+static int framebufferChanged = 0;
+
+static void _note_dirty_rect(int x, int y, int w, int h) {
+    (void)x; (void)y; (void)w; (void)h;
+    framebufferChanged = 1;
+}
+
 static void _render_framebuffer(void) {
+    P5C_TRACE_ZONE("present");
+    // Skip the blit entirely when the frame did not touch the canvas
+    framebufferChanged = 0;
+    _present_dirty_rects(_note_dirty_rect);
+    if (!framebufferChanged) return;
+
     StretchDIBits(hdc, 0, 0, width, height, 0, 0, width, height,
                  framebuffer, &bmi, DIB_RGB_COLORS, SRCCOPY);
 }
 
 int run(void) {
+    if (_headless_requested()) {
+        return _run_headless();
+    }
+
     _setup = setup;
     _draw = draw;
+    _pacer_start(0);
 
     // Initialize random seed
     srand((unsigned int)time(NULL));
-    
+
+    // setup() may draw, so the framebuffer exists before it runs
+    _init_framebuffer();
+
     // Call user setup function
     if (_setup) {
         _setup();
     }
+    canvasPresented = 1;
 
     // Register window class
     WNDCLASS wc = {0};
@@ -779,19 +5025,23 @@ int run(void) {
     bmi.bmiHeader.biBitCount = 32;
     bmi.bmiHeader.biCompression = BI_RGB;
 
-    // Initialize framebuffer
-    _init_framebuffer();
+    // Start tiled rendering if setup() called p5c_threads()
+    _init_tile_renderer();
 
     // Initialize matrix
     resetMatrix();
 
 
+    // Sleep() otherwise rounds up to the 15.6 ms system tick
+    timeBeginPeriod(1);
+
     // Main loop
+    _pacer_first_frame();
     MSG msg;
-    DWORD lastFrameTime = GetTickCount();
-    DWORD targetFrameTime = 1000 / targetFrameRate;
-
     while (1) {
+        // Wait for the next frame's deadline
+        _pacer_wait(-1);
+
         // Process all pending messages
         while (PeekMessage(&msg, NULL, 0, 0, PM_REMOVE)) {
             if (msg.message == WM_QUIT) {
@@ -801,66 +5051,367 @@ int run(void) {
             DispatchMessage(&msg);
         }
 
-        // Calculate frame timing
-        DWORD currentTime = GetTickCount();
-        DWORD elapsedTime = currentTime - lastFrameTime;
+        _pacer_begin_frame();
+        _stats_begin_frame();
 
-        if (elapsedTime >= targetFrameTime) {
-            // Call user draw function
-            if (_draw) {
-                _draw();
-            }
+        // Call user draw function
+        if (_draw) {
+            P5C_TRACE_ZONE("draw");
+            _draw();
+        }
 
-            // Render the framebuffer to the screen
-            _render_framebuffer();
+        // Rasterize deferred drawing and hand the frame to the exporters
+        _finish_frame();
 
-            // Update frame count and time
-            frameCount++;
-            lastFrameTime = currentTime;
-        } else {
-            // Sleep to save CPU
-            Sleep(1);
-        }
+        // Render the framebuffer to the screen
+        _render_framebuffer();
+        _stats_presented();
+
+        frameCount++;
     }
 
 cleanup:
     // Clean up
-    if (framebuffer) {
-        free(framebuffer);
-        framebuffer = NULL;
-    }
+    timeEndPeriod(1);
+    _stop_frame_workers();
+    _free_framebuffer();
     ReleaseDC(hwnd, hdc);
     return 0;
 }
 
-#endif /* P5C_WINDOWS */
+#endif /* P5C_WIN32_BACKEND */
 
-#ifdef P5C_LINUX
+#ifdef P5C_X11_BACKEND
 
 // X11 implementation
+
+// Pixel formats of X visuals. The framebuffer is 0xAARRGGBB in host byte
+// order, which a 24- or 32-bit TrueColor visual with those masks shows as
+// is. Any other layout gets an XImage buffer of its own, and each dirty
+// rectangle is converted into it when the frame is presented.
+#define PIXEL_FORMAT_NATIVE  0 // 32 bpp 0xRRGGBB: no conversion
+#define PIXEL_FORMAT_BGR32   1 // 32 bpp 0xBBGGRR
+#define PIXEL_FORMAT_RGB24   2 // 24 bpp packed, blue byte first
+#define PIXEL_FORMAT_RGB565  3 // 16 bpp, 5-6-5 with red on top
+#define PIXEL_FORMAT_GENERIC 4 // Anything else, one pixel at a time
+
+typedef struct {
+    int kind;
+    int bytesPerPixel;
+    int msbFirst;          // Pixel bytes stored most significant first
+    int shift[3], bits[3]; // Red, green and blue fields of the pixel value
+} PixelFormat;
+
+static PixelFormat pixelFormat;
+
+// Position and width of the contiguous field of set bits in mask
+static void _mask_field(unsigned long mask, int* shift, int* bits) {
+    *shift = 0;
+    *bits = 0;
+    if (!mask) return;
+    while (!(mask & 1)) {
+        mask >>= 1;
+        (*shift)++;
+    }
+    while (mask & 1) {
+        mask >>= 1;
+        (*bits)++;
+    }
+}
+
+// Describe a ZPixmap layout, picking a dedicated kernel when there is one
+static PixelFormat _pixel_format(int bitsPerPixel, unsigned long redMask, unsigned long greenMask,
+                                 unsigned long blueMask, int msbFirst) {
+    PixelFormat f;
+    f.kind = PIXEL_FORMAT_GENERIC;
+    f.bytesPerPixel = (bitsPerPixel + 7) / 8;
+    f.msbFirst = msbFirst;
+    _mask_field(redMask, &f.shift[0], &f.bits[0]);
+    _mask_field(greenMask, &f.shift[1], &f.bits[1]);
+    _mask_field(blueMask, &f.shift[2], &f.bits[2]);
+
+    // Whole-pixel stores need the server's byte order to be ours
+    const uint16_t probe = 1;
+    int hostMsbFirst = *(const uint8_t*)&probe == 0;
+    int rgb = redMask == 0xFF0000 && greenMask == 0xFF00 && blueMask == 0xFF;
+    if (msbFirst == hostMsbFirst) {
+        if (bitsPerPixel == 32 && rgb) {
+            f.kind = PIXEL_FORMAT_NATIVE;
+        } else if (bitsPerPixel == 32 && redMask == 0xFF && greenMask == 0xFF00 && blueMask == 0xFF0000) {
+            f.kind = PIXEL_FORMAT_BGR32;
+        } else if (bitsPerPixel == 16 && redMask == 0xF800 && greenMask == 0x07E0 && blueMask == 0x001F) {
+            f.kind = PIXEL_FORMAT_RGB565;
+        }
+    }
+    // Packed 24-bit pixels are written byte by byte whatever the host order
+    if (bitsPerPixel == 24 && rgb && !msbFirst) {
+        f.kind = PIXEL_FORMAT_RGB24;
+    }
+    return f;
+}
+
+// Any layout: scale each channel to its field and store the bytes in the
+// image's order
+static void _convert_generic(const PixelFormat* f, uint8_t* dst, const uint32_t* src, int n) {
+    for (int i = 0; i < n; i++) {
+        uint32_t p = src[i];
+        uint32_t value = 0;
+        for (int c = 0; c < 3; c++) {
+            uint32_t channel = (p >> (16 - 8 * c)) & 0xFF;
+            int bits = f->bits[c];
+            // Wider fields repeat the top bits so that 255 stays full
+            channel = bits <= 8 ? channel >> (8 - bits) : (channel << (bits - 8)) | (channel >> (16 - bits));
+            value |= channel << f->shift[c];
+        }
+        for (int b = 0; b < f->bytesPerPixel; b++) {
+            int byte = f->msbFirst ? f->bytesPerPixel - 1 - b : b;
+            *dst++ = (uint8_t)(value >> (8 * byte));
+        }
+    }
+}
+
+static void _convert_bgr32(uint8_t* dst, const uint32_t* src, int n) {
+    uint32_t* out = (uint32_t*)dst;
+    int i = 0;
+#ifdef P5C_SSE2
+    const __m128i keep = _mm_set1_epi32(0x0000FF00);
+    const __m128i swap = _mm_set1_epi32(0x00FF00FF);
+    for (; i + 4 <= n; i += 4) {
+        __m128i p = _mm_loadu_si128((const __m128i*)(src + i));
+        __m128i rb = _mm_and_si128(p, swap);
+        rb = _mm_or_si128(_mm_srli_epi32(rb, 16), _mm_slli_epi32(rb, 16));
+        _mm_storeu_si128((__m128i*)(out + i), _mm_or_si128(_mm_and_si128(p, keep), rb));
+    }
+#endif
+    for (; i < n; i++) {
+        uint32_t p = src[i];
+        out[i] = (p & 0xFF00) | ((p >> 16) & 0xFF) | ((p & 0xFF) << 16);
+    }
+}
+
+#ifdef P5C_SSE2
+// Four 0xRRGGBB pixels as 5-6-5 values in the low half of each lane
+static inline __m128i _rgb565_4(__m128i p) {
+    __m128i r = _mm_and_si128(_mm_srli_epi32(p, 8), _mm_set1_epi32(0xF800));
+    __m128i g = _mm_and_si128(_mm_srli_epi32(p, 5), _mm_set1_epi32(0x07E0));
+    __m128i b = _mm_and_si128(_mm_srli_epi32(p, 3), _mm_set1_epi32(0x001F));
+    __m128i v = _mm_or_si128(_mm_or_si128(r, g), b);
+    // Sign-extend so the saturating pack keeps all 16 bits
+    return _mm_srai_epi32(_mm_slli_epi32(v, 16), 16);
+}
+#endif
+
+static void _convert_rgb565(uint8_t* dst, const uint32_t* src, int n) {
+    uint16_t* out = (uint16_t*)dst;
+    int i = 0;
+#ifdef P5C_SSE2
+    for (; i + 8 <= n; i += 8) {
+        __m128i lo = _rgb565_4(_mm_loadu_si128((const __m128i*)(src + i)));
+        __m128i hi = _rgb565_4(_mm_loadu_si128((const __m128i*)(src + i + 4)));
+        _mm_storeu_si128((__m128i*)(out + i), _mm_packs_epi32(lo, hi));
+    }
+#endif
+    for (; i < n; i++) {
+        uint32_t p = src[i];
+        out[i] = (uint16_t)(((p >> 8) & 0xF800) | ((p >> 5) & 0x07E0) | ((p >> 3) & 0x001F));
+    }
+}
+
+#ifdef P5C_SSSE3
+// Drop every fourth byte with one shuffle per 4 pixels. Each store writes
+// 16 bytes of which the next one overwrites the last 4, so the loop stops
+// while 16 bytes of the row are still left.
+__attribute__((target("ssse3")))
+static int _convert_rgb24_ssse3(uint8_t* dst, const uint32_t* src, int n) {
+    const __m128i pack = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+    int i = 0;
+    for (; i + 6 <= n; i += 4) {
+        __m128i p = _mm_loadu_si128((const __m128i*)(src + i));
+        _mm_storeu_si128((__m128i*)(dst + 3 * i), _mm_shuffle_epi8(p, pack));
+    }
+    return i;
+}
+#endif
+
+static void _convert_rgb24(uint8_t* dst, const uint32_t* src, int n) {
+    int i = 0;
+#ifdef P5C_SSSE3
+    if (__builtin_cpu_supports("ssse3")) {
+        i = _convert_rgb24_ssse3(dst, src, n);
+    }
+#endif
+    for (; i < n; i++) {
+        uint32_t p = src[i];
+        dst[3 * i] = (uint8_t)p;
+        dst[3 * i + 1] = (uint8_t)(p >> 8);
+        dst[3 * i + 2] = (uint8_t)(p >> 16);
+    }
+}
+
+// Convert n framebuffer pixels into the image layout f
+static void _convert_pixels(const PixelFormat* f, uint8_t* dst, const uint32_t* src, int n) {
+    switch (f->kind) {
+        case PIXEL_FORMAT_NATIVE:
+            memcpy(dst, src, (size_t)n * sizeof(uint32_t));
+            break;
+        case PIXEL_FORMAT_BGR32:
+            _convert_bgr32(dst, src, n);
+            break;
+        case PIXEL_FORMAT_RGB24:
+            _convert_rgb24(dst, src, n);
+            break;
+        case PIXEL_FORMAT_RGB565:
+            _convert_rgb565(dst, src, n);
+            break;
+        default:
+            _convert_generic(f, dst, src, n);
+            break;
+    }
+}
+
+// The layout of an XImage of the canvas size
+static PixelFormat _ximage_pixel_format(const XImage* image) {
+    PixelFormat f = _pixel_format(image->bits_per_pixel, image->red_mask, image->green_mask,
+                                  image->blue_mask, image->byte_order == MSBFirst);
+    // Padded rows cannot be the framebuffer itself
+    if (f.kind == PIXEL_FORMAT_NATIVE && image->bytes_per_line != width * 4) {
+        f.kind = PIXEL_FORMAT_GENERIC;
+    }
+    return f;
+}
+static int shmAttachFailed = 0;
+
+static int _shm_error_handler(Display* d, XErrorEvent* e) {
+    (void)d;
+    (void)e;
+    shmAttachFailed = 1;
+    return 0;
+}
+
+// Create a shared memory XImage and, when it has the framebuffer's layout,
+// make its pixels the framebuffer. Returns 0 when MIT-SHM is unavailable
+// (e.g. a remote display) so the caller can fall back to XPutImage.
+static int _init_shm_image(Visual* visual, int depth) {
+    if (getenv("P5C_NO_SHM") || !XShmQueryExtension(display)) return 0;
+
+    ximage = XShmCreateImage(display, visual, depth, ZPixmap, NULL, &shmInfo, width, height);
+    if (!ximage) return 0;
+
+    // The segment becomes the framebuffer when the layouts match, and the
+    // target of the conversion otherwise
+    pixelFormat = _ximage_pixel_format(ximage);
+
+    shmInfo.shmid = shmget(IPC_PRIVATE, (size_t)ximage->bytes_per_line * height, IPC_CREAT | 0600);
+    if (shmInfo.shmid < 0) {
+        XDestroyImage(ximage);
+        ximage = NULL;
+        return 0;
+    }
+    shmInfo.shmaddr = ximage->data = (char*)shmat(shmInfo.shmid, NULL, 0);
+    shmInfo.readOnly = False;
+
+    // Attaching fails asynchronously when the server cannot see our memory
+    shmAttachFailed = 0;
+    int (*previousHandler)(Display*, XErrorEvent*) = XSetErrorHandler(_shm_error_handler);
+    if (shmInfo.shmaddr != (char*)-1) {
+        XShmAttach(display, &shmInfo);
+    } else {
+        shmAttachFailed = 1;
+    }
+    XSync(display, False);
+    XSetErrorHandler(previousHandler);
+
+    // Mark the segment for removal now so it cannot leak if we crash
+    shmctl(shmInfo.shmid, IPC_RMID, NULL);
+
+    if (shmAttachFailed) {
+        if (shmInfo.shmaddr != (char*)-1) shmdt(shmInfo.shmaddr);
+        ximage->data = NULL;
+        XDestroyImage(ximage);
+        ximage = NULL;
+        return 0;
+    }
+
+    useShm = 1;
+    shmCompletionType = XShmGetEventBase(display) + ShmCompletion;
+    if (pixelFormat.kind == PIXEL_FORMAT_NATIVE) {
+        _adopt_framebuffer((uint32_t*)shmInfo.shmaddr);
+    }
+    return 1;
+}
+
+static Bool _is_shm_completion(Display* d, XEvent* event, XPointer arg) {
+    (void)d;
+    (void)arg;
+    return event->type == shmCompletionType;
+}
+
+// Block until the X server has finished reading the shared framebuffer
+static void _wait_for_present(void) {
+    if (shmPending == 0) return;
+    P5C_TRACE_ZONE("present wait");
+    uint64_t start = _monotonic_ns();
+    while (shmPending > 0) {
+        XEvent event;
+        XIfEvent(display, &event, _is_shm_completion, NULL);
+        shmPending--;
+    }
+    statsPresentNs += _monotonic_ns() - start;
+}
+
+// Upload one dirty region of the framebuffer, converting it first when the
+// image has a layout of its own
+static void _put_rect(int x, int y, int w, int h) {
+    if (pixelFormat.kind != PIXEL_FORMAT_NATIVE) {
+        for (int row = y; row < y + h; row++) {
+            uint8_t* dst = (uint8_t*)ximage->data + (size_t)row * ximage->bytes_per_line + x * pixelFormat.bytesPerPixel;
+            _convert_pixels(&pixelFormat, dst, framebuffer + (size_t)row * width + x, w);
+        }
+    }
+    if (useShm) {
+        XShmPutImage(display, window, gc, ximage, x, y, x, y, w, h, True);
+        shmPending++;
+    } else {
+        XPutImage(display, window, gc, ximage, x, y, x, y, w, h);
+    }
+}
+
 static void _render_framebuffer(void) {
+    P5C_TRACE_ZONE("present");
     if (!ximage || !framebuffer) return;
 
-    // Update the XImage data
-    ximage->data = (char*)framebuffer;
+    // The image shows the framebuffer itself unless it is converted
+    if (pixelFormat.kind == PIXEL_FORMAT_NATIVE) {
+        ximage->data = (char*)framebuffer;
+    }
 
-    // Put the image on the window
-    XPutImage(display, window, gc, ximage, 0, 0, 0, 0, width, height);
-    XFlush(display);
+    // Put only the regions drawn since the last present on the window
+    if (_present_dirty_rects(_put_rect) > 0) {
+        XFlush(display);
+    }
 }
 
 int run(void) {
+    if (_headless_requested()) {
+        return _run_headless();
+    }
+
     _setup = setup;
     _draw = draw;
+    _pacer_start(0);
     
     // Initialize random seed
     srand((unsigned int)time(NULL));
-    
+
+    // setup() may draw, so the framebuffer exists before it runs
+    _init_framebuffer();
+
     // Call user setup function
     if (_setup) {
         _setup();
     }
-    
+    canvasPresented = 1;
+
     // Open display
     display = XOpenDisplay(NULL);
     if (!display) {
@@ -900,15 +5451,31 @@ int run(void) {
     Visual* visual = DefaultVisual(display, screen);
     int depth = DefaultDepth(display, screen);
 
-    // Initialize framebuffer
-    _init_framebuffer();
-
     // Initialize matrix
     resetMatrix();
 
-    // Create XImage
-    ximage = XCreateImage(display, visual, depth, ZPixmap, 0,
-                         (char*)framebuffer, width, height, 32, width * 4);
+    if (visual->class != TrueColor && visual->class != DirectColor) {
+        fprintf(stderr, "The default visual is not TrueColor; colors will be wrong\n");
+    }
+
+    // Prefer a shared memory image the server reads in place; otherwise
+    // keep the framebuffer setup() drew into and copy it over the socket. Xlib
+    // picks the bits per pixel and row length of the visual's depth.
+    if (!_init_shm_image(visual, depth)) {
+        ximage = XCreateImage(display, visual, depth, ZPixmap, 0, NULL, width, height, 32, 0);
+        if (ximage) {
+            pixelFormat = _ximage_pixel_format(ximage);
+            if (pixelFormat.kind == PIXEL_FORMAT_NATIVE) {
+                ximage->data = (char*)framebuffer;
+            } else {
+                ximage->data = (char*)malloc((size_t)ximage->bytes_per_line * height);
+                if (!ximage->data) {
+                    XDestroyImage(ximage);
+                    ximage = NULL;
+                }
+            }
+        }
+    }
 
     if (!ximage) {
         fprintf(stderr, "Failed to create XImage\n");
@@ -917,116 +5484,137 @@ int run(void) {
         return 1;
     }
 
+    // Start tiled rendering if setup() called p5c_threads()
+    _init_tile_renderer();
+
 
     // Main loop
+    _pacer_first_frame();
     XEvent event;
-    struct timespec lastFrameTime, currentTime, sleepTime;
-    clock_gettime(CLOCK_MONOTONIC, &lastFrameTime);
-    long targetFrameTime = 1000000000 / targetFrameRate; // in nanoseconds
-
     while (1) {
-        // Process all pending events
-        while (XPending(display)) {
-            XNextEvent(display, &event);
-
-            switch (event.type) {
-                case Expose:
-                    _render_framebuffer();
-                    break;
-                case ClientMessage:
-                    if ((Atom)event.xclient.data.l[0] == wm_delete_window) {
-                        goto cleanup;
-                    }
-                    break;
-                case MotionNotify:
-                    mouseX = event.xmotion.x;
-                    mouseY = event.xmotion.y;
-                    break;
-                case ButtonPress:
-                    if (event.xbutton.button == Button1) {
-                        mousePressed = 1;
-                    }
-                    break;
-                case ButtonRelease:
-                    if (event.xbutton.button == Button1) {
-                        mousePressed = 0;
-                    }
-                    break;
-                case KeyPress:
-                    keyPressed = 1;
-                    {
-                        KeySym keysym = XLookupKeysym(&event.xkey, 0);
-
-                        // Check for special keys (arrow keys)
-                        if (keysym == XK_Up || keysym == XK_Down || keysym == XK_Left || keysym == XK_Right) {
-                            // Map X11 keysyms to our arrow key constants
-                            if (keysym == XK_Up) specialKeyStates[ARROW_UP] = 1;
-                            if (keysym == XK_Down) specialKeyStates[ARROW_DOWN] = 1;
-                            if (keysym == XK_Left) specialKeyStates[ARROW_LEFT] = 1;
-                            if (keysym == XK_Right) specialKeyStates[ARROW_RIGHT] = 1;
-                        } else {
-                            // Regular ASCII key
-                            key = keysym & 0xFF;
-                            keyStates[(unsigned char)key] = 1;
+        // Sleep on the X connection until the next frame is due, handling
+        // events as soon as they arrive. XPending() also drains events
+        // Xlib has already read while waiting for shared memory uploads.
+        do {
+            P5C_TRACE_ZONE("events");
+            while (XPending(display)) {
+                XNextEvent(display, &event);
+
+                // Completions of earlier shared memory uploads
+                if (useShm && event.type == shmCompletionType) {
+                    if (shmPending > 0) shmPending--;
+                    continue;
+                }
+
+                switch (event.type) {
+                    case Expose:
+                        // The window contents were lost, not just the dirty regions
+                        _mark_all_dirty();
+                        _render_framebuffer();
+                        break;
+                    case ClientMessage:
+                        if ((Atom)event.xclient.data.l[0] == wm_delete_window) {
+                            goto cleanup;
+                        }
+                        break;
+                    case MotionNotify:
+                        mouseX = event.xmotion.x;
+                        mouseY = event.xmotion.y;
+                        break;
+                    case ButtonPress:
+                        if (event.xbutton.button == Button1) {
+                            mousePressed = 1;
+                        }
+                        break;
+                    case ButtonRelease:
+                        if (event.xbutton.button == Button1) {
+                            mousePressed = 0;
                         }
-                    }
-                    break;
-                case KeyRelease:
-                    keyPressed = 0;
-                    {
-                        KeySym keysym = XLookupKeysym(&event.xkey, 0);
-
-                        // Check for special keys (arrow keys)
-                        if (keysym == XK_Up || keysym == XK_Down || keysym == XK_Left || keysym == XK_Right) {
-                            // Map X11 keysyms to our arrow key constants
-                            if (keysym == XK_Up) specialKeyStates[ARROW_UP] = 0;
-                            if (keysym == XK_Down) specialKeyStates[ARROW_DOWN] = 0;
-                            if (keysym == XK_Left) specialKeyStates[ARROW_LEFT] = 0;
-                            if (keysym == XK_Right) specialKeyStates[ARROW_RIGHT] = 0;
-                        } else {
-                            // Regular ASCII key - use the key that was released (keysym), not the last pressed key
-                            unsigned char released_key = keysym & 0xFF;
-                            keyStates[released_key] = 0;
+                        break;
+                    case KeyPress:
+                        keyPressed = 1;
+                        {
+                            KeySym keysym = XLookupKeysym(&event.xkey, 0);
+
+                            // Check for special keys (arrow keys)
+                            if (keysym == XK_Up || keysym == XK_Down || keysym == XK_Left || keysym == XK_Right) {
+                                // Map X11 keysyms to our arrow key constants
+                                if (keysym == XK_Up) specialKeyStates[ARROW_UP] = 1;
+                                if (keysym == XK_Down) specialKeyStates[ARROW_DOWN] = 1;
+                                if (keysym == XK_Left) specialKeyStates[ARROW_LEFT] = 1;
+                                if (keysym == XK_Right) specialKeyStates[ARROW_RIGHT] = 1;
+                            } else {
+                                // Regular ASCII key
+                                key = keysym & 0xFF;
+                                keyStates[(unsigned char)key] = 1;
+                            }
                         }
-                    }
-                    break;
+                        break;
+                    case KeyRelease:
+                        keyPressed = 0;
+                        {
+                            KeySym keysym = XLookupKeysym(&event.xkey, 0);
+
+                            // Check for special keys (arrow keys)
+                            if (keysym == XK_Up || keysym == XK_Down || keysym == XK_Left || keysym == XK_Right) {
+                                // Map X11 keysyms to our arrow key constants
+                                if (keysym == XK_Up) specialKeyStates[ARROW_UP] = 0;
+                                if (keysym == XK_Down) specialKeyStates[ARROW_DOWN] = 0;
+                                if (keysym == XK_Left) specialKeyStates[ARROW_LEFT] = 0;
+                                if (keysym == XK_Right) specialKeyStates[ARROW_RIGHT] = 0;
+                            } else {
+                                // Regular ASCII key - use the key that was released (keysym), not the last pressed key
+                                unsigned char released_key = keysym & 0xFF;
+                                keyStates[released_key] = 0;
+                            }
+                        }
+                        break;
+                }
             }
-        }
-
-        // Calculate frame timing
-        clock_gettime(CLOCK_MONOTONIC, &currentTime);
-        long elapsedTime = (currentTime.tv_sec - lastFrameTime.tv_sec) * 1000000000 +
-                          (currentTime.tv_nsec - lastFrameTime.tv_nsec);
+        } while (_pacer_wait(ConnectionNumber(display)));
 
-        if (elapsedTime >= targetFrameTime) {
-            // Call user draw function
-            if (_draw) {
-                _draw();
-            }
+        // The server may still be reading the shared framebuffer
+        _wait_for_present();
 
-            // Render the framebuffer to the screen
-            _render_framebuffer();
+        _pacer_begin_frame();
+        _stats_begin_frame();
 
-            // Update frame count and time
-            frameCount++;
-            lastFrameTime = currentTime;
-        } else {
-            // Sleep to save CPU
-            sleepTime.tv_sec = 0;
-            sleepTime.tv_nsec = 1000000; // 1ms
-            nanosleep(&sleepTime, NULL);
+        // Call user draw function
+        if (_draw) {
+            P5C_TRACE_ZONE("draw");
+            _draw();
         }
+
+        // Rasterize deferred drawing and hand the frame to the exporters
+        _finish_frame();
+
+        // Render the framebuffer to the screen
+        _render_framebuffer();
+        _stats_presented();
+
+        frameCount++;
     }
 
 cleanup:
     // Clean up
+    _stop_frame_workers();
+    if (useShm) {
+        _wait_for_present();
+        XShmDetach(display, &shmInfo);
+        XSync(display, False);
+    }
     if (ximage) {
-        ximage->data = NULL; // Prevent XDestroyImage from freeing our framebuffer
+        // The conversion buffer is ours to free, the framebuffer and the
+        // shared segment are not XDestroyImage's
+        if (pixelFormat.kind != PIXEL_FORMAT_NATIVE && !useShm) free(ximage->data);
+        ximage->data = NULL;
         XDestroyImage(ximage);
+        ximage = NULL;
     }
-    if (framebuffer) {
-        free(framebuffer);
-        framebuffer = NULL;
+    _free_framebuffer();
+    if (useShm) {
+        shmdt(shmInfo.shmaddr);
+        useShm = 0;
     }
     XFreeGC(display, gc);
     XDestroyWindow(display, window);
@@ -1034,4 +5622,4 @@ cleanup:
     return 0;
 }
 
-#endif /* P5C_LINUX */
+#endif /* P5C_X11_BACKEND */